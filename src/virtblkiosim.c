@@ -21,667 +21,6367 @@ static struct gendisk            *viosim_disk;
 static        wait_queue_head_t   viosim_r_reqsz_wait_qu;
 static        wait_queue_head_t   viosim_r_block_wait_qu;
 static        wait_queue_head_t   viosim_w_block_wait_qu;
-static struct work_struct         viosim_req_task;
+static        wait_queue_head_t   viosim_ftl_batch_wait_qu;
+static struct delayed_work        viosim_rd_task;
+static struct delayed_work        viosim_wr_task;
 static struct task_struct        *viosim_usr_app;
-static struct viosim_request_map *viosim_req_map;
 
 /**
- * The wait flags for three corresponding wait queues:
+ * The requests fetched from the request queue, read and write ones
+ * dispatched separately (guarded by the request queue spin lock),
+ * so that a write waiting for the user space FTL doesn't hold up reads.
+ * Each dispatch list is a list per I/O priority class
+ * (indexed by <code>DEVICE_PRIO_*</code>).
+ */
+static struct list_head viosim_rd_reqs[DEVICE_PRIO_CLASSES];
+static struct list_head viosim_wr_reqs[DEVICE_PRIO_CLASSES];
+
+/** The dispatch and latency statistics of each I/O priority class. */
+static struct viosim_prio_stats viosim_prio_stats[DEVICE_PRIO_CLASSES];
+
+/** The throttling state of the read and write dispatch lists. */
+static struct viosim_throttle viosim_rd_throttle;
+static struct viosim_throttle viosim_wr_throttle;
+
+/**
+ * The requests waiting for the user space FTL, read and write ones,
+ * and the one handed to it (guarded by <code>viosim_req_map_mutex</code>).
+ */
+static LIST_HEAD(viosim_ftl_rd_reqs);
+static LIST_HEAD(viosim_ftl_wr_reqs);
+static struct viosim_ftl_req *viosim_ftl_cur;
+
+/**
+ * The requests fetched by the FTL in batches and not answered yet,
+ * and the tag for the next request to wait for the FTL
+ * (guarded by <code>viosim_req_map_mutex</code>).
+ */
+static LIST_HEAD(viosim_ftl_handed);
+static u32 viosim_ftl_next_tag;
+
+/** The number of reads handed to the FTL in a row ahead of a write. */
+static unsigned viosim_ftl_writes_passed;
+
+/**
+ * The eventfd the FTL has asked to be signaled through whenever
+ * a request is queued for it (guarded by <code>viosim_req_map_mutex</code>).
+ */
+static struct eventfd_ctx *viosim_ftl_evfd;
+
+/**
+ * The last-known FTL mapping (indexed by LPN): the PPN the FTL has last
+ * mapped each page to, used only with the <code>last</code> FTL fallback
+ * (guarded by <code>viosim_wr_lock</code>).
+ */
+static u64 *viosim_ftl_last;
+
+/**
+ * The reverse of the last-known FTL mapping (indexed by PPN): the LPN
+ * last mapped to each page (<code>DEVICE_MAP_PPN_NONE</code> &ndash; none),
+ * so that pages relocated by the FTL are followed.
+ */
+static u64 *viosim_ftl_last_p2l;
+
+/** Whether requests the FTL didn't answer in time are failed. */
+static bool viosim_ftl_fail;
+
+/**
+ * Whether the registered FTL has declared it maps each page to itself,
+ * so that writes it didn't answer in time may fall back, too.
+ */
+static bool viosim_ftl_identity;
+
+/**
+ * The L2P cache (indexed by LPN): the PPN the FTL has last pointed a read
+ * of each page at, or has written it to (<code>DEVICE_L2P_NONE</code>
+ * &ndash; not cached). Used only when <code>l2p_cache</code> is set.
+ */
+static u32 *viosim_l2p;
+
+/**
+ * The write stamps (indexed by LPN): the write sequence number as of
+ * the last write to each page the driver has placed or completed, so that
+ * the mapping the FTL answers a read with isn't kept if the page has been
+ * written since the read was handed to it (the answer may predate that
+ * write). Used only along with any of the mappings kept here, guarded
+ * by <code>viosim_wr_lock</code>.
+ */
+static u64 *viosim_wr_stamp;
+static u64  viosim_wr_seq;
+
+static DEFINE_SPINLOCK(viosim_wr_lock);
+
+/**
+ * The pool of free PPNs granted by the FTL (a ring), the number of them
+ * taken by writes in flight, and the journal of the writes placed to them
+ * (a ring, with room reserved for the writes in flight). Used only when
+ * <code>async_writes</code> is set, guarded by <code>viosim_async_mutex</code>.
+ */
+static u64      viosim_ppn_pool[DEVICE_PPN_POOL_MAX];
+static unsigned viosim_ppn_pool_head;
+static unsigned viosim_ppn_pool_count;
+static unsigned viosim_ppn_pool_taken;
+
+static struct viosim_journal_entry viosim_journal[DEVICE_JOURNAL_MAX];
+static unsigned                    viosim_journal_head;
+static unsigned                    viosim_journal_count;
+static unsigned                    viosim_journal_reserved;
+
+/** Serializes access to the PPN pool and the journal. */
+static DEFINE_MUTEX(viosim_async_mutex);
+
+/**
+ * The mapping exported read-only to user space (when <code>map_export</code>
+ * is set): the header, the L2P table and the valid bitmap in one
+ * <code>vmalloc_user()</code> area, along with the P2L table kept
+ * to follow pages the FTL relocates (not exported). Updates are serialized
+ * by <code>viosim_map_lock</code> and bracketed by the generation counter.
+ */
+static void                     *viosim_map;
+static struct viosim_map_header *viosim_map_hdr;
+static u64                      *viosim_map_l2p;
+static unsigned long            *viosim_map_valid;
+static u64                      *viosim_map_p2l;
+
+static DEFINE_SPINLOCK(viosim_map_lock);
+
+/** The FTL handshake statistics. */
+static struct viosim_ftl_stats viosim_ftl_stats;
+
+/**
+ * The relay channel holding the per-CPU I/O trace buffers
+ * (when <code>trace_kb</code> is set), and the number of records dropped
+ * because a buffer was full.
+ */
+static struct rchan *viosim_trace_chan;
+static atomic64_t    viosim_trace_dropped;
+
+/**
+ * Serializes access to the requests waiting for the user space FTL
+ * between the device workers and the ioctl() calls made by the FTL.
+ */
+static DEFINE_MUTEX(viosim_req_map_mutex);
+
+/**
+ * The wait flags for the read wait queues (of the request handed
+ * to the FTL):
  * <ul>
  * <li><code>viosim_r_reqsz_wait_flag</code> is for getting
  * the request size.</li>
  * <li><code>viosim_r_block_wait_flag</code> is for reading data block.</li>
- * <li><code>viosim_w_block_wait_flag</code> is for writing data block.</li>
  * </ul>
+ * Writing data block is waited for by each request on its own
+ * (<code>viosim_ftl_req.answered</code>).
+ */
+static bool viosim_r_reqsz_wait_flag;
+static bool viosim_r_block_wait_flag;
+
+/**
+ * The main working buffer: <code>data_buffer</code> is the backing store,
+ * i.e.\ the table of page-sized containers (indexed by PPN) to store all
+ * device data. Pages are allocated stripe by stripe, so that they can be
+ * placed on a chosen NUMA node or interleaved across nodes, and optionally
+ * backed by 2 MiB huge pages. (With the compressed backing store
+ * only incompressible pages live here.) Page-sized device data portions
+ * being read-modify-written go through a page buffer owned by the caller.
+ */
+static u8 **data_buffer;
+
+/**
+ * The backing store page locks, hashed by PPN: a page is read under its
+ * lock held shared and written under it held exclusive, so that accesses
+ * to different pages run concurrently, and a partial page write
+ * (read-modify-write) is atomic with respect to other accesses
+ * to the same page.
+ */
+static struct rw_semaphore viosim_page_locks[DEVICE_PAGE_LOCKS];
+
+/**
+ * The backing store snapshots (raw store only): each one a copy
+ * of the <code>data_buffer</code> table holding a reference to every page
+ * it points to, so that a page shared with a snapshot is copied before
+ * it is written (a page not shared has a single reference).
+ * Page data is accessed with <code>viosim_snap_sem</code> held shared,
+ * snapshots are taken, cloned, rolled back to, and dropped with it held
+ * exclusive.
+ */
+static u8                     **viosim_snaps[DEVICE_SNAP_SLOTS];
+static unsigned                 viosim_snap_count;
+static struct viosim_snap_stats viosim_snap_stats;
+
+static DECLARE_RWSEM(viosim_snap_sem);
+
+/**
+ * The remote store connections (when the backing store is kept
+ * by a user space server): page requests go round them by LPN, so that
+ * those to the same page are sent (and served) in order.
+ */
+static struct viosim_remote_conn  *viosim_remote_conns;
+static unsigned                    viosim_remote_nr;
+static struct viosim_remote_stats  viosim_remote_stats;
+
+/** The backing store stripes (NUMA node and allocation order of each). */
+static struct viosim_stripe *viosim_stripes;
+
+/** The number of device pages and backing store stripes. */
+static u64      viosim_nr_pages;
+static unsigned viosim_nr_stripes;
+
+/**
+ * The number of backing store stripes allocated as huge pages, and those
+ * that fell back to base pages because no huge page was available.
+ */
+static unsigned viosim_huge_stripes;
+static unsigned viosim_fallback_stripes;
+
+/** The per-NUMA-node backing store statistics (<code>nr_node_ids</code>). */
+static struct viosim_numa_stats *viosim_numa_stats;
+
+/** The debugfs directory holding device statistics. */
+static struct dentry *viosim_dbgfs_dir;
+
+/**
+ * The module parameter: The NUMA node to allocate the backing store on.
+ * <code>NUMA_NO_NODE</code> (<code>-1</code>) means the node
+ * of the CPU loading the module.
+ */
+static int numa_node = NUMA_NO_NODE;
+module_param(numa_node, int, 0444);
+MODULE_PARM_DESC(numa_node,
+    "NUMA node to allocate the backing store on (-1: local node)");
+
+/**
+ * The module parameter: Whether to interleave backing store stripes
+ * across all online NUMA nodes (overrides <code>numa_node</code>).
+ */
+static bool numa_interleave;
+module_param(numa_interleave, bool, 0444);
+MODULE_PARM_DESC(numa_interleave,
+    "Interleave backing store stripes across online NUMA nodes");
+
+/**
+ * The module parameter: The device size in blocks
+ * of <code>DEVICE_NUMBER_OF_PAGES_PER_BLOCK</code> pages (4 MiB) each.
+ */
+static unsigned nr_blocks = DEVICE_NUMBER_OF_BLOCKS;
+module_param(nr_blocks, uint, 0444);
+MODULE_PARM_DESC(nr_blocks, "Device size in blocks of 4 MiB each");
+
+/**
+ * The module parameter: Whether to back the device with 2 MiB compound pages
+ * reserved at load (one per stripe) instead of 4 KiB pages.
+ */
+static bool hugepages;
+module_param(hugepages, bool, 0444);
+MODULE_PARM_DESC(hugepages, "Back the device with 2 MiB pages");
+
+/**
+ * The module parameter: The name of the compression algorithm to keep
+ * backing store pages compressed with (e.g.\ <code>lz4</code>
+ * or <code>zstd</code>). Empty string means no compression.
+ */
+static char comp_algo[DEVICE_COMP_ALGO_NAME_MAX];
+module_param_string(comp_algo, comp_algo, sizeof(comp_algo), 0444);
+MODULE_PARM_DESC(comp_algo,
+    "Compress backing store pages with this algorithm (e.g. lz4, zstd)");
+
+/**
+ * The module parameter: Whether to detect all-zero pages on write
+ * and record them as a flag with no storage.
+ */
+static bool zero_pages;
+module_param(zero_pages, bool, 0444);
+MODULE_PARM_DESC(zero_pages, "Store all-zero pages as a flag only");
+
+/**
+ * The module parameter: Whether to deduplicate written pages by content
+ * hash, sharing one reference-counted copy among identical pages.
+ */
+static bool dedup;
+module_param(dedup, bool, 0444);
+MODULE_PARM_DESC(dedup, "Share identical pages by content hash");
+
+/**
+ * The module parameter: How to copy data to the backing store and to
+ * request buffers: <code>memcpy</code> (always cached),
+ * <code>nt</code> (non-temporal, i.e.\ streaming stores bypassing
+ * the caches, from <code>copy_nt_threshold</code> bytes on),
+ * or <code>auto</code> (non-temporal from the size at which it is found
+ * to be faster at load).
+ */
+static char copy_mode[DEVICE_COPY_MODE_NAME_MAX] = DEVICE_COPY_MODE_MEMCPY;
+module_param_string(copy_mode, copy_mode, sizeof(copy_mode), 0444);
+MODULE_PARM_DESC(copy_mode, "Copy mode: memcpy, nt, or auto");
+
+/**
+ * The module parameter: The copy size (in bytes) from which copies
+ * are non-temporal in the <code>nt</code> copy mode.
+ */
+static unsigned copy_nt_threshold = DEVICE_PAGE_SIZE;
+module_param(copy_nt_threshold, uint, 0444);
+MODULE_PARM_DESC(copy_nt_threshold,
+    "Copy size (bytes) from which copies are non-temporal (copy_mode=nt)");
+
+/**
+ * The module parameter: How many times in a row the user space FTL
+ * may be handed a read ahead of a write waiting for it
+ * (<code>0</code> &ndash; reads always go first).
+ */
+static unsigned writes_starved = DEVICE_WRITES_STARVED;
+module_param(writes_starved, uint, 0644);
+MODULE_PARM_DESC(writes_starved,
+    "Reads handed to the FTL ahead of a waiting write (0: no bound)");
+
+/**
+ * The module parameter: How long (in ms) a request waits for the user space
+ * FTL to answer (<code>0</code> &ndash; for as long as it takes).
+ */
+static unsigned ftl_timeout_ms = DEVICE_FTL_TIMEOUT_MS;
+module_param(ftl_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(ftl_timeout_ms,
+    "Time (ms) a request waits for the FTL to answer (0: forever)");
+
+/**
+ * The module parameter: What happens to a request the user space FTL
+ * didn't answer in time: it goes through with the <code>identity</code>
+ * mapping, or with the <code>last</code>-known mapping of its pages,
+ * or it <code>fail</code>s with an I/O error.
+ */
+static char ftl_fallback[DEVICE_FTL_FALLBACK_NAME_MAX]
+                                   = DEVICE_FTL_FALLBACK_IDENTITY;
+module_param_string(ftl_fallback, ftl_fallback, sizeof(ftl_fallback), 0444);
+MODULE_PARM_DESC(ftl_fallback,
+    "Request the FTL didn't answer in time: identity, last, or fail");
+
+/**
+ * The module parameter: Whether to cache the FTL's answers in the kernel,
+ * so that reads of pages mapped before are served without the FTL.
+ * The FTL then has to invalidate pages it moves on its own (e.g.\ on GC).
+ */
+static bool l2p_cache;
+module_param(l2p_cache, bool, 0444);
+MODULE_PARM_DESC(l2p_cache, "Serve reads of pages mapped before in-kernel");
+
+/**
+ * The module parameter: Whether to complete writes without waiting
+ * for the FTL, placing them to the PPNs it has granted in advance
+ * and journaling the new mappings for it to drain.
+ */
+static bool async_writes;
+module_param(async_writes, bool, 0444);
+MODULE_PARM_DESC(async_writes, "Place writes to PPNs granted by the FTL");
+
+/**
+ * The module parameter: Whether to export the mapping the FTL has answered
+ * with (L2P table and valid PPN bitmap) through the read-only
+ * <code>mmap()</code> of the <code>virtblkiosim-map</code> misc device.
+ */
+static bool map_export;
+module_param(map_export, bool, 0444);
+MODULE_PARM_DESC(map_export, "Export the L2P table and valid PPNs via mmap");
+
+/**
+ * The module parameters: The IOPS and bandwidth (bytes/s) caps of reads
+ * and writes (<code>0</code> &ndash; not capped), applied at dispatch
+ * through token buckets, each holding <code>*_burst_ms</code> worth
+ * of its rate.
+ */
+static unsigned read_iops;
+module_param(read_iops, uint, 0644);
+MODULE_PARM_DESC(read_iops, "Read IOPS cap (0: none)");
+
+static unsigned long read_bps;
+module_param(read_bps, ulong, 0644);
+MODULE_PARM_DESC(read_bps, "Read bandwidth cap in bytes/s (0: none)");
+
+static unsigned read_burst_ms = DEVICE_THROTTLE_BURST_MS;
+module_param(read_burst_ms, uint, 0644);
+MODULE_PARM_DESC(read_burst_ms, "Time (ms) reads may go above their caps");
+
+static unsigned write_iops;
+module_param(write_iops, uint, 0644);
+MODULE_PARM_DESC(write_iops, "Write IOPS cap (0: none)");
+
+static unsigned long write_bps;
+module_param(write_bps, ulong, 0644);
+MODULE_PARM_DESC(write_bps, "Write bandwidth cap in bytes/s (0: none)");
+
+static unsigned write_burst_ms = DEVICE_THROTTLE_BURST_MS;
+module_param(write_burst_ms, uint, 0644);
+MODULE_PARM_DESC(write_burst_ms, "Time (ms) writes may go above their caps");
+
+/**
+ * The module parameter: Whether requests are dispatched by their I/O
+ * priority class (real-time first, idle last) rather than in the order
+ * they came in.
+ */
+static bool prio_dispatch = true;
+module_param(prio_dispatch, bool, 0644);
+MODULE_PARM_DESC(prio_dispatch, "Dispatch requests by I/O priority class");
+
+/**
+ * The module parameter: How long (in ms) a request may be passed over
+ * by requests of a higher I/O priority class before it goes ahead of them
+ * (<code>0</code> &ndash; for as long as there are any).
+ */
+static unsigned prio_aging_ms = DEVICE_PRIO_AGING_MS;
+module_param(prio_aging_ms, uint, 0644);
+MODULE_PARM_DESC(prio_aging_ms,
+    "Time (ms) a request may be passed over by higher classes (0: no bound)");
+
+/**
+ * The module parameter: The size (KiB) of the I/O trace buffer
+ * of each CPU, exported through the debugfs relay files
+ * (<code>0</code> &ndash; no trace buffers).
+ */
+static unsigned trace_kb;
+module_param(trace_kb, uint, 0444);
+MODULE_PARM_DESC(trace_kb, "I/O trace buffer size (KiB) per CPU (0: none)");
+
+/**
+ * The module parameter: Whether completed requests are recorded
+ * in the I/O trace buffers.
+ */
+static bool trace;
+module_param(trace, bool, 0644);
+MODULE_PARM_DESC(trace, "Record completed requests in the I/O trace");
+
+/**
+ * The module parameter: The address of the user space server to keep
+ * the backing store: a Unix socket path, or an IPv4 address and a TCP
+ * port (<code>127.0.0.1:7390</code>). Empty &ndash; the store is
+ * in the kernel.
+ */
+static char remote[DEVICE_REMOTE_ADDR_MAX];
+module_param_string(remote, remote, sizeof(remote), 0444);
+MODULE_PARM_DESC(remote,
+    "Keep the backing store in a server at this socket path or IPv4:port");
+
+/** The module parameter: The number of remote store connections. */
+static unsigned remote_conns = DEVICE_REMOTE_CONNS;
+module_param(remote_conns, uint, 0444);
+MODULE_PARM_DESC(remote_conns, "Number of remote store connections");
+
+/**
+ * The module parameter: The max number of page requests in flight
+ * on each remote store connection.
+ */
+static unsigned remote_depth = DEVICE_REMOTE_DEPTH;
+module_param(remote_depth, uint, 0644);
+MODULE_PARM_DESC(remote_depth,
+                 "Max page requests in flight per remote store connection");
+
+/**
+ * The module parameter: Whether to run the copy path self-tests
+ * and microbenchmarks at load (the module isn't loaded if any case fails).
+ */
+static bool selftest;
+module_param(selftest, bool, 0444);
+MODULE_PARM_DESC(selftest, "Run the copy path self-tests at load");
+
+/**
+ * The table of backing store page entries (indexed by PPN), used when any
+ * of <code>comp_algo</code>, <code>zero_pages</code>, or <code>dedup</code>
+ * is set. A page is then either all-zero (flag), shared (dedup page),
+ * compressed (non-zero handle), raw (non-<code>NULL</code>
+ * <code>data_buffer</code> entry), or never written (none of these;
+ * reads as zeros). Except with huge pages, such a store is allocated
+ * on demand rather than upfront.
+ */
+static struct viosim_page_entry *viosim_page_table;
+
+/** The number of backing store pages currently stored raw. */
+static atomic64_t viosim_raw_pages;
+
+/**
+ * The compressed backing store (used only when <code>comp_algo</code>
+ * is set):
+ * <ul>
+ * <li><code>viosim_comp_tfm</code> is the compression transform.</li>
+ * <li><code>viosim_comp_pool</code> is the zsmalloc pool holding
+ * compressed pages in size classes.</li>
+ * <li><code>viosim_comp_buffer</code> is the scratch buffer
+ * to compress into.</li>
+ * </ul>
+ */
+static struct crypto_comp       *viosim_comp_tfm;
+static struct zs_pool           *viosim_comp_pool;
+static u8                       *viosim_comp_buffer;
+
+/** The compressed backing store statistics. */
+static struct viosim_comp_stats  viosim_comp_stats;
+
+/**
+ * Serializes the use of the compression transform and scratch buffer
+ * (along with the compress/decompress call statistics).
+ */
+static DEFINE_MUTEX(viosim_comp_mutex);
+
+/** The shared (deduplicated) pages, hashed by content. */
+static DEFINE_HASHTABLE(viosim_dedup_hash, DEVICE_DEDUP_HASH_BITS);
+
+/**
+ * Serializes access to the shared page hash table, the shared page
+ * reference counts, and the deduplication statistics.
+ */
+static DEFINE_MUTEX(viosim_dedup_mutex);
+
+/** The zero-page and deduplication statistics. */
+static struct viosim_dedup_stats viosim_dedup_stats;
+
+/**
+ * The copy size (in bytes) from which copies are non-temporal
+ * (<code>0</code> &ndash; never), as set up from the copy mode.
+ */
+static unsigned viosim_copy_nt_min;
+
+/** The copy path statistics. */
+static struct viosim_copy_stats viosim_copy_stats;
+
+/**
+ * Helper function.
+ * Copies data whose destination is not going to be read again soon
+ * (the backing store, request buffers), non-temporally from the size
+ * set up by the copy mode, so that large transfers don't evict
+ * the working set from the caches.
+ *
+ * @param dst The destination address.
+ * @param src The source address.
+ * @param len The number of bytes to copy.
+ */
+static void viosim_copy(void *dst, const void *src, const size_t len) {
+    if ((viosim_copy_nt_min != 0) && (len >= viosim_copy_nt_min)) {
+        memcpy_flushcache(dst, src, len);
+
+        /* Ordering streaming stores before whoever reads the data next. */
+        wmb();
+
+        atomic64_inc(&viosim_copy_stats.nt_copies);
+        atomic64_add(len, &viosim_copy_stats.nt_bytes);
+    } else {
+        memcpy(dst, src, len);
+
+        atomic64_inc(&viosim_copy_stats.copies);
+        atomic64_add(len, &viosim_copy_stats.bytes);
+    }
+}
+
+/**
+ * Helper function.
+ * Gets the lock guarding the backing store page.
+ *
+ * @param ppn The physical page number (PPN).
+ *
+ * @return The lock the page hashes to.
+ */
+static struct rw_semaphore *viosim_page_lock(const u64 ppn) {
+    return &viosim_page_locks[hash_64(ppn, DEVICE_PAGE_LOCK_BITS)];
+}
+
+/**
+ * Helper function.
+ * Locks the pages of a read-modify-write: the page read from shared,
+ * and the page written to exclusive (only the latter when both hash
+ * to the same lock). Locks are taken in the order of their addresses,
+ * so that two such operations over the same pages can't deadlock.
+ *
+ * @param ppn  The physical page number (PPN) to read from.
+ * @param ppnx The physical page number (PPN) to write to.
+ */
+static void viosim_page_lock_rmw(const u64 ppn, const u64 ppnx) {
+    struct rw_semaphore *r_lock = viosim_page_lock(ppn);
+    struct rw_semaphore *w_lock = viosim_page_lock(ppnx);
+
+    if (r_lock == w_lock) {
+        down_write(w_lock);
+    } else if (r_lock < w_lock) {
+        down_read(r_lock);
+        down_write(w_lock);
+    } else {
+        down_write(w_lock);
+        down_read(r_lock);
+    }
+}
+
+/**
+ * Helper function.
+ * Unlocks the pages locked by <code>viosim_page_lock_rmw(...)</code>.
+ *
+ * @param ppn  The physical page number (PPN) read from.
+ * @param ppnx The physical page number (PPN) written to.
+ */
+static void viosim_page_unlock_rmw(const u64 ppn, const u64 ppnx) {
+    struct rw_semaphore *r_lock = viosim_page_lock(ppn);
+    struct rw_semaphore *w_lock = viosim_page_lock(ppnx);
+
+    if (r_lock != w_lock) {
+        up_read(r_lock);
+    }
+
+    up_write(w_lock);
+}
+
+/**
+ * Helper function.
+ * Gets the NUMA node holding the backing store page.
+ *
+ * @param ppn The physical page number (PPN).
+ *
+ * @return The NUMA node the page is allocated on.
+ */
+static int viosim_page_node(const u64 ppn) {
+    return viosim_stripes[ppn / DEVICE_NUMBER_OF_PAGES_PER_STRIPE].node;
+}
+
+/**
+ * Helper function.
+ * Accounts a backing store page copy as either node-local or remote
+ * with respect to the CPU doing the copy.
+ *
+ * @param ppn The physical page number (PPN) being copied.
+ */
+static void viosim_numa_account(const u64 ppn) {
+    int node = viosim_page_node(ppn);
+
+    if (node == numa_node_id()) {
+        atomic64_inc(&viosim_numa_stats[node].local_copies);
+    } else {
+        atomic64_inc(&viosim_numa_stats[node].remote_copies);
+    }
+}
+
+/**
+ * Helper function.
+ * Frees the compressed copy of a backing store page (if any).
+ * Gets called with the page locked exclusive.
+ *
+ * @param ppn The physical page number (PPN).
+ */
+static void viosim_comp_handle_free(const u64 ppn) {
+    struct viosim_page_entry *entry = &viosim_page_table[ppn];
+
+    if (entry->handle == 0) {
+        return;
+    }
+
+    zs_free(viosim_comp_pool, entry->handle);
+
+    atomic64_dec(&viosim_comp_stats.comp_pages);
+    atomic64_sub(entry->size, &viosim_comp_stats.stored_bytes);
+
+    entry->handle = 0;
+    entry->size   = 0;
+}
+
+/**
+ * Helper function.
+ * Gets the raw copy of a backing store page, allocating it
+ * on the node of its stripe when the page has no storage yet.
+ * Gets called with the page locked exclusive.
+ *
+ * @param ppn The physical page number (PPN).
+ *
+ * @return The exit code indicating the status of getting the page.
+ */
+static int viosim_raw_get(const u64 ppn) {
+    int ret = EXIT_SUCCESS;
+
+    struct page *page;
+
+    if (data_buffer[ppn] != NULL) {
+        return ret;
+    }
+
+    page = alloc_pages_node(viosim_page_node(ppn), GFP_NOIO, 0);
+
+    if (page == NULL) {
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    data_buffer[ppn] = page_address(page);
+
+    atomic64_inc(&viosim_numa_stats[viosim_page_node(ppn)].alloc_pages);
+    atomic64_inc(&viosim_raw_pages);
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Frees the raw copy of a backing store page (if any).
+ * Pages of huge stripes are part of a compound page and are kept.
+ * Gets called with the page locked exclusive.
+ *
+ * @param ppn The physical page number (PPN).
  */
-static bool viosim_r_reqsz_wait_flag = true;
-static bool viosim_r_block_wait_flag = true;
-static bool viosim_w_block_wait_flag = true;
+static void viosim_raw_free(const u64 ppn) {
+    if ((data_buffer[ppn] == NULL)
+        || (viosim_stripes[ppn / DEVICE_NUMBER_OF_PAGES_PER_STRIPE].order
+                                                                   > 0)) {
+
+        return;
+    }
+
+    atomic64_dec(&viosim_numa_stats[viosim_page_node(ppn)].alloc_pages);
+    atomic64_dec(&viosim_raw_pages);
+
+    free_page((unsigned long) data_buffer[ppn]);
+
+    data_buffer[ppn] = NULL;
+}
+
+/**
+ * Helper function.
+ * Makes a raw backing store page private to the device before it is
+ * written, when it is shared with a snapshot: the device gets a copy
+ * of its own (or a blank page, when it is about to be overwritten
+ * as a whole) and drops its reference to the shared one.
+ * Gets called with the page locked exclusive.
+ *
+ * @param ppn  The physical page number (PPN).
+ * @param copy Whether to copy the page data (partial writes).
+ *
+ * @return The exit code indicating the status of unsharing the page.
+ */
+static int viosim_raw_cow(const u64 ppn, const bool copy) {
+    int ret = EXIT_SUCCESS;
+
+    struct page *page;
+    struct page *shared;
+
+    if ((viosim_snap_count == 0) || (ppn >= viosim_nr_pages)
+                                 || (data_buffer[ppn] == NULL)) {
+
+        return ret;
+    }
+
+    shared = virt_to_page(data_buffer[ppn]);
+
+    if (page_count(shared) == 1) {
+        return ret;
+    }
+
+    page = alloc_pages_node(viosim_page_node(ppn), GFP_NOIO, 0);
+
+    if (page == NULL) {
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    if (copy) {
+        memcpy(page_address(page), data_buffer[ppn], DEVICE_PAGE_SIZE);
+    }
+
+    data_buffer[ppn] = page_address(page);
+
+    /* A snapshot holds the shared page: this is never the last reference. */
+    put_page(shared);
+
+    atomic64_inc(&viosim_numa_stats[page_to_nid(page)].alloc_pages);
+    atomic64_inc(&viosim_snap_stats.cow_pages);
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Copies a backing store page table (the device's or a snapshot's),
+ * taking a reference to every page it points to.
+ * Gets called with <code>viosim_snap_sem</code> held exclusive.
+ *
+ * @param table The page table to copy.
+ *
+ * @return The copy, or <code>NULL</code> when out of memory.
+ */
+static u8 **viosim_snap_copy(u8 **table) {
+    u8 **copy = kvmalloc_array(viosim_nr_pages, sizeof(*copy), GFP_KERNEL);
+
+    u64 ppn;
+
+    if (copy == NULL) {
+        return copy;
+    }
+
+    memcpy(copy, table, sizeof(*copy) * viosim_nr_pages);
+
+    for (ppn = 0; ppn < viosim_nr_pages; ppn++) {
+        if (copy[ppn] != NULL) {
+            get_page(virt_to_page(copy[ppn]));
+        }
+
+        if ((ppn % DEVICE_NUMBER_OF_PAGES_PER_STRIPE) == 0) {
+            cond_resched();
+        }
+    }
+
+    return copy;
+}
+
+/**
+ * Helper function.
+ * Releases a backing store page table (the device's or a snapshot's),
+ * dropping its reference to every page it points to, and freeing pages
+ * along with the last one.
+ * Gets called with <code>viosim_snap_sem</code> held exclusive.
+ *
+ * @param table The page table to release.
+ */
+static void viosim_snap_release(u8 **table) {
+    struct page *page;
+
+    u64 ppn;
+
+    for (ppn = 0; ppn < viosim_nr_pages; ppn++) {
+        if (table[ppn] == NULL) {
+            continue;
+        }
+
+        page = virt_to_page(table[ppn]);
+
+        if (page_count(page) == 1) {
+            atomic64_dec(&viosim_numa_stats[page_to_nid(page)].alloc_pages);
+        }
+
+        put_page(page);
+
+        if ((ppn % DEVICE_NUMBER_OF_PAGES_PER_STRIPE) == 0) {
+            cond_resched();
+        }
+    }
+
+    kvfree(table);
+}
+
+/**
+ * Takes a snapshot of the backing store (or of another snapshot)
+ * into a slot, or rolls the device back to one, or drops one.
+ *
+ * @param cmd  The snapshot <code>ioctl()</code> call ID.
+ * @param slot The slot of the snapshot.
+ * @param src  The slot of the snapshot to clone (cloning only).
+ *
+ * @return The exit code indicating the status of the operation.
+ */
+static int viosim_snap_op(const unsigned cmd,
+                          const u32      slot,
+                          const u32      src) {
+
+    int ret = EXIT_SUCCESS;
+
+    u8 **table = NULL;
+
+    u64 start = ktime_get_ns();
+
+    /* Only kernel pages allocated one by one are reference-counted. */
+    if ((viosim_page_table != NULL) || (viosim_huge_stripes > 0)
+                                    || (data_buffer == NULL)) {
+
+        ret = -EOPNOTSUPP;
+
+        return ret;
+    }
+
+    if ((slot >= DEVICE_SNAP_SLOTS) || ((cmd == DEVICE_IOCTL_SNAP_CLONE)
+                                     && (src  >= DEVICE_SNAP_SLOTS))) {
+
+        ret = -EINVAL;
+
+        return ret;
+    }
+
+    /* Waiting for the I/O under way to complete, holding off the rest. */
+    down_write(&viosim_snap_sem);
+
+    switch (cmd) {
+    case DEVICE_IOCTL_SNAP_TAKE:
+    case DEVICE_IOCTL_SNAP_CLONE:
+        if (viosim_snaps[slot] != NULL) {
+            ret = -EBUSY;
+
+            break;
+        }
+
+        if (cmd == DEVICE_IOCTL_SNAP_TAKE) {
+            table = data_buffer;
+        } else {
+            table = viosim_snaps[src];
+        }
+
+        if (table == NULL) {
+            ret = -ENOENT;
+
+            break;
+        }
+
+        viosim_snaps[slot] = viosim_snap_copy(table);
+
+        if (viosim_snaps[slot] == NULL) {
+            ret = -ENOMEM;
+
+            break;
+        }
+
+        viosim_snap_count++;
+
+        viosim_snap_stats.taken++;
+        viosim_snap_stats.last_take_ns = ktime_get_ns() - start;
+
+        break;
+
+    case DEVICE_IOCTL_SNAP_ROLLBACK:
+        if (viosim_snaps[slot] == NULL) {
+            ret = -ENOENT;
+
+            break;
+        }
+
+        /* Swapping the page table root for a copy of the snapshot's. */
+        table = viosim_snap_copy(viosim_snaps[slot]);
+
+        if (table == NULL) {
+            ret = -ENOMEM;
+
+            break;
+        }
+
+        swap(table, data_buffer);
+
+        viosim_snap_release(table);
+
+        viosim_snap_stats.rollbacks++;
+        viosim_snap_stats.last_rollback_ns = ktime_get_ns() - start;
+
+        break;
+
+    case DEVICE_IOCTL_SNAP_DROP:
+        if (viosim_snaps[slot] == NULL) {
+            ret = -ENOENT;
+
+            break;
+        }
+
+        viosim_snap_release(viosim_snaps[slot]);
+
+        viosim_snaps[slot] = NULL;
+
+        viosim_snap_count--;
+    }
+
+    up_write(&viosim_snap_sem);
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Drops a reference to a shared (deduplicated) page,
+ * freeing it along with the last one.
+ * Gets called with <code>viosim_dedup_mutex</code> held.
+ *
+ * @param dup The <code>viosim_dedup_page</code> structure describing
+ *            the shared page.
+ */
+static void viosim_dedup_put(struct viosim_dedup_page *dup) {
+    viosim_dedup_stats.shared_refs--;
+
+    if (--dup->refcount > 0) {
+        return;
+    }
+
+    hash_del(&dup->node);
+
+    atomic64_dec(
+        &viosim_numa_stats[page_to_nid(virt_to_page(dup->data))].alloc_pages);
+
+    free_page((unsigned long) dup->data);
+    kfree(dup);
+
+    viosim_dedup_stats.shared_pages--;
+}
+
+/**
+ * Helper function.
+ * Releases whatever storage a backing store page entry holds
+ * (shared page reference, compressed copy, raw copy, zero flag).
+ * Gets called with the page locked exclusive.
+ *
+ * @param ppn The physical page number (PPN).
+ */
+static void viosim_page_release(const u64 ppn) {
+    struct viosim_page_entry *entry = &viosim_page_table[ppn];
+
+    if (entry->flags & DEVICE_PAGE_FLAG_ZERO) {
+        atomic64_dec(&viosim_dedup_stats.zero_pages);
+    }
+
+    if (entry->dup != NULL) {
+        mutex_lock(&viosim_dedup_mutex);
+
+        viosim_dedup_put(entry->dup);
+
+        mutex_unlock(&viosim_dedup_mutex);
+    }
+
+    viosim_comp_handle_free(ppn);
+    viosim_raw_free(ppn);
+
+    entry->flags = 0;
+    entry->dup   = NULL;
+}
+
+/**
+ * Inner helper function.
+ * Gets called from inside <code>viosim_dev_read_page(...)</code>
+ * for compressed pages.
+ *
+ * @param ppn    The physical page number (PPN).
+ * @param buffer The page buffer to decompress into.
+ *
+ * @return The exit code indicating the status of decompressing
+ *         the page into the page buffer.
+ */
+static int viosim_comp_read_page(const u64 ppn, u8 *buffer) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_entry *entry = &viosim_page_table[ppn];
+
+    unsigned dlen = DEVICE_PAGE_SIZE;
+
+    u64 start;
+    u8 *src;
+
+    mutex_lock(&viosim_comp_mutex);
+
+    start = ktime_get_ns();
+
+    src = zs_map_object(viosim_comp_pool, entry->handle, ZS_MM_RO);
+
+    ret = crypto_comp_decompress(viosim_comp_tfm, src, entry->size,
+                                 buffer, &dlen);
+
+    zs_unmap_object(viosim_comp_pool, entry->handle);
+
+    viosim_comp_stats.decomp_ns += ktime_get_ns() - start;
+    viosim_comp_stats.decomp_ops++;
+
+    mutex_unlock(&viosim_comp_mutex);
+
+    if ((ret != 0) || (dlen != DEVICE_PAGE_SIZE)) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _DECOMPRESS_PAGE_FAILED_ERR _NEW_LINE, ppn);
+
+        ret = -EIO;
+    }
+
+    return ret;
+}
+
+/**
+ * Inner helper function.
+ * Gets called from inside <code>viosim_dev_write_page(...)</code>
+ * when the compressed backing store is in use.
+ * Pages that do not compress below <code>DEVICE_COMP_MAX_SIZE</code>
+ * are kept raw.
+ *
+ * @param ppnx   The new physical page number (PPN).
+ * @param buffer The page buffer to store.
+ *
+ * @return The exit code indicating the status of storing the page buffer.
+ */
+static int viosim_comp_write_page(const u64 ppnx, const u8 *buffer) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_entry *entry = &viosim_page_table[ppnx];
+
+    unsigned      clen = DEVICE_COMP_BUFFER_SIZE;
+    unsigned long handle;
+
+    u64 start;
+    u8 *dst;
+
+    mutex_lock(&viosim_comp_mutex);
+
+    start = ktime_get_ns();
+
+    ret = crypto_comp_compress(viosim_comp_tfm, buffer, DEVICE_PAGE_SIZE,
+                               viosim_comp_buffer, &clen);
+
+    viosim_comp_stats.comp_ns += ktime_get_ns() - start;
+    viosim_comp_stats.comp_ops++;
+
+    /* --- Incompressible page: keeping it raw - Begin --------------------- */
+    if ((ret != 0) || (clen > DEVICE_COMP_MAX_SIZE)) {
+        mutex_unlock(&viosim_comp_mutex);
+
+        ret = viosim_raw_get(ppnx);
+
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+
+        viosim_copy(data_buffer[ppnx], buffer, DEVICE_PAGE_SIZE);
+
+        viosim_numa_account(ppnx);
+
+        viosim_comp_handle_free(ppnx);
+
+        return ret;
+    }
+    /* --- Incompressible page: keeping it raw - End ----------------------- */
+
+    viosim_comp_stats.comp_out_bytes += clen;
+
+    handle = zs_malloc(viosim_comp_pool, clen, GFP_NOIO | __GFP_NOWARN);
+
+    if (handle == 0) {
+        mutex_unlock(&viosim_comp_mutex);
+
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    dst = zs_map_object(viosim_comp_pool, handle, ZS_MM_WO);
+
+    memcpy(dst, viosim_comp_buffer, clen);
+
+    zs_unmap_object(viosim_comp_pool, handle);
+
+    mutex_unlock(&viosim_comp_mutex);
+
+    /* Dropping the previous copy only once the new one is in place. */
+    viosim_comp_handle_free(ppnx);
+    viosim_raw_free(ppnx);
+
+    entry->handle = handle;
+    entry->size   = clen;
+
+    atomic64_inc(&viosim_comp_stats.comp_pages);
+    atomic64_add(clen, &viosim_comp_stats.stored_bytes);
+
+    return ret;
+}
+
+/**
+ * Inner helper function.
+ * Gets called from inside <code>viosim_dev_write_page(...)</code>
+ * when deduplication is in use: the page gets a reference to a shared page
+ * of identical content when one exists, or a new shared page otherwise.
+ *
+ * @param ppnx   The new physical page number (PPN).
+ * @param buffer The page buffer to store.
+ *
+ * @return The exit code indicating the status of storing the page buffer.
+ */
+static int viosim_dedup_write_page(const u64 ppnx, const u8 *buffer) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_entry *entry = &viosim_page_table[ppnx];
+    struct viosim_dedup_page *dup;
+    struct page              *page;
+
+    u64 hash = xxh64(buffer, DEVICE_PAGE_SIZE, 0);
+
+    mutex_lock(&viosim_dedup_mutex);
+
+    /* --- Looking up a shared page of identical content - Begin ----------- */
+    hash_for_each_possible(viosim_dedup_hash, dup, node, hash) {
+        if ((dup->hash != hash)
+            || (memcmp(dup->data, buffer, DEVICE_PAGE_SIZE) != 0)) {
+
+            continue;
+        }
+
+        viosim_dedup_stats.hits++;
+
+        /* Rewriting the very same content: nothing to do. */
+        if (dup == entry->dup) {
+            mutex_unlock(&viosim_dedup_mutex);
+
+            return ret;
+        }
+
+        dup->refcount++;
+        viosim_dedup_stats.shared_refs++;
+
+        goto dedup_ref_taken;
+    }
+    /* --- Looking up a shared page of identical content - End ------------- */
+
+    viosim_dedup_stats.misses++;
+
+    /*
+     * The sole owner of a shared page may update it in place: no other
+     * page can take a reference to it while the mutex is held.
+     */
+    if ((entry->dup != NULL) && (entry->dup->refcount == 1)) {
+        dup = entry->dup;
+
+        hash_del(&dup->node);
+
+        memcpy(dup->data, buffer, DEVICE_PAGE_SIZE);
+
+        dup->hash = hash;
+
+        hash_add(viosim_dedup_hash, &dup->node, hash);
+
+        mutex_unlock(&viosim_dedup_mutex);
+
+        return ret;
+    }
+
+    dup  = kmalloc(sizeof(*dup), GFP_NOIO);
+    page = alloc_pages_node(viosim_page_node(ppnx), GFP_NOIO, 0);
+
+    if ((dup == NULL) || (page == NULL)) {
+        mutex_unlock(&viosim_dedup_mutex);
+
+        kfree(dup);
+
+        if (page != NULL) {
+            __free_page(page);
+        }
+
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    dup->data     = page_address(page);
+    dup->hash     = hash;
+    dup->refcount = 1;
+
+    atomic64_inc(&viosim_numa_stats[page_to_nid(page)].alloc_pages);
+
+    memcpy(dup->data, buffer, DEVICE_PAGE_SIZE);
+
+    hash_add(viosim_dedup_hash, &dup->node, hash);
+
+    viosim_dedup_stats.shared_pages++;
+    viosim_dedup_stats.shared_refs++;
+
+dedup_ref_taken:
+    mutex_unlock(&viosim_dedup_mutex);
+
+    /*
+     * The reference taken keeps the shared page alive, so the previous
+     * storage of the page (the mutex is taken again to drop a shared one)
+     * can be released now.
+     */
+    viosim_page_release(ppnx);
+
+    entry->dup = dup;
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Puts a reference to a remote store request, the last one
+ * getting it done.
+ *
+ * @param rreq The remote store request.
+ */
+static void viosim_remote_put(struct viosim_remote_req *rreq) {
+    if (atomic_dec_and_test(&rreq->pending)) {
+        rreq->done(rreq);
+    }
+}
+
+/**
+ * Helper function.
+ * Accounts a page request answered (or failed) and puts
+ * its reference to the request it is part of.
+ *
+ * @param io  The page request.
+ * @param ret The status it was answered with.
+ */
+static void viosim_remote_io_done(struct viosim_remote_io *io,
+                                  const int                ret) {
+
+    struct viosim_remote_req *rreq = io->rreq;
+
+    if (ret != EXIT_SUCCESS) {
+        atomic64_inc(&viosim_remote_stats.errors);
+
+        /* The first error is the one reported. */
+        cmpxchg(&rreq->error, EXIT_SUCCESS, ret);
+    } else {
+        atomic64_inc((io->op == DEVICE_REMOTE_OP_READ)
+                   ? &viosim_remote_stats.reads
+                   : &viosim_remote_stats.writes);
+
+        atomic64_add(ktime_get_ns() - io->start_ns,
+                     &viosim_remote_stats.lat_ns);
+    }
+
+    viosim_remote_put(rreq);
+}
+
+/**
+ * Inner helper function.
+ * Takes a free tag of a remote store connection for a page request,
+ * unless as many are in flight as allowed.
+ *
+ * @param conn The remote store connection.
+ * @param io   The page request.
+ * @param tag  The tag taken (<code>-EIO</code> &ndash; the connection
+ *             is lost).
+ *
+ * @return <code>true</code> when done, or <code>false</code> to wait
+ *         for a tag to become free.
+ */
+static bool viosim_remote_slot_try(struct viosim_remote_conn *conn,
+                                   struct viosim_remote_io   *io,
+                                   int                       *tag) {
+
+    unsigned depth = clamp_t(unsigned, READ_ONCE(remote_depth),
+                             1, DEVICE_REMOTE_DEPTH_MAX);
+
+    spin_lock(&conn->lock);
+
+    if (conn->dead) {
+        spin_unlock(&conn->lock);
+
+        *tag = -EIO;
+
+        return true;
+    }
+
+    if (conn->nr_inflight >= depth) {
+        spin_unlock(&conn->lock);
+
+        return false;
+    }
+
+    /* There is a free one: fewer than all the tags are in flight. */
+    while (conn->inflight[conn->next_tag] != NULL) {
+        conn->next_tag = (conn->next_tag + 1) % DEVICE_REMOTE_DEPTH_MAX;
+    }
+
+    *tag = conn->next_tag;
+
+    conn->inflight[*tag] = io;
+    conn->nr_inflight++;
+    conn->peak           = max(conn->peak, conn->nr_inflight);
+    conn->next_tag       = (*tag + 1) % DEVICE_REMOTE_DEPTH_MAX;
+
+    spin_unlock(&conn->lock);
+
+    return true;
+}
+
+/**
+ * Helper function.
+ * Sends a message to the remote store (followed by the data, if any).
+ * When it can't be sent (whole), the connection is shut down, so that
+ * the requests in flight on it fail.
+ *
+ * @param conn The remote store connection.
+ * @param msg  The message.
+ * @param data The data (or <code>NULL</code>).
+ * @param len  The data length.
+ *
+ * @return The exit code indicating the status of sending the message.
+ */
+static int viosim_remote_send(      struct viosim_remote_conn *conn,
+                              const struct viosim_remote_msg  *msg,
+                              const u8                        *data,
+                              const u32                        len) {
+
+    struct msghdr mh = { .msg_flags = MSG_NOSIGNAL };
+    struct kvec   vec[2];
+
+    size_t total = sizeof(*msg) + ((data != NULL) ? len : 0);
+
+    int ret;
+
+    vec[0].iov_base = (void *) msg;
+    vec[0].iov_len  = sizeof(*msg);
+    vec[1].iov_base = (void *) data;
+    vec[1].iov_len  = len;
+
+    mutex_lock(&conn->send_mutex);
+
+    ret = kernel_sendmsg(conn->sock, &mh, vec, (data != NULL) ? 2 : 1, total);
+
+    mutex_unlock(&conn->send_mutex);
+
+    if (ret != total) {
+        kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+
+        ret = -EIO;
+
+        return ret;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Helper function.
+ * Receives the given number of bytes from the remote store.
+ *
+ * @param sock   The socket.
+ * @param buffer The buffer to receive into.
+ * @param len    The number of bytes.
+ *
+ * @return The exit code indicating the status of receiving the bytes.
+ */
+static int viosim_remote_recv(struct socket *sock, void *buffer,
+                              const size_t   len) {
+
+    struct msghdr mh = { .msg_flags = 0 };
+    struct kvec   vec;
+
+    int ret;
+
+    vec.iov_base = buffer;
+    vec.iov_len  = len;
+
+    ret = kernel_recvmsg(sock, &mh, &vec, 1, len, MSG_WAITALL);
+
+    if (ret != len) {
+        ret = -EIO;
+
+        return ret;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Sends a page request to the remote store, on the connection
+ * the LPN goes to, waiting for a tag to become free first if need be.
+ * The request it is part of gets a reference, put once answered
+ * (or failed).
+ *
+ * @param rreq    The request it is part of.
+ * @param io      The page request.
+ * @param op      The operation (<code>DEVICE_REMOTE_OP_*</code>).
+ * @param lpn     The LPN (that picks the connection).
+ * @param ppn     The page read or written.
+ * @param src_ppn The page the rest of the page written comes from.
+ * @param offset  The offset within the page.
+ * @param buffer  The buffer to read into (or write from).
+ * @param len     The number of bytes.
+ */
+static void viosim_remote_submit(      struct viosim_remote_req *rreq,
+                                       struct viosim_remote_io  *io,
+                                 const u16                       op,
+                                       u64                       lpn,
+                                 const u64                       ppn,
+                                 const u64                       src_ppn,
+                                 const u32                       offset,
+                                       u8                       *buffer,
+                                 const u32                       len) {
+
+    struct viosim_remote_conn *conn;
+    struct viosim_remote_msg   msg;
+
+    int tag;
+
+    conn = &viosim_remote_conns[do_div(lpn, viosim_remote_nr)];
+
+    io->rreq   = rreq;
+    io->buffer = buffer;
+    io->len    = len;
+    io->op     = op;
+
+    atomic_inc(&rreq->pending);
+
+    if (!viosim_remote_slot_try(conn, io, &tag)) {
+        atomic64_inc(&viosim_remote_stats.slot_waits);
+
+        wait_event(conn->slot_wait, viosim_remote_slot_try(conn, io, &tag));
+    }
+
+    if (tag < 0) {
+        viosim_remote_io_done(io, tag);
+
+        return;
+    }
+
+    msg.magic    = DEVICE_REMOTE_MAGIC;
+    msg.op       = op;
+    msg.status   = 0;
+    msg.tag      = tag;
+    msg.len      = len;
+    msg.ppn      = ppn;
+    msg.src_ppn  = src_ppn;
+    msg.offset   = offset;
+    msg.reserved = 0;
+
+    io->start_ns = ktime_get_ns();
+
+    /* A request not sent is failed along with the connection. */
+    viosim_remote_send(conn, &msg, (op == DEVICE_REMOTE_OP_WRITE) ? buffer
+                                                                  : NULL,
+                       len);
+}
+
+/**
+ * Inner helper function.
+ * Fails the requests in flight on a remote store connection lost
+ * (or being closed), and any to be sent on it from now on.
+ *
+ * @param conn The remote store connection.
+ */
+static void viosim_remote_conn_fail(struct viosim_remote_conn *conn) {
+    struct viosim_remote_io *io;
+
+    unsigned tag;
+
+    spin_lock(&conn->lock);
+
+    conn->dead = true;
+
+    for (tag = 0; tag < DEVICE_REMOTE_DEPTH_MAX; tag++) {
+        io = conn->inflight[tag];
+
+        if (io == NULL) {
+            continue;
+        }
+
+        conn->inflight[tag] = NULL;
+        conn->nr_inflight--;
+
+        spin_unlock(&conn->lock);
+
+        viosim_remote_io_done(io, -EIO);
+
+        spin_lock(&conn->lock);
+    }
+
+    spin_unlock(&conn->lock);
+
+    wake_up_all(&conn->slot_wait);
+}
+
+/**
+ * Receives the answers on a remote store connection, matching them
+ * to the requests in flight by tag, until the connection is lost
+ * or shut down: a kernel thread per connection.
+ *
+ * @param data The remote store connection.
+ *
+ * @return <code>0</code> (as expected of a kernel thread).
+ */
+static int viosim_remote_rx(void *data) {
+    struct viosim_remote_conn *conn = data;
+    struct viosim_remote_msg   msg;
+    struct viosim_remote_io   *io;
+
+    bool lost;
+
+    while (!kthread_should_stop()) {
+        if (viosim_remote_recv(conn->sock, &msg, sizeof(msg))
+                                                        != EXIT_SUCCESS) {
+            break;
+        }
+
+        if ((msg.magic != DEVICE_REMOTE_MAGIC)
+         || (msg.tag   >= DEVICE_REMOTE_DEPTH_MAX)) {
+
+            break;
+        }
+
+        spin_lock(&conn->lock);
+
+        io = conn->inflight[msg.tag];
+
+        spin_unlock(&conn->lock);
+
+        if (io == NULL) {
+            break;
+        }
+
+        /* The data read goes straight where it was asked for. */
+        if ((msg.status == 0) && (io->op == DEVICE_REMOTE_OP_READ)) {
+            if ((msg.len != io->len) || (viosim_remote_recv(conn->sock,
+                                   io->buffer, io->len) != EXIT_SUCCESS)) {
+
+                break;
+            }
+        }
+
+        spin_lock(&conn->lock);
+
+        conn->inflight[msg.tag] = NULL;
+        conn->nr_inflight--;
+
+        spin_unlock(&conn->lock);
+
+        wake_up(&conn->slot_wait);
+
+        viosim_remote_io_done(io, (msg.status == 0) ? EXIT_SUCCESS : -EIO);
+    }
+
+    /* (Not when being closed.) */
+    spin_lock(&conn->lock);
+
+    lost = !conn->dead;
+
+    spin_unlock(&conn->lock);
+
+    if (lost) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _REMOTE_CONN_LOST_ERR _NEW_LINE, conn->index);
+    }
+
+    viosim_remote_conn_fail(conn);
+
+    /* Waiting to be stopped. */
+    set_current_state(TASK_INTERRUPTIBLE);
+
+    while (!kthread_should_stop()) {
+        schedule();
+
+        set_current_state(TASK_INTERRUPTIBLE);
+    }
+
+    __set_current_state(TASK_RUNNING);
+
+    return 0;
+}
+
+/**
+ * Gets called once a single page request to the remote store is done.
+ *
+ * @param rreq The remote store request.
+ */
+static void viosim_remote_page_done(struct viosim_remote_req *rreq) {
+    complete(&rreq->waited);
+}
+
+/**
+ * Helper function.
+ * Reads or writes a page of the remote store, waiting for the answer.
+ *
+ * @param op     The operation (<code>DEVICE_REMOTE_OP_*</code>).
+ * @param ppn    The physical page number (PPN).
+ * @param buffer The page buffer to read into (or write from).
+ *
+ * @return The exit code indicating the status of the page request.
+ */
+static int viosim_remote_page_io(const u16 op, const u64 ppn, u8 *buffer) {
+    struct viosim_remote_req rreq;
+    struct viosim_remote_io  io;
+
+    memset(&rreq, 0, sizeof(rreq));
+
+    init_completion(&rreq.waited);
+
+    atomic_set(&rreq.pending, 1);
+
+    rreq.done = viosim_remote_page_done;
+
+    viosim_remote_submit(&rreq, &io, op, ppn, ppn, ppn, 0, buffer,
+                         DEVICE_PAGE_SIZE);
+
+    viosim_remote_put(&rreq);
+
+    wait_for_completion(&rreq.waited);
+
+    return rreq.error;
+}
+
+/**
+ * Inner helper function.
+ * Tells the I/O priority class of a request. Requests with no class set
+ * go by the nice level of the task issuing them, i.e.\ best-effort.
+ *
+ * @param req The request.
+ *
+ * @return The I/O priority class (<code>DEVICE_PRIO_*</code>).
+ */
+static unsigned viosim_req_prio_class(struct request *req) {
+    switch (IOPRIO_PRIO_CLASS(req_get_ioprio(req))) {
+    case IOPRIO_CLASS_RT:
+        return DEVICE_PRIO_RT;
+    case IOPRIO_CLASS_IDLE:
+        return DEVICE_PRIO_IDLE;
+    default:
+        return DEVICE_PRIO_BE;
+    }
+}
+
+/**
+ * Inner helper function.
+ * Tells whether any requests are waiting in a dispatch list.
+ *
+ * @param reqs The dispatch list (a list per I/O priority class).
+ *
+ * @return <code>true</code> if there are requests waiting.
+ */
+static bool viosim_reqs_waiting(const struct list_head *reqs) {
+    unsigned i;
+
+    for (i = 0; i < DEVICE_PRIO_CLASSES; i++) {
+        if (!list_empty(&reqs[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Processes requests that have been placed on the queue: sorts them
+ * into the read and write dispatch lists (by I/O priority class,
+ * when <code>prio_dispatch</code> is set) and kicks their workers.
+ */
+static void viosim_req_proc(void) {
+    struct request *req;
+
+    u64 lpn;
+
+    unsigned cls;
+
+    int cpu = WORK_CPU_UNBOUND;
+
+    /*
+     * Peeking at the first pending request to pick a CPU on the NUMA node
+     * holding its stripe, so that the copy loop runs node-locally.
+     * (The queue lock is held here by the block layer.)
+     */
+    req = blk_peek_request(viosim_req_qu);
+
+    if (req != NULL) {
+        lpn = blk_rq_pos(req) / DEVICE_NUMBER_OF_SECTORS_PER_PAGE;
+
+        if (lpn < viosim_nr_pages) {
+            cpu = cpumask_any_and(cpumask_of_node(viosim_page_node(lpn)),
+                                  cpu_online_mask);
+
+            /* Memoryless or CPU-less node: let the workqueue decide. */
+            if (cpu >= nr_cpu_ids) {
+                cpu = WORK_CPU_UNBOUND;
+            }
+        }
+    }
+
+    while ((req = blk_fetch_request(viosim_req_qu)) != NULL) {
+        cls = READ_ONCE(prio_dispatch) ? viosim_req_prio_class(req)
+                                       : DEVICE_PRIO_BE;
+
+        if (rq_data_dir(req) == 0) {
+            list_add_tail(&req->queuelist, &viosim_rd_reqs[cls]);
+        } else {
+            list_add_tail(&req->queuelist, &viosim_wr_reqs[cls]);
+        }
+
+        viosim_prio_stats[cls].queued++;
+    }
+
+    /*
+     * Putting the tasks in the kernel-global workqueue. (A task already
+     * waiting for its token bucket to refill is left waiting.)
+     */
+    if (viosim_reqs_waiting(viosim_rd_reqs)) {
+        queue_delayed_work_on(cpu, system_wq, &viosim_rd_task, 0);
+    }
+
+    if (viosim_reqs_waiting(viosim_wr_reqs)) {
+        queue_delayed_work_on(cpu, system_wq, &viosim_wr_task, 0);
+    }
+}
+
+/**
+ * Inner helper function.
+ * Gets called from inside <code>viosim_dev_read(...)</code>
+ * and <code>viosim_dev_write(...)</code> helpers.
+ * Gets called with the page locked (shared at least).
+ *
+ * @param ppn    The physical page number (PPN).
+ * @param buffer The page buffer to read the page into.
+ *
+ * @return The exit code indicating the status of reading a page of data
+ *         from the device.
+ */
+static int viosim_dev_read_page(const u64 ppn, u8 *buffer) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_entry *entry;
+
+    if (ppn >= viosim_nr_pages) {
+        /* No such page (e.g. an LPN left unmapped by the FTL): zeros. */
+        memset(buffer, 0, DEVICE_PAGE_SIZE);
+
+        /* Returning "success" anyway, because it's not an error. */
+        return ret;
+    }
+
+    /* The store is kept by a user space server: asking it for the page. */
+    if (viosim_remote_conns != NULL) {
+        return viosim_remote_page_io(DEVICE_REMOTE_OP_READ, ppn, buffer);
+    }
+
+    /* --- Reading pages not stored raw - Begin --------------------------- */
+    if (viosim_page_table != NULL) {
+        entry = &viosim_page_table[ppn];
+
+        /* All-zero or never written page: reading zeros. */
+        if ((entry->flags & DEVICE_PAGE_FLAG_ZERO)
+            || ((entry->dup    == NULL) && (entry->handle == 0)
+                                        && (data_buffer[ppn] == NULL))) {
+
+            memset(buffer, 0, DEVICE_PAGE_SIZE);
+
+            return ret;
+        }
+
+        if (entry->dup != NULL) {
+            memcpy(buffer, entry->dup->data, DEVICE_PAGE_SIZE);
+
+            return ret;
+        }
+
+        if (entry->handle != 0) {
+            return viosim_comp_read_page(ppn, buffer);
+        }
+    }
+    /* --- Reading pages not stored raw - End ----------------------------- */
+
+    /*
+     * Copying one-page data portion from the consolidated data buffer
+     * into the page buffer, i.e. reading the data page.
+     */
+    memcpy(buffer, data_buffer[ppn], DEVICE_PAGE_SIZE);
+
+    viosim_numa_account(ppn);
+
+    return ret;
+}
+
+/**
+ * Helper (wrapper) function.
+ * Reads data from the device.
+ *
+ * @param req_map The <code>viosim_request_map</code> structure which holds
+ *                the device read/write request mapping data (one page).
+ * @param segs    The request data segments within the page.
+ * @param nr_segs The number of segments.
+ * @param buffer  The page buffer to use (the caller's own).
+ *
+ * @return The exit code indicating the status of reading data from the device.
+ */
+static int viosim_dev_read(      struct viosim_request_map *req_map,
+                           const struct viosim_request_seg *segs,
+                           const unsigned                   nr_segs,
+                                 u8                        *buffer) {
+
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_map *page_map = &req_map->page_map;
+
+    /* Getting the PPN from page map. */
+    u64 ppn = page_map->ppn;
+
+    /* The page data to copy the segments from. */
+    u8 *src = buffer;
+
+    struct rw_semaphore *lock;
+
+    unsigned i;
+
+    lock = viosim_page_lock(ppn);
+
+    down_read(lock);
+
+    if ((viosim_page_table  == NULL) && (viosim_remote_conns == NULL)
+                                     && (ppn < viosim_nr_pages)) {
+
+        /* A raw page is copied from straight. */
+        src = data_buffer[ppn];
+
+        viosim_numa_account(ppn);
+    } else {
+        /*
+         * Reading a page of data from the device.
+         * Here the page buffer is populated.
+         */
+        ret = viosim_dev_read_page(ppn, buffer);
+    }
+
+    /*
+     * Copying the sectors-occupied data portion of each segment
+     * from the page into the read/write request buffer.
+     */
+    for (i = 0; i < nr_segs; i++) {
+        viosim_copy(segs[i].buffer,
+                    src + ((segs[i].start_sector
+                          % DEVICE_NUMBER_OF_SECTORS_PER_PAGE)
+                          * DEVICE_SECTOR_SIZE),
+                    (segs[i].num_of_sectors * DEVICE_SECTOR_SIZE));
+    }
+
+    up_read(lock);
+
+    return ret;
+}
+
+/**
+ * Inner helper function.
+ * Gets called from inside <code>viosim_dev_write(...)</code> helper.
+ * Gets called with the page locked exclusive.
+ *
+ * @param ppnx   The new physical page number (PPN).
+ * @param buffer The page buffer to write the page from.
+ *
+ * @return The exit code indicating the status of writing a page of data
+ *         to the device.
+ */
+static int viosim_dev_write_page(const u64 ppnx, const u8 *buffer) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_entry *entry;
+
+    if (ppnx >= viosim_nr_pages) {
+        pr_warn_ratelimited(_MODULE_NAME _COLON_SPACE_SEP \
+                            _WRITE_CAPACITY_REACHED_MSG _NEW_LINE);
+
+        /* No page to write to (e.g. the FTL is out of space): failing. */
+        ret = -ENOSPC;
+
+        return ret;
+    }
+
+    /* The store is kept by a user space server: handing it the page. */
+    if (viosim_remote_conns != NULL) {
+        return viosim_remote_page_io(DEVICE_REMOTE_OP_WRITE, ppnx,
+                                     (u8 *) buffer);
+    }
+
+    /* --- Storing pages not to be kept raw - Begin ----------------------- */
+    if (viosim_page_table != NULL) {
+        entry = &viosim_page_table[ppnx];
+
+        /* All-zero page: recording the flag, dropping any storage. */
+        if (zero_pages
+            && (memchr_inv(buffer, 0, DEVICE_PAGE_SIZE) == NULL)) {
+
+            viosim_page_release(ppnx);
+
+            entry->flags |= DEVICE_PAGE_FLAG_ZERO;
+
+            atomic64_inc(&viosim_dedup_stats.zero_pages);
+            atomic64_inc(&viosim_dedup_stats.zero_writes);
+
+            return ret;
+        }
+
+        if (entry->flags & DEVICE_PAGE_FLAG_ZERO) {
+            entry->flags &= ~DEVICE_PAGE_FLAG_ZERO;
+
+            atomic64_dec(&viosim_dedup_stats.zero_pages);
+        }
+
+        if (dedup) {
+            return viosim_dedup_write_page(ppnx, buffer);
+        }
+
+        if (viosim_comp_tfm != NULL) {
+            return viosim_comp_write_page(ppnx, buffer);
+        }
+
+        ret = viosim_raw_get(ppnx);
+
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+    }
+    /* --- Storing pages not to be kept raw - End ------------------------- */
+
+    /* A page shared with a snapshot is replaced as a whole. */
+    ret = viosim_raw_cow(ppnx, false);
+
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    /*
+     * Copying one-page data portion from the page buffer
+     * into the consolidated data buffer, i.e. writing the data page.
+     */
+    viosim_copy(data_buffer[ppnx], buffer, DEVICE_PAGE_SIZE);
+
+    viosim_numa_account(ppnx);
+
+    return ret;
+}
+
+/**
+ * Helper (wrapper) function.
+ * Writes data to the device.
+ *
+ * @param req_map The <code>viosim_request_map</code> structure which holds
+ *                the device read/write request mapping data (one page).
+ * @param segs    The request data segments within the page.
+ * @param nr_segs The number of segments.
+ * @param buffer  The page buffer to use (the caller's own).
+ *
+ * @return The exit code indicating the status of writing data to the device.
+ */
+static int viosim_dev_write(      struct viosim_request_map *req_map,
+                            const struct viosim_request_seg *segs,
+                            const unsigned                   nr_segs,
+                                  u8                        *buffer) {
+
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_page_map *page_map = &req_map->page_map;
+
+    /* Getting the PPN from page map. */
+    u64 ppn = page_map->ppn;
+
+    /* Getting the new PPN from page map (for write). */
+    u64 ppnx = page_map->ppnx;
+
+    /* Getting the number of sectors of the page written. */
+    u64 num_of_sectors = req_map->num_of_sectors;
+
+    /* The page data to copy the segments to. */
+    u8 *dst = buffer;
+
+    unsigned i;
+
+    /* --- Performing the "Read-Modify-Write" atomic operation - Begin ----- */
+    viosim_page_lock_rmw(ppn, ppnx);
+
+    if ((viosim_page_table  == NULL) && (viosim_remote_conns == NULL)
+                                     && (ppn == ppnx)
+                                     && (ppnx < viosim_nr_pages)) {
+
+        /* A raw page written in place is patched straight. */
+        ret = viosim_raw_cow(ppnx, true);
+
+        if (ret != EXIT_SUCCESS) {
+            goto rmw_done;
+        }
+
+        dst = data_buffer[ppnx];
+
+        viosim_numa_account(ppnx);
+    } else if (num_of_sectors < DEVICE_NUMBER_OF_SECTORS_PER_PAGE) {
+        /* (1) Read                                              */
+        /* Reading a page of data from the device                */
+        /* (unless the request overwrites all of it).            */
+        /* Here the page buffer is populated.                    */
+        ret = viosim_dev_read_page(ppn, buffer);
+
+        if (ret != EXIT_SUCCESS) {
+            goto rmw_done;
+        }
+    }
+
+    /* (2) Modify                                                      */
+    /* Copying the sectors-occupied data portion of each segment       */
+    /* from the read/write request buffer into the page.               */
+    for (i = 0; i < nr_segs; i++) {
+        u8 *seg_dst = dst + ((segs[i].start_sector
+                            % DEVICE_NUMBER_OF_SECTORS_PER_PAGE)
+                            * DEVICE_SECTOR_SIZE);
+
+        if (dst == buffer) {
+            memcpy(seg_dst, segs[i].buffer,
+                   (segs[i].num_of_sectors * DEVICE_SECTOR_SIZE));
+        } else {
+            viosim_copy(seg_dst, segs[i].buffer,
+                        (segs[i].num_of_sectors * DEVICE_SECTOR_SIZE));
+        }
+    }
+
+    /* (3) Write                                */
+    /* Writing data page to the device.         */
+    /* Here the data_buffer array is populated. */
+    if (dst == buffer) {
+        ret = viosim_dev_write_page(ppnx, buffer);
+    }
+
+rmw_done:
+    viosim_page_unlock_rmw(ppn, ppnx);
+    /* --- Performing the "Read-Modify-Write" atomic operation - End ------- */
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Adds a request segment to the request map, one entry per device page
+ * the segment spans: a segment may start in the middle of a page and run
+ * into the next one, whereas an entry is always within a page, and
+ * sector-contiguous segments falling into the same page are coalesced
+ * into a single entry. The segment list gets a segment per page
+ * (merged with the previous one when contiguous in memory as well).
+ *
+ * @param req_map    The request map entries.
+ * @param req_size   The number of entries filled in so far (gets updated).
+ * @param segs       The request data segments.
+ * @param nr_segs    The number of segments so far (gets updated).
+ * @param lba        The starting sector of the segment.
+ * @param buffer     The segment data buffer.
+ * @param len        The segment length in bytes.
+ * @param transf_dir The data transfer direction.
+ */
+static void viosim_req_map_fill(      struct viosim_request_map *req_map,
+                                      unsigned                  *req_size,
+                                      struct viosim_request_seg *segs,
+                                      unsigned                  *nr_segs,
+                                const u64                        lba,
+                                      u8                        *buffer,
+                                const unsigned                   len,
+                                const int                        transf_dir) {
+
+    struct viosim_request_map *viosim_rq_map = NULL;
+    struct viosim_page_map    *viosim_pg_map;
+    struct viosim_request_seg *viosim_rq_seg = NULL;
+
+    u64      sector = lba;
+    unsigned left   = len / DEVICE_SECTOR_SIZE;
+    unsigned count;
+
+    while (left > 0) {
+        count = min_t(unsigned, left, DEVICE_NUMBER_OF_SECTORS_PER_PAGE
+                    - (sector % DEVICE_NUMBER_OF_SECTORS_PER_PAGE));
+
+        if (*req_size > 0) {
+            viosim_rq_map = &req_map[*req_size - 1];
+        }
+
+        /* --- Starting an entry for a page not seen yet - Begin --------- */
+        if ((viosim_rq_map == NULL) || (viosim_rq_map->page_map.lpn
+                            != (sector / DEVICE_NUMBER_OF_SECTORS_PER_PAGE))) {
+
+            viosim_rq_map = &req_map[(*req_size)++];
+            viosim_pg_map = &viosim_rq_map->page_map;
+
+            /* The logical page number (LPN). */
+            viosim_pg_map->lpn = sector / DEVICE_NUMBER_OF_SECTORS_PER_PAGE;
+
+            /*
+             * Identity mapping by default: the user space FTL overrides
+             * the PPN (and the new PPN for writes) when it remaps the page.
+             */
+            viosim_pg_map->ppn  = viosim_pg_map->lpn;
+            viosim_pg_map->ppnx = viosim_pg_map->lpn;
+
+            viosim_pg_map->transf_dir = transf_dir; /* Read or write. */
+
+            viosim_rq_map->start_sector   = sector;
+            viosim_rq_map->num_of_sectors = 0;
+            viosim_rq_map->req_buffer     = buffer;
+        }
+        /* --- Starting an entry for a page not seen yet - End ----------- */
+
+        viosim_rq_map->num_of_sectors += count;
+
+        if (*nr_segs > 0) {
+            viosim_rq_seg = &segs[*nr_segs - 1];
+        }
+
+        if ((viosim_rq_seg == NULL)
+            || (viosim_rq_seg->entry != (*req_size - 1))
+            || ((viosim_rq_seg->buffer + (viosim_rq_seg->num_of_sectors
+                                        * DEVICE_SECTOR_SIZE)) != buffer)) {
+
+            viosim_rq_seg = &segs[(*nr_segs)++];
+
+            viosim_rq_seg->entry          = *req_size - 1;
+            viosim_rq_seg->num_of_sectors = 0;
+            viosim_rq_seg->start_sector   = sector;
+            viosim_rq_seg->buffer         = buffer;
+        }
+
+        viosim_rq_seg->num_of_sectors += count;
+
+        buffer += count * DEVICE_SECTOR_SIZE;
+        sector += count;
+        left   -= count;
+    }
+}
+
+/**
+ * Helper function.
+ * Performs the read/write ops of a request map, page by page,
+ * stopping at the first one that fails.
+ *
+ * @param req_map    The request map entries.
+ * @param req_size   The number of entries.
+ * @param segs       The request data segments (in the order of entries).
+ * @param nr_segs    The number of segments.
+ * @param transf_dir The data transfer direction.
+ * @param buffer     The page buffer to use (the caller's own).
+ *
+ * @return The exit code indicating the status of the ops performed
+ *         (that of the failing one, if any).
+ */
+static int viosim_req_map_exec(      struct viosim_request_map *req_map,
+                               const unsigned                   req_size,
+                               const struct viosim_request_seg *segs,
+                               const unsigned                   nr_segs,
+                               const int                        transf_dir,
+                                     u8                        *buffer) {
+
+    int ret = EXIT_SUCCESS;
+
+    unsigned i;
+    unsigned first = 0;
+    unsigned last;
+
+    /* (No snapshot is taken or rolled back to amid the request.) */
+    down_read(&viosim_snap_sem);
+
+    for (i = 0; (ret == EXIT_SUCCESS) && (i < req_size); i++) {
+        /* Picking the segments of the page. */
+        for (last = first; (last < nr_segs) && (segs[last].entry == i); last++);
+
+        if (transf_dir == 0) {
+            ret = viosim_dev_read( &req_map[i], &segs[first], last - first,
+                                   buffer);
+        } else {
+            ret = viosim_dev_write(&req_map[i], &segs[first], last - first,
+                                   buffer);
+        }
+
+        first = last;
+    }
+
+    up_read(&viosim_snap_sem);
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Invalidates a range of the L2P cache (if it is in use).
+ *
+ * @param lpn      The first logical page number (LPN).
+ * @param nr_pages The number of pages (<code>0</code> &ndash; all of them).
+ */
+static void viosim_l2p_invalidate(const u64 lpn, const u64 nr_pages) {
+    u64 end = (nr_pages == 0) ? viosim_nr_pages : (lpn + nr_pages);
+    u64 i;
+
+    if (viosim_l2p == NULL) {
+        return;
+    }
+
+    for (i = (nr_pages == 0) ? 0 : lpn; i < end; i++) {
+        WRITE_ONCE(viosim_l2p[i], DEVICE_L2P_NONE);
+    }
+}
+
+/**
+ * Helper function.
+ * Caches the page mapping the FTL has answered with.
+ *
+ * @param lpn The logical page number (LPN).
+ * @param ppn The physical page number (PPN) the page is at
+ *            (an unmapped one is not cached).
+ */
+static void viosim_l2p_update(const u64 lpn, const u64 ppn) {
+    if ((viosim_l2p == NULL) || (lpn >= viosim_nr_pages)) {
+        return;
+    }
+
+    WRITE_ONCE(viosim_l2p[lpn], (ppn < viosim_nr_pages) ? (u32) ppn
+                                                        : DEVICE_L2P_NONE);
+}
+
+/**
+ * Helper function.
+ * Stamps a page as written as of now.
+ * Gets called with <code>viosim_wr_lock</code> held.
+ *
+ * @param lpn The logical page number (LPN).
+ */
+static void viosim_wr_stamp_page(const u64 lpn) {
+    if ((viosim_wr_stamp == NULL) || (lpn >= viosim_nr_pages)) {
+        return;
+    }
+
+    viosim_wr_stamp[lpn] = ++viosim_wr_seq;
+}
+
+/**
+ * Helper function.
+ * Tells whether a page has been written since the given write sequence
+ * number. Gets called with <code>viosim_wr_lock</code> held.
+ *
+ * @param lpn    The logical page number (LPN).
+ * @param wr_seq The write sequence number.
+ *
+ * @return <code>true</code> if the page has been written since.
+ */
+static bool viosim_wr_since(const u64 lpn, const u64 wr_seq) {
+    return (viosim_wr_stamp != NULL) && (lpn < viosim_nr_pages)
+                                     && (viosim_wr_stamp[lpn] > wr_seq);
+}
+
+/**
+ * Helper function.
+ * Records where a page lives now in the last-known FTL mapping
+ * (if it is in use). Gets called with <code>viosim_wr_lock</code> held.
+ *
+ * @param lpn The logical page number (LPN).
+ * @param ppn The physical page number (PPN).
+ */
+static void viosim_ftl_last_set(const u64 lpn, const u64 ppn) {
+    u64 old;
+
+    if ((viosim_ftl_last == NULL) || (lpn >= viosim_nr_pages)
+                                  || (ppn >= viosim_nr_pages)) {
+
+        return;
+    }
+
+    old = viosim_ftl_last[lpn];
+
+    if (viosim_ftl_last_p2l[old] == lpn) {
+        viosim_ftl_last_p2l[old] = DEVICE_MAP_PPN_NONE;
+    }
+
+    viosim_ftl_last[lpn]     = ppn;
+    viosim_ftl_last_p2l[ppn] = lpn;
+}
+
+/**
+ * Helper function.
+ * Moves the page relocated by the FTL in the last-known FTL mapping
+ * (if it is in use and the page is mapped there).
+ *
+ * @param src_ppn The physical page number (PPN) copied from.
+ * @param dst_ppn The physical page number (PPN) copied to.
+ */
+static void viosim_ftl_last_move(const u64 src_ppn, const u64 dst_ppn) {
+    u64 lpn;
+
+    if ((viosim_ftl_last == NULL) || (src_ppn >= viosim_nr_pages)) {
+        return;
+    }
+
+    spin_lock(&viosim_wr_lock);
+
+    lpn = viosim_ftl_last_p2l[src_ppn];
+
+    if (lpn != DEVICE_MAP_PPN_NONE) {
+        viosim_ftl_last_set(lpn, dst_ppn);
+    }
+
+    spin_unlock(&viosim_wr_lock);
+}
+
+/**
+ * Helper function.
+ * Maps a read request from the L2P cache, when all of its pages are
+ * cached (the map is left as is otherwise).
+ *
+ * @param req_map  The request map entries.
+ * @param req_size The number of entries.
+ *
+ * @return <code>true</code> if the request has been mapped.
+ */
+static bool viosim_l2p_lookup(struct viosim_request_map *req_map,
+                              const unsigned             req_size) {
+
+    u32 ppn;
+
+    unsigned i;
+
+    for (i = 0; i < req_size; i++) {
+        if ((req_map[i].page_map.lpn >= viosim_nr_pages)
+            || (READ_ONCE(viosim_l2p[req_map[i].page_map.lpn])
+                                               == DEVICE_L2P_NONE)) {
+
+            return false;
+        }
+    }
+
+    for (i = 0; i < req_size; i++) {
+        ppn = READ_ONCE(viosim_l2p[req_map[i].page_map.lpn]);
+
+        /* Invalidated in the meantime: the identity mapping stays. */
+        if (ppn != DEVICE_L2P_NONE) {
+            req_map[i].page_map.ppn  = ppn;
+            req_map[i].page_map.ppnx = ppn;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Helper function.
+ * Maps the LPN onto the PPN in the mapping export, invalidating the page
+ * it was mapped onto (and unmapping the LPN the PPN was holding before).
+ * Gets called with <code>viosim_map_lock</code> held.
+ *
+ * @param lpn The logical page number (LPN).
+ * @param ppn The physical page number (PPN).
+ */
+static void viosim_map_set(const u64 lpn, const u64 ppn) {
+    u64 gen = viosim_map_hdr->generation;
+    u64 old = viosim_map_l2p[lpn];
+    u64 own = viosim_map_p2l[ppn];
+
+    /* Reads of pages mapped as known leave it as is. */
+    if (old == ppn) {
+        return;
+    }
+
+    WRITE_ONCE(viosim_map_hdr->generation, gen + 1);
+
+    smp_wmb();
+
+    if (old != DEVICE_MAP_PPN_NONE) {
+        clear_bit(old, viosim_map_valid);
+
+        viosim_map_p2l[old] = DEVICE_MAP_PPN_NONE;
+    }
+
+    if (own != DEVICE_MAP_PPN_NONE) {
+        WRITE_ONCE(viosim_map_l2p[own], DEVICE_MAP_PPN_NONE);
+    }
+
+    WRITE_ONCE(viosim_map_l2p[lpn], ppn);
+
+    viosim_map_p2l[ppn] = lpn;
+
+    set_bit(ppn, viosim_map_valid);
+
+    smp_wmb();
+
+    WRITE_ONCE(viosim_map_hdr->generation, gen + 2);
+}
+
+/**
+ * Helper function.
+ * Records the mapping the FTL has answered with in the mapping export
+ * (if it is in use).
+ *
+ * @param lpn The logical page number (LPN).
+ * @param ppn The physical page number (PPN) the page is at
+ *            (an unmapped one is not recorded).
+ */
+static void viosim_map_update(const u64 lpn, const u64 ppn) {
+    if ((viosim_map == NULL) || (lpn >= viosim_nr_pages)
+                             || (ppn >= viosim_nr_pages)) {
+
+        return;
+    }
+
+    spin_lock(&viosim_map_lock);
+
+    viosim_map_set(lpn, ppn);
+
+    spin_unlock(&viosim_map_lock);
+}
+
+/**
+ * Helper function.
+ * Moves the page relocated by the FTL in the mapping export
+ * (if it is in use and the page is mapped, as known).
+ *
+ * @param src_ppn The physical page number (PPN) copied from.
+ * @param dst_ppn The physical page number (PPN) copied to.
+ */
+static void viosim_map_move(const u64 src_ppn, const u64 dst_ppn) {
+    u64 lpn;
+
+    if ((viosim_map == NULL) || (src_ppn >= viosim_nr_pages)
+                             || (dst_ppn >= viosim_nr_pages)) {
+
+        return;
+    }
+
+    spin_lock(&viosim_map_lock);
+
+    lpn = viosim_map_p2l[src_ppn];
+
+    if (lpn != DEVICE_MAP_PPN_NONE) {
+        viosim_map_set(lpn, dst_ppn);
+    }
+
+    spin_unlock(&viosim_map_lock);
+}
+
+/**
+ * Helper function.
+ * Forgets the whole mapping export (if it is in use), e.g.\ for another
+ * FTL that maps pages differently.
+ */
+static void viosim_map_reset(void) {
+    u64 gen;
+
+    if (viosim_map == NULL) {
+        return;
+    }
+
+    spin_lock(&viosim_map_lock);
+
+    gen = viosim_map_hdr->generation;
+
+    WRITE_ONCE(viosim_map_hdr->generation, gen + 1);
+
+    smp_wmb();
+
+    memset(viosim_map_l2p,   0xff, viosim_nr_pages * sizeof(u64));
+    memset(viosim_map_p2l,   0xff, viosim_nr_pages * sizeof(u64));
+    memset(viosim_map_valid, 0,    BITS_TO_LONGS(viosim_nr_pages)
+                                 * sizeof(unsigned long));
+
+    smp_wmb();
+
+    WRITE_ONCE(viosim_map_hdr->generation, gen + 2);
+
+    spin_unlock(&viosim_map_lock);
+}
+
+/**
+ * Maps the mapping export read-only into user space.
+ *
+ * @param file The file of the misc device.
+ * @param vma  The user space memory area to map the export into.
+ *
+ * @return The exit code indicating the mapping status.
+ */
+static int viosim_map_mmap(struct file *file, struct vm_area_struct *vma) {
+    /* The mapping is the kernel's to update only. */
+    if (vma->vm_flags & VM_WRITE) {
+        return -EPERM;
+    }
+
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_vmalloc_range(vma, viosim_map, vma->vm_pgoff);
+}
+
+/** The mapping export misc device operations. */
+static const struct file_operations viosim_map_fops = {
+    .owner = THIS_MODULE,
+    .mmap  = viosim_map_mmap,
+};
+
+/** The mapping export misc device. */
+static struct miscdevice viosim_map_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = DEVICE_MAP_MISC_NAME,
+    .fops  = &viosim_map_fops,
+    .mode  = 0444,
+};
+
+/**
+ * Helper function.
+ * Places a write request to PPNs granted by the FTL, when there are enough
+ * of them and room in the journal, and the pages written only in part are
+ * in the L2P cache (to be read before written). The PPNs are taken
+ * and the journal room reserved until <code>viosim_async_commit()</code>.
+ *
+ * @param req_map  The request map entries.
+ * @param req_size The number of entries.
+ *
+ * @return <code>true</code> if the request has been placed.
+ */
+static bool viosim_async_place(struct viosim_request_map *req_map,
+                               const unsigned             req_size) {
+
+    bool placed = false;
+
+    u32 ppn;
+
+    unsigned i;
+
+    mutex_lock(&viosim_async_mutex);
+
+    if ((viosim_ppn_pool_count < req_size) || (viosim_journal_count
+        + viosim_journal_reserved + req_size > DEVICE_JOURNAL_MAX)) {
+
+        goto async_place_unlock;
+    }
+
+    for (i = 0; i < req_size; i++) {
+        if (req_map[i].num_of_sectors == DEVICE_NUMBER_OF_SECTORS_PER_PAGE) {
+            continue;
+        }
+
+        if ((viosim_l2p == NULL) || (req_map[i].page_map.lpn
+            >= viosim_nr_pages) || (READ_ONCE(viosim_l2p[
+            req_map[i].page_map.lpn]) == DEVICE_L2P_NONE)) {
+
+            goto async_place_unlock;
+        }
+    }
+
+    spin_lock(&viosim_wr_lock);
+
+    for (i = 0; i < req_size; i++) {
+        struct viosim_page_map *viosim_pg_map = &req_map[i].page_map;
+
+        /* Full pages aren't read, so an unknown PPN to read from is fine. */
+        if (viosim_l2p != NULL) {
+            ppn = READ_ONCE(viosim_l2p[viosim_pg_map->lpn]);
+
+            if (ppn != DEVICE_L2P_NONE) {
+                viosim_pg_map->ppn = ppn;
+            }
+        }
+
+        viosim_pg_map->ppnx = viosim_ppn_pool[viosim_ppn_pool_head];
+
+        viosim_ppn_pool_head = (viosim_ppn_pool_head + 1)
+                             % DEVICE_PPN_POOL_MAX;
+
+        /* The FTL doesn't know of the page's new place until it drains. */
+        viosim_wr_stamp_page(viosim_pg_map->lpn);
+    }
+
+    spin_unlock(&viosim_wr_lock);
+
+    viosim_ppn_pool_count   -= req_size;
+    viosim_ppn_pool_taken   += req_size;
+    viosim_journal_reserved += req_size;
+
+    placed = true;
+
+async_place_unlock:
+    mutex_unlock(&viosim_async_mutex);
+
+    return placed;
+}
+
+/**
+ * Helper function.
+ * Journals the writes placed by <code>viosim_async_place()</code>
+ * once they are done.
+ *
+ * @param req_map  The request map entries.
+ * @param req_size The number of entries.
+ * @param done     Whether the writes have succeeded. A failed write's PPN
+ *                 is not journaled: the FTL may still map the page
+ *                 to where it was, and the PPN is lost to it.
+ */
+static void viosim_async_commit(struct viosim_request_map *req_map,
+                                const unsigned             req_size,
+                                const bool                 done) {
+
+    struct viosim_journal_entry *entry;
+
+    unsigned i;
+
+    mutex_lock(&viosim_async_mutex);
+
+    for (i = 0; i < req_size; i++) {
+        if (!done) {
+            pr_err_ratelimited(_MODULE_NAME _COLON_SPACE_SEP \
+                               _JOURNAL_LOST_ERR _NEW_LINE,
+                               req_map[i].page_map.lpn,
+                               req_map[i].page_map.ppnx);
+
+            continue;
+        }
+
+        entry = &viosim_journal[(viosim_journal_head + viosim_journal_count)
+                                % DEVICE_JOURNAL_MAX];
+
+        entry->lpn = req_map[i].page_map.lpn;
+        entry->ppn = req_map[i].page_map.ppnx;
+
+        viosim_journal_count++;
+    }
+
+    viosim_ppn_pool_taken   -= req_size;
+    viosim_journal_reserved -= req_size;
+
+    mutex_unlock(&viosim_async_mutex);
+}
+
+/**
+ * Helper function.
+ * Chooses the list of waiting requests the next one handed to the user
+ * space FTL comes from: reads go first, but a waiting write is not passed
+ * by more than <code>writes_starved</code> reads in a row.
+ * Gets called with <code>viosim_req_map_mutex</code> held.
+ *
+ * @return The list, or <code>NULL</code> if no request is waiting.
+ */
+static struct list_head *viosim_ftl_next(void) {
+    struct list_head *reqs = &viosim_ftl_rd_reqs;
+
+    if (list_empty(&viosim_ftl_rd_reqs)
+        || (!list_empty(&viosim_ftl_wr_reqs)
+            && (writes_starved > 0)
+            && (viosim_ftl_writes_passed >= writes_starved))) {
+
+        reqs = &viosim_ftl_wr_reqs;
+    }
+
+    return list_empty(reqs) ? NULL : reqs;
+}
+
+/**
+ * Helper function.
+ * Accounts for a request handed to the user space FTL out of the list
+ * chosen by <code>viosim_ftl_next()</code>.
+ * Gets called with <code>viosim_req_map_mutex</code> held.
+ *
+ * @param reqs The list.
+ */
+static void viosim_ftl_account(const struct list_head *reqs) {
+    if (reqs == &viosim_ftl_wr_reqs) {
+        viosim_ftl_writes_passed = 0;
+    } else if (!list_empty(&viosim_ftl_wr_reqs)) {
+        viosim_ftl_writes_passed++;
+    }
+}
+
+/**
+ * Helper function.
+ * Takes the mapping the user space FTL has answered a request with
+ * and lets the request go through.
+ * Gets called with <code>viosim_req_map_mutex</code> held.
+ *
+ * @param ftl_req    The request answered.
+ * @param answer_map The request map entries as answered by the FTL.
+ */
+static void viosim_ftl_answer(      struct viosim_ftl_req     *ftl_req,
+                              const struct viosim_request_map *answer_map) {
+
+    struct viosim_request_map *req_map = ftl_req->req_map;
+
+    bool fresh;
+
+    unsigned i;
+
+    /*
+     * Taking only the mapping the FTL is in charge of: the sectors
+     * and the request buffers stay as the kernel prepared them.
+     */
+    for (i = 0; i < ftl_req->req_size; i++) {
+        req_map[i].page_map.ppn  = answer_map[i].page_map.ppn;
+        req_map[i].page_map.ppnx = answer_map[i].page_map.ppnx;
+
+        spin_lock(&viosim_wr_lock);
+
+        /*
+         * A page written since the request was handed to the FTL
+         * may have moved on from where the answer has it: the mapping
+         * is kept only if it has not been.
+         */
+        fresh = !viosim_wr_since(req_map[i].page_map.lpn, ftl_req->wr_seq);
+
+        /* Reads are cached now, writes once written. */
+        if (req_map[i].page_map.transf_dir != 0) {
+            viosim_l2p_invalidate(req_map[i].page_map.lpn, 1);
+        } else if (fresh) {
+            viosim_l2p_update(req_map[i].page_map.lpn,
+                              req_map[i].page_map.ppn);
+            viosim_map_update(req_map[i].page_map.lpn,
+                              req_map[i].page_map.ppn);
+        }
+
+        /* Remembering where a page read lives (writes once written). */
+        if (fresh && (req_map[i].page_map.transf_dir == 0)) {
+            viosim_ftl_last_set(req_map[i].page_map.lpn,
+                                req_map[i].page_map.ppn);
+        }
+
+        spin_unlock(&viosim_wr_lock);
+    }
+
+    atomic64_inc(&viosim_ftl_stats.answered);
+
+    /* Setting the request's write wait flag to TRUE to let it go through. */
+    list_del(&ftl_req->node);
+
+    ftl_req->answered = true;
+}
+
+/**
+ * Helper function.
+ * Hands the next request waiting for the user space FTL to it (unless
+ * one is handed already): reads go first, but a waiting write is not
+ * passed by more than <code>writes_starved</code> reads in a row.
+ * Gets called with <code>viosim_req_map_mutex</code> held.
+ *
+ * @return <code>true</code> if a request has been handed to the FTL.
+ */
+static bool viosim_ftl_pick(void) {
+    struct list_head *reqs;
+
+    if (viosim_ftl_cur != NULL) {
+        return false;
+    }
+
+    reqs = viosim_ftl_next();
+
+    if (reqs == NULL) {
+        return false;
+    }
+
+    viosim_ftl_account(reqs);
+
+    viosim_ftl_cur = list_first_entry(reqs, struct viosim_ftl_req, node);
+
+    viosim_ftl_cur->wr_seq = READ_ONCE(viosim_wr_seq);
+
+    viosim_r_reqsz_wait_flag = true;
+    viosim_r_block_wait_flag = true;
+
+    return true;
+}
+
+/**
+ * Helper function.
+ * Lets all requests waiting for the user space FTL go through
+ * as they are. Gets called with <code>viosim_req_map_mutex</code> held.
+ */
+static void viosim_ftl_answer_all(void) {
+    struct viosim_ftl_req *ftl_req, *tmp;
+
+    list_for_each_entry_safe(ftl_req, tmp, &viosim_ftl_rd_reqs, node) {
+        list_del(&ftl_req->node);
+
+        ftl_req->answered = true;
+    }
+
+    list_for_each_entry_safe(ftl_req, tmp, &viosim_ftl_wr_reqs, node) {
+        list_del(&ftl_req->node);
+
+        ftl_req->answered = true;
+    }
+
+    list_for_each_entry_safe(ftl_req, tmp, &viosim_ftl_handed, node) {
+        list_del(&ftl_req->node);
+
+        ftl_req->answered = true;
+    }
+
+    viosim_ftl_cur           = NULL;
+    viosim_r_reqsz_wait_flag = false;
+    viosim_r_block_wait_flag = false;
+}
+
+/**
+ * Inner helper function.
+ * Tells when a request was issued, i.e.\ got into the request queue.
+ *
+ * @param req The request.
+ *
+ * @return The time (ns, monotonic clock) the request was issued at.
+ */
+static u64 viosim_req_start_ns(const struct request *req) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+    return req->start_time_ns;
+#else
+    /* Only jiffies to go by. */
+    return ktime_get_ns() - jiffies_to_nsecs(jiffies - req->start_time);
+#endif
+}
+
+/**
+ * Logs a request being completed to the I/O trace buffer of the current
+ * CPU (with the request queue spin lock held, interrupts off).
+ *
+ * @param req   The request.
+ * @param write Whether it is a write.
+ * @param ret   The request completion status.
+ */
+static void viosim_trace_log(const struct request *req,
+                             const bool            write,
+                             const int             ret) {
+
+    struct viosim_trace_rec rec;
+
+    if ((viosim_trace_chan == NULL) || !READ_ONCE(trace)) {
+        return;
+    }
+
+    rec.time_ns = ktime_get_ns();
+    rec.lat_ns  = rec.time_ns - viosim_req_start_ns(req);
+    rec.sector  = blk_rq_pos(req);
+    rec.bytes   = blk_rq_bytes(req);
+    rec.op      = write ? DEVICE_TRACE_OP_WRITE : DEVICE_TRACE_OP_READ;
+    rec.error   = (ret != EXIT_SUCCESS);
+
+    relay_write(viosim_trace_chan, &rec, sizeof(rec));
+}
+
+/**
+ * Accounts a request being completed to the latency statistics
+ * of its I/O priority class, whether or not it was dispatched by it
+ * (with the request queue spin lock held).
+ *
+ * @param req The request.
+ * @param ret The request completion status.
+ */
+static void viosim_prio_account(struct request *req, const int ret) {
+    struct viosim_prio_stats *st = &viosim_prio_stats[
+                                    viosim_req_prio_class(req)];
+
+    u64 lat_ns = ktime_get_ns() - viosim_req_start_ns(req);
+
+    unsigned b = min_t(unsigned, fls64(div_u64(lat_ns, NSEC_PER_USEC)),
+                                 DEVICE_PRIO_LAT_BUCKETS - 1);
+
+    st->completed++;
+    st->errors     += (ret != EXIT_SUCCESS);
+    st->lat_ns     += lat_ns;
+    st->max_lat_ns  = max(st->max_lat_ns, lat_ns);
+    st->lat_hist[b]++;
+}
+
+/**
+ * Helper function.
+ * Caches the pages of a request map written (as the FTL answered
+ * or the driver placed them), and commits those placed.
+ *
+ * @param req_map    The request map entries.
+ * @param req_size   The number of entries.
+ * @param transf_dir The data transfer direction.
+ * @param update     Whether the pages written are to be cached.
+ * @param placed     Whether the pages were placed by the driver.
+ * @param ret        The status of performing the request map ops.
+ */
+static void viosim_req_map_commit(      struct viosim_request_map *req_map,
+                                  const unsigned                   req_size,
+                                  const int                        transf_dir,
+                                  const bool                       update,
+                                  const bool                       placed,
+                                  const int                        ret) {
+
+    unsigned i;
+
+    for (i = 0; (transf_dir != 0) && (i < req_size); i++) {
+        spin_lock(&viosim_wr_lock);
+
+        /* Reads handed to the FTL before are not to cache the old place. */
+        viosim_wr_stamp_page(req_map[i].page_map.lpn);
+
+        /* Written pages are cached only once the data is where they point. */
+        if (update && (ret == EXIT_SUCCESS)) {
+            viosim_l2p_update(req_map[i].page_map.lpn,
+                              req_map[i].page_map.ppnx);
+            viosim_map_update(req_map[i].page_map.lpn,
+                              req_map[i].page_map.ppnx);
+            viosim_ftl_last_set(req_map[i].page_map.lpn,
+                                req_map[i].page_map.ppnx);
+        }
+
+        spin_unlock(&viosim_wr_lock);
+    }
+
+    if (placed) {
+        viosim_async_commit(req_map, req_size, ret == EXIT_SUCCESS);
+    }
+}
+
+/**
+ * Gets called once all the page requests of a device request sent
+ * to the remote store are answered: ends the request.
+ *
+ * @param rreq The remote store request.
+ */
+static void viosim_remote_req_end(struct viosim_remote_req *rreq) {
+    unsigned long flags;
+
+    bool write = (rreq->transf_dir != 0);
+
+    viosim_req_map_commit(rreq->req_map, rreq->req_size, rreq->transf_dir,
+                          rreq->update,  rreq->placed,   rreq->error);
+
+    atomic64_dec(&viosim_remote_stats.reqs_inflight);
+
+    spin_lock_irqsave(&viosim_lock, flags);
+
+    viosim_trace_log(rreq->req, write, rreq->error);
+    viosim_prio_account(rreq->req, rreq->error);
+
+    /* Completely finishing the request. */
+    __blk_end_request_all(rreq->req, rreq->error);
+
+    spin_unlock_irqrestore(&viosim_lock, flags);
+
+    kfree(rreq->ios);
+    kfree(rreq->req_segs);
+    kfree(rreq->req_map);
+    kfree(rreq);
+}
+
+/**
+ * Sends the read/write ops of a request map to the remote store,
+ * a page request per segment, all of them in flight at once.
+ * The request is ended as they are answered
+ * (by <code>viosim_remote_req_end(...)</code>), which takes
+ * the request map over.
+ *
+ * @param req        The request.
+ * @param req_map    The request map entries.
+ * @param req_size   The number of entries.
+ * @param segs       The request data segments (in the order of entries).
+ * @param nr_segs    The number of segments.
+ * @param transf_dir The data transfer direction.
+ * @param update     Whether the pages written are to be cached.
+ * @param placed     Whether the pages were placed by the driver.
+ *
+ * @return <code>-EINPROGRESS</code> once sent, or the exit code
+ *         indicating the failure to send the request map.
+ */
+static int viosim_remote_req_submit(      struct request            *req,
+                                          struct viosim_request_map *req_map,
+                                    const unsigned                   req_size,
+                                          struct viosim_request_seg *segs,
+                                    const unsigned                   nr_segs,
+                                    const int                        transf_dir,
+                                    const bool                       update,
+                                    const bool                       placed) {
+
+    struct viosim_remote_req *rreq;
+    struct viosim_page_map   *page_map;
+
+    u64 src_ppn;
+    u32 offset;
+    u32 len;
+
+    unsigned i;
+
+    rreq = kzalloc(sizeof(*rreq), GFP_NOIO);
+
+    if (rreq != NULL) {
+        rreq->ios = kcalloc(nr_segs, sizeof(*rreq->ios), GFP_NOIO);
+    }
+
+    if ((rreq == NULL) || (rreq->ios == NULL)) {
+        kfree(rreq);
+
+        return -ENOMEM;
+    }
+
+    rreq->done       = viosim_remote_req_end;
+    rreq->req        = req;
+    rreq->req_map    = req_map;
+    rreq->req_segs   = segs;
+    rreq->req_size   = req_size;
+    rreq->transf_dir = transf_dir;
+    rreq->update     = update;
+    rreq->placed     = placed;
+
+    /* Holding a reference while sending, so that it isn't done meanwhile. */
+    atomic_set(&rreq->pending, 1);
+
+    atomic64_inc(&viosim_remote_stats.reqs);
+    atomic64_inc(&viosim_remote_stats.reqs_inflight);
+
+    for (i = 0; i < nr_segs; i++) {
+        page_map = &req_map[segs[i].entry].page_map;
+
+        offset = (segs[i].start_sector % DEVICE_NUMBER_OF_SECTORS_PER_PAGE)
+               * DEVICE_SECTOR_SIZE;
+        len    =  segs[i].num_of_sectors * DEVICE_SECTOR_SIZE;
+
+        if (transf_dir == 0) {
+            /* No such page (e.g. an LPN left unmapped by the FTL): zeros. */
+            if (page_map->ppn >= viosim_nr_pages) {
+                memset(segs[i].buffer, 0, len);
+
+                continue;
+            }
+
+            viosim_remote_submit(rreq, &rreq->ios[i], DEVICE_REMOTE_OP_READ,
+                                 page_map->lpn, page_map->ppn, page_map->ppn,
+                                 offset, segs[i].buffer, len);
+
+            continue;
+        }
+
+        /* No page to write to (e.g. the FTL is out of space): failing. */
+        if (page_map->ppnx >= viosim_nr_pages) {
+            cmpxchg(&rreq->error, EXIT_SUCCESS, -ENOSPC);
+
+            continue;
+        }
+
+        /*
+         * The first segment of a page written in part brings the rest
+         * of it from where it was (the server does the read-modify-write).
+         */
+        src_ppn = page_map->ppnx;
+
+        if (((i == 0) || (segs[i - 1].entry != segs[i].entry))
+            && (req_map[segs[i].entry].num_of_sectors
+                                       < DEVICE_NUMBER_OF_SECTORS_PER_PAGE)) {
+
+            src_ppn = (page_map->ppn < viosim_nr_pages)
+                    ?  page_map->ppn : DEVICE_REMOTE_PPN_ZERO;
+        }
+
+        viosim_remote_submit(rreq, &rreq->ios[i], DEVICE_REMOTE_OP_WRITE,
+                             page_map->lpn, page_map->ppnx, src_ppn,
+                             offset, segs[i].buffer, len);
+    }
+
+    viosim_remote_put(rreq);
+
+    return -EINPROGRESS;
+}
+
+/**
+ * Helper function.
+ * Tells whether any request is waiting for the user space FTL
+ * (the condition a batch fetch waits on).
+ *
+ * @return <code>true</code> if a request is waiting.
+ */
+static bool viosim_ftl_waiting(void) {
+    return !list_empty(&viosim_ftl_rd_reqs)
+        || !list_empty(&viosim_ftl_wr_reqs);
+}
+
+/**
+ * Helper function.
+ * Fetches requests waiting for the user space FTL in the order
+ * <code>viosim_ftl_pick()</code> hands them, as many as fit
+ * in the batch buffer (up to <code>DEVICE_FTL_BATCH_MAX</code>),
+ * and keeps them handed until answered by their tags. The request
+ * handed through <code>GET_REQUEST_SIZE</code>, if any, is taken over:
+ * an FTL serves requests either way, not both.
+ * Gets called with <code>viosim_req_map_mutex</code> held.
+ *
+ * @param batch The batch to fill in (<code>nr_reqs</code> is set).
+ *
+ * @return The exit code indicating the status of fetching the requests
+ *         (<code>-EOVERFLOW</code> if the first one doesn't fit).
+ */
+static int viosim_ftl_fetch(struct viosim_ftl_batch *batch) {
+    u8 __user *dst = u64_to_user_ptr(batch->addr);
+
+    struct viosim_ftl_req *ftl_req;
+    struct list_head      *reqs;
+
+    u32    left = batch->len;
+    size_t rec_size;
+
+    int ret = EXIT_SUCCESS;
+
+    batch->nr_reqs = 0;
+
+    viosim_ftl_cur           = NULL;
+    viosim_r_reqsz_wait_flag = false;
+    viosim_r_block_wait_flag = false;
+
+    while ((batch->nr_reqs < DEVICE_FTL_BATCH_MAX)
+        && ((reqs = viosim_ftl_next()) != NULL)) {
+
+        ftl_req  = list_first_entry(reqs, struct viosim_ftl_req, node);
+        rec_size = sizeof(struct viosim_ftl_batch_req)
+                 + (sizeof(*ftl_req->req_map) * ftl_req->req_size);
+
+        /* The rest is left waiting for the next batch. */
+        if (rec_size > left) {
+            if (batch->nr_reqs == 0) {
+                ret = -EOVERFLOW;
+            }
+
+            break;
+        }
+
+        if (put_user(ftl_req->tag, &((struct viosim_ftl_batch_req __user *)
+                                     dst)->tag)
+         || put_user(ftl_req->req_size,
+                     &((struct viosim_ftl_batch_req __user *) dst)->req_size)
+         || copy_to_user(dst + sizeof(struct viosim_ftl_batch_req),
+                         ftl_req->req_map,
+                         sizeof(*ftl_req->req_map) * ftl_req->req_size)) {
+
+            if (batch->nr_reqs == 0) {
+                ret = -EFAULT;
+            }
+
+            break;
+        }
+
+        viosim_ftl_account(reqs);
+
+        ftl_req->wr_seq = READ_ONCE(viosim_wr_seq);
+
+        list_move_tail(&ftl_req->node, &viosim_ftl_handed);
+
+        dst  += rec_size;
+        left -= rec_size;
+
+        batch->nr_reqs++;
+    }
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Answers requests fetched in a batch by their tags. A request gone
+ * in the meantime (e.g.\ timed out) is skipped, and so is an answer
+ * of another size than the request.
+ *
+ * @param batch The batch answered (<code>nr_reqs</code> is set
+ *              to the number of requests answered).
+ *
+ * @return The exit code indicating the status of answering the requests
+ *         (the ones before a failing record are answered anyway).
+ */
+static int viosim_ftl_answer_batch(struct viosim_ftl_batch *batch) {
+    u8 __user *src = u64_to_user_ptr(batch->addr);
+
+    struct viosim_ftl_batch_req  rec;
+    struct viosim_request_map   *answer_map;
+    struct viosim_ftl_req       *ftl_req, *it;
+
+    u32    left    = batch->len;
+    u32    nr_reqs = batch->nr_reqs;
+    u32    i;
+    size_t rec_size;
+
+    int ret = EXIT_SUCCESS;
+
+    if (nr_reqs > DEVICE_FTL_BATCH_MAX) {
+        ret = -EINVAL;
+
+        return ret;
+    }
+
+    batch->nr_reqs = 0;
+
+    for (i = 0; (ret == EXIT_SUCCESS) && (i < nr_reqs); i++) {
+        if (left < sizeof(rec)) {
+            ret = -EINVAL;
+
+            break;
+        }
+
+        if (copy_from_user(&rec, src, sizeof(rec))) {
+            ret = -EFAULT;
+
+            break;
+        }
+
+        rec_size = sizeof(rec) + (sizeof(*answer_map) * rec.req_size);
+
+        if (rec_size > left) {
+            ret = -EINVAL;
+
+            break;
+        }
+
+        mutex_lock(&viosim_req_map_mutex);
+
+        ftl_req = NULL;
+
+        list_for_each_entry(it, &viosim_ftl_handed, node) {
+            if (it->tag == rec.tag) {
+                ftl_req = it;
+
+                break;
+            }
+        }
+
+        if ((ftl_req != NULL) && (ftl_req->req_size == rec.req_size)) {
+            answer_map = kmalloc(rec_size - sizeof(rec), GFP_KERNEL);
+
+            if (answer_map == NULL) {
+                ret = -ENOMEM;
+            } else if (copy_from_user(answer_map, src + sizeof(rec),
+                                      rec_size - sizeof(rec))) {
+
+                ret = -EFAULT;
+            } else {
+                viosim_ftl_answer(ftl_req, answer_map);
+
+                batch->nr_reqs++;
+            }
+
+            kfree(answer_map);
+        }
+
+        mutex_unlock(&viosim_req_map_mutex);
+
+        src  += rec_size;
+        left -= rec_size;
+    }
+
+    /* Waking up the processes before writing. */
+    if (batch->nr_reqs > 0) {
+        wake_up_interruptible(&viosim_w_block_wait_qu);
+    }
+
+    return ret;
+}
+
+/**
+ * Processes the request fetched from the request queue, i.e.\ data transfer.
+ *
+ * @param req The <code>request</code> structure containing the request
+ *            to process.
+ *
+ * @return The exit code indicating the overall status of processing
+ *         the request.
+ */
+static int viosim_req_transfer(struct request *req) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_request_map *req_map;
+    struct viosim_request_seg *req_segs;
+
+    struct viosim_ftl_req ftl_req;
+
+    long timeout = (ftl_timeout_ms > 0) ? msecs_to_jiffies(ftl_timeout_ms)
+                                        : MAX_SCHEDULE_TIMEOUT;
+    bool answered = false;
+    bool placed   = false;
+
+    u8 *page_buffer;
+
+    struct bio_vec      bv;
+    struct req_iterator iter;
+
+    unsigned req_size = 0;
+    unsigned nr_segs  = 0;
+    unsigned i;
+    unsigned max_size;
+    unsigned max_segs = 0;
+
+    /* Getting the data transfer direction (read/write from/to the device). */
+    int transf_dir = rq_data_dir(req);
+
+    /* Getting the starting sector (current sector). */
+    sector_t start_sector  = blk_rq_pos(req);
+    sector_t sector_offset = 0;
+
+    /* Getting the amount of sectors left in the entire request. */
+    unsigned num_of_sectors = blk_rq_sectors(req);
+
+    /* --- DEBUG: Printing the data transfer direction - Begin ------------- */
+#define TRANSF_DIR_READ  "read from device"
+#define TRANSF_DIR_WRITE "write to device"
+#define TRANSF_DIR_MSG   "===> Data transfer dir: %d, i.e. %s"
+
+    /* Once per request: printed only when debugging is turned on. */
+    pr_debug(_MODULE_NAME _COLON_SPACE_SEP \
+             TRANSF_DIR_MSG _NEW_LINE, transf_dir,
+             (transf_dir == 0) ? TRANSF_DIR_READ : TRANSF_DIR_WRITE);
+    /* --- DEBUG: Printing the data transfer direction - End --------------- */
+
+    /*
+     * Sizing the map and the segment list: an entry per page the segments
+     * span, and at most a segment per bio_vec and page boundary crossed.
+     */
+    rq_for_each_segment(bv, req, iter) {
+        sector_offset += bv.bv_len / DEVICE_SECTOR_SIZE;
+
+        max_segs++;
+    }
+
+    if (sector_offset == 0) {
+        return ret;
+    }
+
+    max_size  = (start_sector + sector_offset - 1)
+              / DEVICE_NUMBER_OF_SECTORS_PER_PAGE
+              -  start_sector / DEVICE_NUMBER_OF_SECTORS_PER_PAGE + 1;
+    max_segs += max_size;
+
+    req_map  = kzalloc(
+        sizeof(struct viosim_request_map) * max_size, GFP_KERNEL);
+    req_segs = kmalloc(
+        sizeof(struct viosim_request_seg) * max_segs, GFP_KERNEL);
+
+    if ((req_map == NULL) || (req_segs == NULL)) {
+        kfree(req_segs);
+        kfree(req_map);
+
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    sector_offset = 0;
+
+    /*
+     * Traversing <bio> segments in the request list.
+     * - bv   -- bio_vec structure, a vector representation of <bio>s:
+     * struct bio_vec {
+     *     struct   page *bv_page;
+     *     unsigned int   bv_len;
+     *     unsigned int   bv_offset;
+     * };
+     * - req  -- Request queue (runqueue) structure.
+     * - iter -- Request queue iterator (structure).
+     * See https://www.kernel.org/doc/Documentation/block/biodoc.txt ,
+     * section 3.2.1 for details.
+     */
+    rq_for_each_segment(bv, req, iter) {
+        /* The logical block address (LBA). */
+        u64 lba = start_sector + sector_offset;
+
+        viosim_req_map_fill(req_map, &req_size, req_segs, &nr_segs, lba,
+                            page_address(bv.bv_page) + bv.bv_offset,
+                            bv.bv_len, transf_dir);
+
+        sector_offset += bv.bv_len / DEVICE_SECTOR_SIZE;
+    }
+
+    /* --- Placing writes to PPNs granted by the FTL - Begin ------------ */
+    if (async_writes && (transf_dir != 0)) {
+        placed = viosim_async_place(req_map, req_size);
+
+        if (placed) {
+            atomic64_inc(&viosim_ftl_stats.async_writes);
+
+            goto req_map_exec;
+        }
+
+        /* Forwarding it makes the FTL come and grant more PPNs, too. */
+        atomic64_inc(&viosim_ftl_stats.async_misses);
+    }
+    /* --- Placing writes to PPNs granted by the FTL - End -------------- */
+
+    /* --- Serving reads of pages mapped before in-kernel - Begin ------- */
+    if ((viosim_l2p != NULL) && (transf_dir == 0)) {
+        if (viosim_l2p_lookup(req_map, req_size)) {
+            atomic64_inc(&viosim_ftl_stats.l2p_hits);
+
+            goto req_map_exec;
+        }
+
+        atomic64_inc(&viosim_ftl_stats.l2p_misses);
+    }
+    /* --- Serving reads of pages mapped before in-kernel - End --------- */
+
+    ftl_req.req_map  = req_map;
+    ftl_req.req_size = req_size;
+    ftl_req.answered = false;
+
+    /* Queueing the request map for the user space FTL. */
+    mutex_lock(&viosim_req_map_mutex);
+
+    ftl_req.tag = viosim_ftl_next_tag++;
+
+    if (viosim_usr_app == NULL) {
+        /* The FTL is gone: going through with the identity mapping. */
+        ftl_req.answered = true;
+    } else {
+        list_add_tail(&ftl_req.node, (transf_dir == 0) ? &viosim_ftl_rd_reqs
+                                                       : &viosim_ftl_wr_reqs);
+
+        /* Telling the FTL serving out of an event loop, if any. */
+        if (viosim_ftl_evfd != NULL) {
+            eventfd_signal(viosim_ftl_evfd, 1);
+        }
+
+        wake_up_interruptible(&viosim_ftl_batch_wait_qu);
+    }
+
+    if (viosim_ftl_pick()) {
+        /* Waking up the process before getting the request size and reading. */
+        wake_up_interruptible(&viosim_r_reqsz_wait_qu);
+        wake_up_interruptible(&viosim_r_block_wait_qu);
+    }
+
+    mutex_unlock(&viosim_req_map_mutex);
+
+    /* Putting the process to sleep before writing (until the deadline). */
+    timeout = wait_event_interruptible_timeout(
+        viosim_w_block_wait_qu, ftl_req.answered, timeout);
+
+    /* Taking the request map back: late answers are rejected from now on. */
+    mutex_lock(&viosim_req_map_mutex);
+
+    answered = ftl_req.answered;
+
+    if (!answered) {
+        list_del(&ftl_req.node);
+
+        /* Not handing the next request over until the FTL asks for one. */
+        if (viosim_ftl_cur == &ftl_req) {
+            viosim_ftl_cur           = NULL;
+            viosim_r_reqsz_wait_flag = false;
+            viosim_r_block_wait_flag = false;
+        }
+    }
+
+    mutex_unlock(&viosim_req_map_mutex);
+
+    if (!answered && (timeout < 0)) {
+        kfree(req_segs);
+        kfree(req_map);
+
+        /* When interrupted by a signal -- return with error. */
+        ret = -ERESTARTSYS;
+
+        return ret;
+    }
+
+    /* --- Falling back when the FTL didn't answer in time - Begin -------- */
+    if (!answered) {
+        atomic64_inc(&viosim_ftl_stats.timeouts);
+
+        pr_warn_ratelimited(_MODULE_NAME _COLON_SPACE_SEP \
+                            _FTL_TIMEOUT_ERR _NEW_LINE,
+                            (u64) start_sector, ftl_timeout_ms, ftl_fallback);
+
+        /*
+         * Only reads are safe to send to where a page is believed
+         * to live: a write put anywhere else than the FTL would have put
+         * it is lost to the FTL, unless its pages never move.
+         */
+        if (viosim_ftl_fail || ((transf_dir != 0) && !viosim_ftl_identity)) {
+            atomic64_inc(&viosim_ftl_stats.failures);
+
+            kfree(req_segs);
+            kfree(req_map);
+
+            ret = -EIO;
+
+            return ret;
+        }
+
+        /* The map is still identity unless the last-known one is there. */
+        spin_lock(&viosim_wr_lock);
+
+        for (i = 0; (viosim_ftl_last != NULL) && (i < req_size); i++) {
+            struct viosim_page_map *viosim_pg_map = &req_map[i].page_map;
+
+            if (viosim_pg_map->lpn < viosim_nr_pages) {
+                viosim_pg_map->ppn  = viosim_ftl_last[viosim_pg_map->lpn];
+                viosim_pg_map->ppnx = viosim_pg_map->ppn;
+            }
+        }
+
+        spin_unlock(&viosim_wr_lock);
+
+        atomic64_inc(&viosim_ftl_stats.fallbacks);
+    }
+    /* --- Falling back when the FTL didn't answer in time - End ---------- */
+
+req_map_exec:
+    if (sector_offset != num_of_sectors) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _BIO_DOES_NOT_MATCH_REQUEST_ERR _NEW_LINE);
+    }
+
+    /* --- Sending it to the server keeping the store - Begin ------------ */
+    if ((viosim_remote_conns != NULL) && (sector_offset == num_of_sectors)) {
+        ret = viosim_remote_req_submit(req, req_map, req_size,
+                                       req_segs, nr_segs, transf_dir,
+                                       answered || placed, placed);
+
+        /* Ended as the server answers: the map goes along with it. */
+        if (ret == -EINPROGRESS) {
+            return ret;
+        }
+
+        if (placed) {
+            viosim_async_commit(req_map, req_size, false);
+        }
+
+        kfree(req_segs);
+        kfree(req_map);
+
+        return ret;
+    }
+    /* --- Sending it to the server keeping the store - End -------------- */
+
+    /* The page buffer the request's partial pages go through. */
+    page_buffer = kmalloc(DEVICE_PAGE_SIZE, GFP_NOIO);
+
+    if (page_buffer == NULL) {
+        if (placed) {
+            viosim_async_commit(req_map, req_size, false);
+        }
+
+        kfree(req_segs);
+        kfree(req_map);
+
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    /* Actually performing read/write ops using the appropriate helpers. */
+    ret = viosim_req_map_exec(req_map, req_size, req_segs, nr_segs,
+                              transf_dir, page_buffer);
+
+    viosim_req_map_commit(req_map, req_size, transf_dir,
+                          answered || placed, placed, ret);
+
+    kfree(page_buffer);
+    kfree(req_segs);
+    kfree(req_map);
+
+    if (sector_offset != num_of_sectors) {
+        ret = -EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+/**
+ * Inner helper function.
+ * Tells how long a request has to wait for a token bucket to hold
+ * enough tokens for it. A bucket holds up to <code>burst_ns</code>
+ * worth of tokens; a request costing more than that goes
+ * when the bucket is full, taking it into debt.
+ *
+ * @param full_ns  The time (ns) the bucket will be full again.
+ * @param now_ns   The current time (ns).
+ * @param cost_ns  The request cost (ns worth of tokens).
+ * @param burst_ns The bucket size (ns worth of tokens).
+ *
+ * @return The time (ns) to wait (<code>0</code> &ndash; none).
+ */
+static u64 viosim_throttle_wait(const u64 full_ns,  const u64 now_ns,
+                                const u64 cost_ns,  const u64 burst_ns) {
+
+    u64 slack = (burst_ns > cost_ns) ? (burst_ns - cost_ns) : 0;
+
+    if (full_ns <= (now_ns + slack)) {
+        return 0;
+    }
+
+    return full_ns - now_ns - slack;
+}
+
+/**
+ * Takes the tokens for a request out of the IOPS and bandwidth buckets
+ * of its dispatch list, unless either of them is short of tokens.
+ *
+ * @param th    The throttling state of the dispatch list.
+ * @param write Whether it is the write dispatch list.
+ * @param bytes The request size in bytes.
+ *
+ * @return The time (ns) to wait before the request may be dispatched
+ *         (<code>0</code> &ndash; the tokens are taken, it may go now).
+ */
+static u64 viosim_throttle_take(      struct viosim_throttle *th,
+                                const bool                    write,
+                                const unsigned                bytes) {
+
+    unsigned      iops  = write ? READ_ONCE(write_iops)
+                                : READ_ONCE(read_iops);
+    unsigned long bps   = write ? READ_ONCE(write_bps)
+                                : READ_ONCE(read_bps);
+    unsigned      burst = write ? READ_ONCE(write_burst_ms)
+                                : READ_ONCE(read_burst_ms);
+
+    u64 now_ns, burst_ns, iops_cost = 0, bps_cost = 0, wait = 0;
+
+    /* (A request may still be held from before the caps were lifted.) */
+    if ((iops == 0) && (bps == 0) && (th->held_since_ns == 0)) {
+        return 0;
+    }
+
+    now_ns   = ktime_get_ns();
+    burst_ns = (u64) burst * NSEC_PER_MSEC;
+
+    if (iops > 0) {
+        iops_cost = div_u64(NSEC_PER_SEC, iops);
+        wait      = viosim_throttle_wait(th->iops_full_ns, now_ns,
+                                         iops_cost, burst_ns);
+    }
+
+    if (bps > 0) {
+        bps_cost = div64_u64((u64) bytes * NSEC_PER_SEC, bps);
+        wait     = max(wait, viosim_throttle_wait(th->bps_full_ns, now_ns,
+                                                  bps_cost, burst_ns));
+    }
+
+    if (wait > 0) {
+        if (th->held_since_ns == 0) {
+            th->held_since_ns = now_ns;
+            th->throttled++;
+        }
+
+        return wait;
+    }
+
+    /* Taking the tokens, i.e. moving the time buckets get full forward. */
+    if (iops > 0) {
+        th->iops_full_ns = max(th->iops_full_ns, now_ns) + iops_cost;
+    }
+
+    if (bps > 0) {
+        th->bps_full_ns  = max(th->bps_full_ns,  now_ns) + bps_cost;
+    }
+
+    if (th->held_since_ns != 0) {
+        th->throttled_ns  += now_ns - th->held_since_ns;
+        th->held_since_ns  = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Picks the request to dispatch next out of a dispatch list: the one
+ * at the head of the highest I/O priority class with any requests waiting,
+ * unless the head of a lower class has been passed over for longer
+ * than <code>prio_aging_ms</code> (the one issued first going then),
+ * so that no class is starved.
+ *
+ * @param reqs The dispatch list (a list per I/O priority class).
+ * @param cls  The class of the request picked (out).
+ * @param aged Whether it goes ahead of a higher class for having waited
+ *             too long (out).
+ *
+ * @return The request picked (<code>NULL</code> &ndash; none waiting).
+ */
+static struct request *viosim_prio_pick(struct list_head *reqs,
+                                        unsigned         *cls,
+                                        bool             *aged) {
+
+    struct request *req, *pick = NULL;
+
+    u64 aging_ns = (u64) READ_ONCE(prio_aging_ms) * NSEC_PER_MSEC;
+    u64 now_ns   = 0, start_ns, pick_ns = 0;
+
+    unsigned i;
+
+    *aged = false;
+
+    for (i = 0; i < DEVICE_PRIO_CLASSES; i++) {
+        if (list_empty(&reqs[i])) {
+            continue;
+        }
+
+        req = list_first_entry(&reqs[i], struct request, queuelist);
+
+        if (pick == NULL) {
+            pick = req;
+            *cls = i;
+
+            if (aging_ns == 0) {
+                break;
+            }
+
+            now_ns  = ktime_get_ns();
+            pick_ns = viosim_req_start_ns(pick);
+
+            continue;
+        }
+
+        start_ns = viosim_req_start_ns(req);
+
+        if (((start_ns + aging_ns) < now_ns) && (start_ns < pick_ns)) {
+            pick    = req;
+            pick_ns = start_ns;
+            *cls    = i;
+            *aged   = true;
+        }
+    }
+
+    return pick;
+}
+
+/**
+ * Executes the requests of a dispatch list one by one, in the order
+ * <code>viosim_prio_pick(...)</code> picks them. When a request
+ * has to wait for the caps of the list, the task is put back
+ * into the workqueue to run once the tokens are there.
+ *
+ * @param reqs  The dispatch list (read or write requests).
+ * @param task  The task executing the list.
+ * @param th    The throttling state of the list.
+ * @param write Whether it is the write dispatch list.
+ */
+static void viosim_req_exec(      struct list_head       *reqs,
+                                  struct delayed_work    *task,
+                                  struct viosim_throttle *th,
+                            const bool                    write) {
+
+    struct request *req;
+
+    u64 wait;
+
+    unsigned cls;
+
+    bool aged;
+
+    int ret;
+
+    spin_lock_irq(&viosim_lock);
+
+    while ((req = viosim_prio_pick(reqs, &cls, &aged)) != NULL) {
+        wait = viosim_throttle_take(th, write, blk_rq_bytes(req));
+
+        if (wait > 0) {
+            queue_delayed_work(system_wq, task,
+                usecs_to_jiffies(div_u64(wait, NSEC_PER_USEC) + 1));
+
+            break;
+        }
+
+        th->dispatched++;
+        th->bytes += blk_rq_bytes(req);
+
+        viosim_prio_stats[cls].queued--;
+        viosim_prio_stats[cls].dispatched++;
+        viosim_prio_stats[cls].aged += aged;
+
+        list_del_init(&req->queuelist);
+
+        spin_unlock_irq(&viosim_lock);
+
+        ret = EXIT_SUCCESS;
+
+        if (viosim_usr_app != NULL) {
+            /* Handling the request: its main processing is going there. */
+            ret = viosim_req_transfer(req);
+        }
+
+        spin_lock_irq(&viosim_lock);
+
+        /* Sent to the server keeping the store: ended as it answers. */
+        if (ret == -EINPROGRESS) {
+            continue;
+        }
+
+        viosim_trace_log(req, write, ret);
+        viosim_prio_account(req, ret);
+
+        /* Completely finishing the request. */
+        __blk_end_request_all(req, ret);
+    }
+
+    spin_unlock_irq(&viosim_lock);
+}
+
+/**
+ * Executes read requests: a task prepared and waited to be run
+ * out of a workqueue.
+ *
+ * @param task The <code>work_struct</code> device structure
+ *             which contains the working task.
+ */
+static void viosim_rd_exec(const struct work_struct *task) {
+    viosim_req_exec(viosim_rd_reqs, &viosim_rd_task,
+                    &viosim_rd_throttle, false);
+}
+
+/**
+ * Executes write requests: a task prepared and waited to be run
+ * out of a workqueue.
+ *
+ * @param task The <code>work_struct</code> device structure
+ *             which contains the working task.
+ */
+static void viosim_wr_exec(const struct work_struct *task) {
+    viosim_req_exec(viosim_wr_reqs, &viosim_wr_task,
+                    &viosim_wr_throttle, true);
+}
+
+/**
+ * Implements engaging the device operation.
+ *
+ * @param blkdev The <code>block_device</code> structure describing the device.
+ * @param mode   N/A. (TODO: Provide description.)
+ *
+ * @return The exit code indicating engaging the device operation
+ *         execution status.
+ */
+static int viosim_open_proc(struct block_device *blkdev, const fmode_t mode) {
+    int ret = EXIT_SUCCESS;
+
+    /* --- DEBUG: Printing the device private data - Begin ----------------- */
+#define OPEN_PROC_DBG_00 "===> 00: blkdev != NULL"
+#define OPEN_PROC_DBG_01 "===> 01: blkdev->bd_disk != NULL"
+#define OPEN_PROC_DBG_02 "===> 02: viosim_private_data == NULL"
+#define OPEN_PROC_DBG_03 "===> 03: viosim_private_data != NULL"
+#define OPEN_PROC_DBG_99 "Device engage: private_data: %s"
+
+    char *viosim_private_data = NULL;
+
+    if (blkdev != NULL) {
+/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP OPEN_PROC_DBG_00 _NEW_LINE);*/
+
+        if (blkdev->bd_disk != NULL) {
+/*            pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+                    OPEN_PROC_DBG_01 _NEW_LINE);*/
+
+            viosim_private_data = kzalloc(
+                sizeof(blkdev->bd_disk->private_data) + 1, GFP_KERNEL);
+
+            viosim_private_data = strcpy(viosim_private_data,
+                                         blkdev->bd_disk->private_data);
+        }
+    }
+
+    if (viosim_private_data == NULL) {
+/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP OPEN_PROC_DBG_02 _NEW_LINE);*/
+
+        ret = EXIT_FAILURE;
+
+        viosim_private_data = kzalloc(3 + 1, GFP_KERNEL);
+
+        viosim_private_data = strcpy(viosim_private_data, "N/A");
+    }
+
+    if (viosim_private_data != NULL) {
+/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP OPEN_PROC_DBG_03 _NEW_LINE);*/
+
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+                OPEN_PROC_DBG_99 _NEW_LINE, viosim_private_data);
+
+        kfree(viosim_private_data);
+    }
+    /* --- DEBUG: Printing the device private data - End ------------------- */
+
+    return ret;
+}
+
+/**
+ * Implements releasing the device operation.
+ *
+ * @param viosim_disc The <code>gendisk</code> structure describing the device.
+ * @param mode        N/A. (TODO: Provide description.)
+ */
+static void viosim_release_proc(      struct gendisk *viosim_disc,
+                                const        fmode_t  mode) {
+
+    /* --- DEBUG: Printing the device private data - Begin ----------------- */
+#define RLZZ_PROC_DBG_04 "===> 04: viosim_disc != NULL"
+#define RLZZ_PROC_DBG_05 "===> 05: viosim_private_data == NULL"
+#define RLZZ_PROC_DBG_06 "===> 06: viosim_private_data != NULL"
+#define RLZZ_PROC_DBG_99 "Device release: private_data: %s"
+
+    char *viosim_private_data = NULL;
+
+    struct eventfd_ctx *evfd = NULL;
+
+    if (viosim_disc != NULL) {
+/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP RLZZ_PROC_DBG_04 _NEW_LINE);*/
+
+        viosim_private_data = kzalloc(
+            sizeof(viosim_disc->private_data) + 1, GFP_KERNEL);
+
+        viosim_private_data = strcpy(viosim_private_data,
+                                     viosim_disc->private_data);
+    }
+
+    if (viosim_private_data == NULL) {
+/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP RLZZ_PROC_DBG_05 _NEW_LINE);*/
+
+        viosim_private_data = kzalloc(3 + 1, GFP_KERNEL);
+
+        viosim_private_data = strcpy(viosim_private_data, "N/A");
+    }
+
+    if (viosim_private_data != NULL) {
+/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP RLZZ_PROC_DBG_06 _NEW_LINE);*/
+
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+                RLZZ_PROC_DBG_99 _NEW_LINE, viosim_private_data);
+
+        kfree(viosim_private_data);
+    }
+    /* --- DEBUG: Printing the device private data - End ------------------- */
+
+    if (viosim_usr_app != current) {
+        return;
+    }
+
+    /*
+     * Nullifying the user space calling process task pointer ->
+     * releasing the device.
+     */
+    viosim_usr_app = NULL;
+
+    viosim_l2p_invalidate(0, 0);
+
+    /*
+     * The PPNs granted are the gone FTL's to hand out, whereas the journal
+     * is kept for the next one to drain (it has the pages' latest places).
+     */
+    mutex_lock(&viosim_async_mutex);
+
+    viosim_ppn_pool_count = 0;
+
+    mutex_unlock(&viosim_async_mutex);
+
+    /*
+     * Letting requests that still wait for the gone FTL go through
+     * with the identity mapping they were prepared with.
+     */
+    mutex_lock(&viosim_req_map_mutex);
+
+    viosim_ftl_answer_all();
+
+    swap(evfd, viosim_ftl_evfd);
+
+    mutex_unlock(&viosim_req_map_mutex);
+
+    if (evfd != NULL) {
+        eventfd_ctx_put(evfd);
+    }
+
+    wake_up_interruptible(&viosim_w_block_wait_qu);
+}
+
+/**
+ * Implements the ioctl() system call to control device I/O ops.
+ *
+ * @param blkdev The <code>block_device</code> structure describing the device.
+ * @param mode   N/A. (TODO: Provide description.)
+ * @param cmd    The ioctl() command ID to execute.
+ * @param arg    The ioctl() argument to pass to a command set. (Optional.)
+ *
+ * @return The exit code indicating the ioctl() operation execution status.
+ */
+static int viosim_ioctl_proc(      struct block_device  *blkdev,
+                             const        fmode_t        mode,
+                             const        unsigned       cmd,
+                             const        unsigned long  arg) {
+
+    int ret = EXIT_SUCCESS;
+
+    unsigned long dead_bytes = 0UL;
+
+    struct viosim_request_map   *req_map;
+    struct viosim_request_map   *answer_map;
+    struct viosim_page_copy      page_copy;
+    struct viosim_l2p_range      l2p_range;
+    struct viosim_ppn_grant     *ppn_grant;
+    struct viosim_journal_batch *journal_batch;
+    struct viosim_ftl_batch      ftl_batch;
+    struct viosim_snap_clone     snap_clone;
+    struct eventfd_ctx          *evfd = NULL;
+
+    int evfd_num;
+
+    u32 snap_slot;
+
+    unsigned long req_size;
+
+    u8 *page_buffer;
+
+    unsigned i;
+
+    /* --- DEBUG: Printing the ioctl() call ID - Begin --------------------- */
+#define IOCTL_PROC_CMD_AND_ARG_DBG \
+        "===> ioctl() call ID: %#010x " \
+        "(dir: %#x | size: %#05x | chr: %#04x '%c' | func: %#04x) " \
+        "===> arg: %lu"
+
+    /* Once per call, the FTL's ones included: as for debugging only. */
+    pr_debug(_MODULE_NAME _COLON_SPACE_SEP IOCTL_PROC_CMD_AND_ARG_DBG _NEW_LINE,
+                       cmd,
+              _IOC_DIR(cmd),
+             _IOC_SIZE(cmd),
+             _IOC_TYPE(cmd), _IOC_TYPE(cmd),
+               _IOC_NR(cmd),
+                       arg);
+
+#define IOCTL_PROC_CMD_SYM_0_DBG "===> REG_USER_CALLER"
+#define IOCTL_PROC_CMD_SYM_1_DBG "===> GET_REQUEST_SIZE"
+#define IOCTL_PROC_CMD_SYM_2_DBG "===> GET_BLOCK"
+#define IOCTL_PROC_CMD_SYM_3_DBG "===> SET_BLOCK"
+    /* --- DEBUG: Printing the ioctl() call ID - End ----------------------- */
+
+    switch(cmd) {
+    case DEVICE_IOCTL_REG_USER_CALLER:
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+                IOCTL_PROC_CMD_SYM_0_DBG _NEW_LINE);
+
+        /*
+         * <current> points to the task structure of the calling process
+         *           in user space.
+         */
+        viosim_usr_app = current;
+
+        /* Writes fall back only as long as pages are declared to stay put. */
+        viosim_ftl_identity = ((arg & DEVICE_REG_FLAG_IDENTITY) != 0);
+
+        /* Another FTL may map pages differently. */
+        viosim_l2p_invalidate(0, 0);
+        viosim_map_reset();
+
+        /* Nor is the previous one's eventfd of any use to it. */
+        mutex_lock(&viosim_req_map_mutex);
+
+        swap(evfd, viosim_ftl_evfd);
+
+        mutex_unlock(&viosim_req_map_mutex);
+
+        if (evfd != NULL) {
+            eventfd_ctx_put(evfd);
+        }
+
+        break;
+
+    case DEVICE_IOCTL_GET_REQUEST_SIZE:
+        pr_debug(_MODULE_NAME _COLON_SPACE_SEP \
+                 IOCTL_PROC_CMD_SYM_1_DBG _NEW_LINE);
+
+        for (;;) {
+            /* Taking the next waiting request, if none is handed yet. */
+            mutex_lock(&viosim_req_map_mutex);
+
+            viosim_ftl_pick();
+
+            /* Not waiting for one when opened non-blocking. */
+            if (mode & FMODE_NDELAY) {
+                if ((viosim_ftl_cur != NULL) && viosim_r_reqsz_wait_flag) {
+                    break;
+                }
+
+                mutex_unlock(&viosim_req_map_mutex);
+
+                ret = -EAGAIN;
+
+                return ret;
+            }
+
+            mutex_unlock(&viosim_req_map_mutex);
+
+            /* Putting the process to sleep before reading. */
+            if (wait_event_interruptible(
+                viosim_r_reqsz_wait_qu, viosim_r_reqsz_wait_flag)) {
+
+                /* When interrupted by a signal -- return with error. */
+                ret = -ERESTARTSYS;
+
+                return ret;
+            }
+
+            mutex_lock(&viosim_req_map_mutex);
+
+            /* The request may have been withdrawn in the meantime. */
+            if ((viosim_ftl_cur != NULL) && viosim_r_reqsz_wait_flag) {
+                break;
+            }
+
+            mutex_unlock(&viosim_req_map_mutex);
+        }
+
+        req_size = viosim_ftl_cur->req_size;
+
+        /*
+         * Setting the get-(read)-request-size-wait-flag back to FALSE
+         * to put the process to sleep until the next request arrives.
+         */
+        viosim_r_reqsz_wait_flag = false;
+
+        mutex_unlock(&viosim_req_map_mutex);
+
+        /* Returning the request size to user space. */
+        ret = put_user(req_size, (unsigned long __user *) arg);
+
+        if (ret != 0) {
+            return ret; /* <== -EFAULT */
+        }
+
+        break;
+
+    case DEVICE_IOCTL_GET_BLOCK:
+        pr_debug(_MODULE_NAME _COLON_SPACE_SEP \
+                 IOCTL_PROC_CMD_SYM_2_DBG _NEW_LINE);
+
+        /* Putting the process to sleep before reading (unless opened */
+        /* non-blocking: failing with -EAGAIN as if the request was gone). */
+        if (!(mode & FMODE_NDELAY) && wait_event_interruptible(
+            viosim_r_block_wait_qu, viosim_r_block_wait_flag)) {
+
+            /* When interrupted by a signal -- return with error. */
+            ret = -ERESTARTSYS;
+
+            return ret;
+        }
+
+        mutex_lock(&viosim_req_map_mutex);
+
+        if ((viosim_ftl_cur == NULL) || !viosim_r_block_wait_flag) {
+            mutex_unlock(&viosim_req_map_mutex);
+
+            ret = -EAGAIN;
+
+            return ret;
+        }
+
+        /* Returning block of data to user space. */
+        dead_bytes = copy_to_user(
+          (struct viosim_request_map __user *) arg, /* <== Dest address.     */
+          viosim_ftl_cur->req_map,                  /* <== Source address.   */
+          (sizeof(*viosim_ftl_cur->req_map) *       /* <== How much to copy? */
+                   viosim_ftl_cur->req_size));
+
+        /*
+         * Setting the read wait flag back to FALSE to put the process
+         * to sleep until the next request arrives.
+         */
+        viosim_r_block_wait_flag = false;
+
+        mutex_unlock(&viosim_req_map_mutex);
+
+        if (dead_bytes > 0UL) {
+            pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                     _COPY_TO_USER_DEAD_BYTES_EXIST_ERR _NEW_LINE,
+                     dead_bytes);
+        }
+
+        break;
+
+    case DEVICE_IOCTL_SET_BLOCK:
+        pr_debug(_MODULE_NAME _COLON_SPACE_SEP \
+                 IOCTL_PROC_CMD_SYM_3_DBG _NEW_LINE);
+
+        mutex_lock(&viosim_req_map_mutex);
+
+        /*
+         * Only the request handed to the FTL (and read by it) may be
+         * answered, and once.
+         */
+        if ((viosim_ftl_cur == NULL) || viosim_r_block_wait_flag) {
+            mutex_unlock(&viosim_req_map_mutex);
+
+            ret = -EINVAL;
+
+            return ret;
+        }
+
+        req_map  = viosim_ftl_cur->req_map;
+        req_size = viosim_ftl_cur->req_size;
+
+        answer_map = kmalloc(sizeof(*req_map) * req_size, GFP_KERNEL);
+
+        if (answer_map == NULL) {
+            mutex_unlock(&viosim_req_map_mutex);
+
+            ret = -ENOMEM;
+
+            return ret;
+        }
+
+        /* Passing block of data to kernel space. */
+        dead_bytes = copy_from_user(
+          answer_map,                               /* <== Dest address.     */
+          (struct viosim_request_map __user *) arg, /* <== Source address.   */
+          (sizeof(*req_map) * req_size));           /* <== How much to copy? */
+
+        if (dead_bytes > 0UL) {
+            mutex_unlock(&viosim_req_map_mutex);
+
+            kfree(answer_map);
+
+            pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                     _COPY_FROM_USER_DEAD_BYTES_EXIST_ERR _NEW_LINE,
+                     dead_bytes);
+
+            ret = -EFAULT;
+
+            return ret;
+        }
+
+        viosim_ftl_answer(viosim_ftl_cur, answer_map);
+
+        kfree(answer_map);
+
+        /* Handing the next one over. */
+        viosim_ftl_cur = NULL;
+
+        if (viosim_ftl_pick()) {
+            wake_up_interruptible(&viosim_r_reqsz_wait_qu);
+            wake_up_interruptible(&viosim_r_block_wait_qu);
+        }
+
+        mutex_unlock(&viosim_req_map_mutex);
+
+        /* Waking up the process before writing. */
+        wake_up_interruptible(&viosim_w_block_wait_qu);
+
+        break;
+
+    case DEVICE_IOCTL_COPY_PAGE:
+        /* Only the registered FTL may move pages (e.g. for its GC). */
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        if (copy_from_user(&page_copy,
+            (struct viosim_page_copy __user *) arg, sizeof(page_copy))) {
+
+            ret = -EFAULT;
+
+            return ret;
+        }
+
+        if ((page_copy.src_ppn >= viosim_nr_pages)
+         || (page_copy.dst_ppn >= viosim_nr_pages)) {
+
+            ret = -EINVAL;
+
+            return ret;
+        }
+
+        page_buffer = kmalloc(DEVICE_PAGE_SIZE, GFP_KERNEL);
+
+        if (page_buffer == NULL) {
+            ret = -ENOMEM;
+
+            return ret;
+        }
+
+        /* Both pages are locked, as for a read-modify-write. */
+        down_read(&viosim_snap_sem);
+
+        viosim_page_lock_rmw(page_copy.src_ppn, page_copy.dst_ppn);
+
+        ret = viosim_dev_read_page(page_copy.src_ppn, page_buffer);
+
+        if (ret == EXIT_SUCCESS) {
+            ret = viosim_dev_write_page(page_copy.dst_ppn, page_buffer);
+        }
+
+        viosim_page_unlock_rmw(page_copy.src_ppn, page_copy.dst_ppn);
+
+        up_read(&viosim_snap_sem);
+
+        kfree(page_buffer);
+
+        if (ret == EXIT_SUCCESS) {
+            viosim_map_move(page_copy.src_ppn, page_copy.dst_ppn);
+            viosim_ftl_last_move(page_copy.src_ppn, page_copy.dst_ppn);
+        }
+
+        break;
+
+    case DEVICE_IOCTL_INVALIDATE_L2P:
+        /* Only the registered FTL knows which pages it has moved. */
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        if (copy_from_user(&l2p_range,
+            (struct viosim_l2p_range __user *) arg, sizeof(l2p_range))) {
+
+            ret = -EFAULT;
+
+            return ret;
+        }
+
+        if ((l2p_range.lpn >= viosim_nr_pages)
+         || (l2p_range.nr_pages > (viosim_nr_pages - l2p_range.lpn))) {
+
+            ret = -EINVAL;
+
+            return ret;
+        }
+
+        viosim_l2p_invalidate(l2p_range.lpn, l2p_range.nr_pages);
+
+        atomic64_add((l2p_range.nr_pages == 0) ? viosim_nr_pages
+                                               : l2p_range.nr_pages,
+                     &viosim_ftl_stats.l2p_invalidated);
+
+        break;
+
+    case DEVICE_IOCTL_GRANT_PPNS:
+        if (!async_writes) {
+            ret = -EOPNOTSUPP;
+
+            return ret;
+        }
+
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        ppn_grant = kmalloc(sizeof(*ppn_grant), GFP_KERNEL);
+
+        if (ppn_grant == NULL) {
+            ret = -ENOMEM;
+
+            return ret;
+        }
+
+        if (copy_from_user(ppn_grant,
+            (struct viosim_ppn_grant __user *) arg, sizeof(*ppn_grant))) {
+
+            kfree(ppn_grant);
+
+            ret = -EFAULT;
+
+            return ret;
+        }
+
+        if (ppn_grant->nr_ppns > DEVICE_PPN_BATCH_MAX) {
+            kfree(ppn_grant);
+
+            ret = -EINVAL;
+
+            return ret;
+        }
+
+        for (i = 0; i < ppn_grant->nr_ppns; i++) {
+            if (ppn_grant->ppns[i] >= viosim_nr_pages) {
+                kfree(ppn_grant);
+
+                ret = -EINVAL;
+
+                return ret;
+            }
+        }
+
+        mutex_lock(&viosim_async_mutex);
+
+        /* The whole batch or nothing: the FTL drains and retries. */
+        if (viosim_ppn_pool_count + viosim_ppn_pool_taken
+            + ppn_grant->nr_ppns > DEVICE_PPN_POOL_MAX) {
+
+            ret = -ENOSPC;
+        }
+
+        for (i = 0; (ret == EXIT_SUCCESS) && (i < ppn_grant->nr_ppns); i++) {
+            viosim_ppn_pool[(viosim_ppn_pool_head + viosim_ppn_pool_count)
+                            % DEVICE_PPN_POOL_MAX] = ppn_grant->ppns[i];
+
+            viosim_ppn_pool_count++;
+        }
+
+        mutex_unlock(&viosim_async_mutex);
+
+        if (ret == EXIT_SUCCESS) {
+            atomic64_add(ppn_grant->nr_ppns, &viosim_ftl_stats.ppns_granted);
+        }
+
+        kfree(ppn_grant);
+
+        break;
+
+    case DEVICE_IOCTL_DRAIN_JOURNAL:
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        journal_batch = kmalloc(sizeof(*journal_batch), GFP_KERNEL);
+
+        if (journal_batch == NULL) {
+            ret = -ENOMEM;
+
+            return ret;
+        }
+
+        mutex_lock(&viosim_async_mutex);
+
+        journal_batch->nr_entries = min_t(u64, viosim_journal_count,
+                                               DEVICE_PPN_BATCH_MAX);
+
+        for (i = 0; i < journal_batch->nr_entries; i++) {
+            journal_batch->entries[i] = viosim_journal[viosim_journal_head];
+
+            viosim_journal_head = (viosim_journal_head + 1)
+                                % DEVICE_JOURNAL_MAX;
+        }
+
+        viosim_journal_count -= journal_batch->nr_entries;
+
+        mutex_unlock(&viosim_async_mutex);
+
+        atomic64_add(journal_batch->nr_entries,
+                     &viosim_ftl_stats.journal_drained);
+
+        /* The entries are gone from the journal now, whatever happens. */
+        if (copy_to_user((struct viosim_journal_batch __user *) arg,
+                         journal_batch, sizeof(*journal_batch))) {
+
+            ret = -EFAULT;
+        }
+
+        kfree(journal_batch);
+
+        break;
+
+    case DEVICE_IOCTL_SET_EVENTFD:
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        ret = get_user(evfd_num, (int __user *) arg);
+
+        if (ret != 0) {
+            return ret; /* <== -EFAULT */
+        }
+
+        if (evfd_num >= 0) {
+            evfd = eventfd_ctx_fdget(evfd_num);
+
+            if (IS_ERR(evfd)) {
+                ret = PTR_ERR(evfd);
+
+                return ret;
+            }
+        }
+
+        mutex_lock(&viosim_req_map_mutex);
+
+        swap(evfd, viosim_ftl_evfd);
+
+        /* Requests queued already are to be picked up right away. */
+        if ((viosim_ftl_evfd != NULL) && (!list_empty(&viosim_ftl_rd_reqs)
+                                       || !list_empty(&viosim_ftl_wr_reqs))) {
+
+            eventfd_signal(viosim_ftl_evfd, 1);
+        }
+
+        mutex_unlock(&viosim_req_map_mutex);
+
+        /* Dropping the one replaced. */
+        if (evfd != NULL) {
+            eventfd_ctx_put(evfd);
+        }
+
+        break;
+
+    case DEVICE_IOCTL_GET_BATCH:
+        /* Only the registered FTL may have requests handed in batches. */
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        if (copy_from_user(&ftl_batch,
+            (struct viosim_ftl_batch __user *) arg, sizeof(ftl_batch))) {
+
+            ret = -EFAULT;
+
+            return ret;
+        }
+
+        for (;;) {
+            /* Putting the process to sleep until a request is waiting */
+            /* (unless opened non-blocking).                           */
+            if (!(mode & FMODE_NDELAY) && wait_event_interruptible(
+                viosim_ftl_batch_wait_qu, viosim_ftl_waiting())) {
+
+                /* When interrupted by a signal -- return with error. */
+                ret = -ERESTARTSYS;
+
+                return ret;
+            }
+
+            mutex_lock(&viosim_req_map_mutex);
+
+            ret = viosim_ftl_fetch(&ftl_batch);
+
+            mutex_unlock(&viosim_req_map_mutex);
+
+            if ((ret != EXIT_SUCCESS) || (ftl_batch.nr_reqs > 0)) {
+                break;
+            }
+
+            /* None is there (or it has been withdrawn in the meantime). */
+            if (mode & FMODE_NDELAY) {
+                ret = -EAGAIN;
+
+                return ret;
+            }
+        }
+
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+
+        /* Returning the number of requests fetched to user space. */
+        ret = put_user(ftl_batch.nr_reqs,
+                       &((struct viosim_ftl_batch __user *) arg)->nr_reqs);
+
+        if (ret != 0) {
+            return ret; /* <== -EFAULT */
+        }
+
+        break;
+
+    case DEVICE_IOCTL_SET_BATCH:
+        if (viosim_usr_app != current) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        if (copy_from_user(&ftl_batch,
+            (struct viosim_ftl_batch __user *) arg, sizeof(ftl_batch))) {
+
+            ret = -EFAULT;
+
+            return ret;
+        }
+
+        ret = viosim_ftl_answer_batch(&ftl_batch);
+
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
+
+        /* Returning the number of requests answered to user space. */
+        ret = put_user(ftl_batch.nr_reqs,
+                       &((struct viosim_ftl_batch __user *) arg)->nr_reqs);
+
+        if (ret != 0) {
+            return ret; /* <== -EFAULT */
+        }
+
+        break;
+
+    case DEVICE_IOCTL_SNAP_TAKE:
+    case DEVICE_IOCTL_SNAP_ROLLBACK:
+    case DEVICE_IOCTL_SNAP_DROP:
+    case DEVICE_IOCTL_SNAP_CLONE:
+        /* Rolling back rewrites the whole device under everyone's feet. */
+        if (!capable(CAP_SYS_ADMIN)) {
+            ret = -EPERM;
+
+            return ret;
+        }
+
+        if (cmd == DEVICE_IOCTL_SNAP_CLONE) {
+            if (copy_from_user(&snap_clone,
+                (struct viosim_snap_clone __user *) arg, sizeof(snap_clone))) {
+
+                ret = -EFAULT;
+
+                return ret;
+            }
+        } else {
+            ret = get_user(snap_slot, (u32 __user *) arg);
+
+            if (ret != 0) {
+                return ret; /* <== -EFAULT */
+            }
+
+            snap_clone.slot = snap_slot;
+            snap_clone.src  = 0;
+        }
+
+        ret = viosim_snap_op(cmd, snap_clone.slot, snap_clone.src);
+
+        break;
+
+    default:
+        ret = -ENOTTY;
+    }
+
+    return ret;
+}
+
+/**
+ * Helper function.
+ * Picks the NUMA node to allocate a backing store stripe on.
+ *
+ * @param stripe The backing store stripe number.
+ *
+ * @return The NUMA node to allocate the stripe on.
+ */
+static int viosim_stripe_node_pick(const unsigned stripe) {
+    int node = first_online_node;
+
+    unsigned i = stripe % nr_online_nodes;
+
+    if (!numa_interleave) {
+        return numa_node;
+    }
+
+    /* Walking online nodes round-robin by stripe number. */
+    while (i--) {
+        node = next_online_node(node);
+    }
+
+    return node;
+}
+
+/**
+ * Inner helper function.
+ * Connects to the remote store and tells it the device size,
+ * then starts receiving the answers on the connection.
+ *
+ * @param conn The remote store connection.
+ *
+ * @return The exit code indicating the status of connecting.
+ */
+static int viosim_remote_connect(struct viosim_remote_conn *conn) {
+    int ret = EXIT_SUCCESS;
+
+    struct sockaddr_un       un;
+    struct sockaddr_in       in;
+    struct sockaddr         *addr;
+    struct viosim_remote_msg msg;
+
+    const char *port = strrchr(remote, ':');
+
+    u16 in_port;
+
+    int family = (remote[0] == '/') ? AF_UNIX : AF_INET;
+    int addr_len;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+    int one = 1;
+#endif
+
+    /* A path is a Unix socket, anything else is IPv4 address:port. */
+    if (family == AF_UNIX) {
+        memset(&un, 0, sizeof(un));
+
+        un.sun_family = AF_UNIX;
+
+        if (strscpy(un.sun_path, remote, sizeof(un.sun_path)) < 0) {
+            ret = -EINVAL;
+
+            return ret;
+        }
+
+        addr     = (struct sockaddr *) &un;
+        addr_len = sizeof(un);
+    } else {
+        memset(&in, 0, sizeof(in));
+
+        in.sin_family = AF_INET;
+
+        if ((port == NULL)
+            || (!in4_pton(remote, port - remote,
+                          (u8 *) &in.sin_addr.s_addr, -1, NULL))
+            || (kstrtou16(port + 1, 10, &in_port) != 0)) {
+
+            ret = -EINVAL;
+
+            return ret;
+        }
+
+        in.sin_port = htons(in_port);
+
+        addr     = (struct sockaddr *) &in;
+        addr_len = sizeof(in);
+    }
+
+    ret = sock_create_kern(&init_net, family, SOCK_STREAM, 0, &conn->sock);
+
+    if (ret < 0) {
+        conn->sock = NULL;
+
+        return ret;
+    }
+
+    ret = kernel_connect(conn->sock, addr, addr_len, 0);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Page requests are small and latency-bound: sending them at once. */
+    if (family == AF_INET) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+        tcp_sock_set_nodelay(conn->sock->sk);
+#else
+        kernel_setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY,
+                          (char *) &one, sizeof(one));
+#endif
+    }
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.magic = DEVICE_REMOTE_MAGIC;
+    msg.op    = DEVICE_REMOTE_OP_HELLO;
+    msg.ppn   = viosim_nr_pages;
+
+    ret = viosim_remote_send(conn, &msg, NULL, 0);
+
+    if (ret == EXIT_SUCCESS) {
+        ret = viosim_remote_recv(conn->sock, &msg, sizeof(msg));
+    }
+
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
+
+    /* The server may refuse a device of another size than its own. */
+    if ((msg.magic != DEVICE_REMOTE_MAGIC) || (msg.status != 0)) {
+        ret = -EPROTO;
+
+        return ret;
+    }
+
+    conn->rx_task = kthread_run(viosim_remote_rx, conn,
+                                DEVICE_NAME "-rx%u", conn->index);
+
+    if (IS_ERR(conn->rx_task)) {
+        ret = PTR_ERR(conn->rx_task);
+
+        conn->rx_task = NULL;
+
+        return ret;
+    }
+
+    return ret;
+}
+
+/**
+ * Connects to the user space server keeping the backing store,
+ * as many connections as asked for.
+ *
+ * @return The exit code indicating the status of connecting.
+ */
+static int viosim_remote_init(void) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_remote_conn *conn;
+
+    unsigned i;
+
+    if ((remote[0] != '/') && (strchr(remote, ':') == NULL)) {
+        ret = -EINVAL;
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _REMOTE_ADDR_INVALID_ERR _NEW_LINE, remote);
+
+        return ret;
+    }
+
+    viosim_remote_nr = clamp_t(unsigned, remote_conns,
+                               1, DEVICE_REMOTE_CONNS_MAX);
+
+    viosim_remote_conns = kcalloc(viosim_remote_nr,
+                                  sizeof(*viosim_remote_conns), GFP_KERNEL);
+
+    if (viosim_remote_conns == NULL) {
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    for (i = 0; i < viosim_remote_nr; i++) {
+        conn = &viosim_remote_conns[i];
+
+        conn->index = i;
+
+        mutex_init(&conn->send_mutex);
+        spin_lock_init(&conn->lock);
+        init_waitqueue_head(&conn->slot_wait);
+
+        ret = viosim_remote_connect(conn);
+
+        if (ret != EXIT_SUCCESS) {
+            pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                     _REMOTE_CONNECT_FAILED_ERR _NEW_LINE, remote, i, ret);
+
+            return ret;
+        }
+    }
+
+    pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+            _REMOTE_CONNECTED_MSG _NEW_LINE, remote, viosim_remote_nr,
+            clamp_t(unsigned, remote_depth, 1, DEVICE_REMOTE_DEPTH_MAX));
+
+    return ret;
+}
+
+/**
+ * Closes the remote store connections: shutting them down makes
+ * the receiving threads fail whatever is still in flight.
+ */
+static void viosim_remote_free(void) {
+    struct viosim_remote_conn *conn;
+
+    unsigned i;
+
+    if (viosim_remote_conns == NULL) {
+        return;
+    }
+
+    for (i = 0; i < viosim_remote_nr; i++) {
+        conn = &viosim_remote_conns[i];
+
+        spin_lock(&conn->lock);
+
+        conn->dead = true;
+
+        spin_unlock(&conn->lock);
+
+        if (conn->sock != NULL) {
+            kernel_sock_shutdown(conn->sock, SHUT_RDWR);
+        }
+    }
+
+    for (i = 0; i < viosim_remote_nr; i++) {
+        conn = &viosim_remote_conns[i];
+
+        if (conn->rx_task != NULL) {
+            kthread_stop(conn->rx_task);
+        }
+
+        if (conn->sock != NULL) {
+            sock_release(conn->sock);
+        }
+    }
+
+    kfree(viosim_remote_conns);
+
+    viosim_remote_conns = NULL;
+}
+
+/** Frees the device backing store. */
+static void viosim_store_free(void) {
+    unsigned stripe;
+    unsigned i;
+    u64      ppn;
+
+    /* Dropping snapshots, then shared, compressed, and on-demand pages. */
+    for (i = 0; i < DEVICE_SNAP_SLOTS; i++) {
+        if (viosim_snaps[i] != NULL) {
+            viosim_snap_release(viosim_snaps[i]);
+        }
+
+        viosim_snaps[i] = NULL;
+    }
+
+    viosim_snap_count = 0;
+
+    viosim_remote_free();
+
+    if (viosim_page_table != NULL) {
+        for (ppn = 0; ppn < viosim_nr_pages; ppn++) {
+            viosim_page_release(ppn);
+        }
+    }
+
+    if ((data_buffer != NULL) && (viosim_stripes != NULL)) {
+        for (stripe = 0; stripe < viosim_nr_stripes; stripe++) {
+            ppn = (u64) stripe * DEVICE_NUMBER_OF_PAGES_PER_STRIPE;
+
+            /* A huge stripe is a single compound page: free it at once. */
+            if (viosim_stripes[stripe].order > 0) {
+                __free_pages(virt_to_page(data_buffer[ppn]),
+                             viosim_stripes[stripe].order);
+
+                continue;
+            }
+
+            for (i = 0; i < DEVICE_NUMBER_OF_PAGES_PER_STRIPE; i++) {
+                if (data_buffer[ppn + i] != NULL) {
+                    free_page((unsigned long) data_buffer[ppn + i]);
+                }
+            }
+        }
+    }
+
+    if (viosim_comp_pool != NULL) {
+        zs_destroy_pool(viosim_comp_pool);
+    }
+
+    if ((viosim_comp_tfm != NULL) && (!IS_ERR(viosim_comp_tfm))) {
+        crypto_free_comp(viosim_comp_tfm);
+    }
+
+    kvfree(viosim_page_table);
+    kfree(viosim_comp_buffer);
+
+    /* The last-known FTL mapping and the L2P cache are sized by it, too. */
+    kvfree(viosim_ftl_last);
+    kvfree(viosim_ftl_last_p2l);
+    kvfree(viosim_l2p);
+    kvfree(viosim_wr_stamp);
+
+    viosim_ftl_last     = NULL;
+    viosim_ftl_last_p2l = NULL;
+    viosim_l2p          = NULL;
+    viosim_wr_stamp     = NULL;
+
+    /*
+     * So is the mapping export, which goes along with its misc device
+     * (that can't be mapped by anyone anymore, keeping the module in).
+     */
+    if (viosim_map != NULL) {
+        misc_deregister(&viosim_map_misc);
+
+        vfree(viosim_map);
+        kvfree(viosim_map_p2l);
+    }
+
+    viosim_map         = NULL;
+    viosim_map_p2l     = NULL;
+
+    viosim_comp_tfm    = NULL;
+    viosim_comp_pool   = NULL;
+    viosim_page_table  = NULL;
+    viosim_comp_buffer = NULL;
+
+    kvfree(data_buffer);
+    kfree(viosim_stripes);
+    kfree(viosim_numa_stats);
+
+    data_buffer       = NULL;
+    viosim_stripes    = NULL;
+    viosim_numa_stats = NULL;
+}
+
+/**
+ * Allocates a backing store stripe on the NUMA node picked
+ * by <code>viosim_stripe_node_pick(...)</code>: as a single 2 MiB
+ * compound page when huge pages are requested, or page by page otherwise
+ * (and as a fallback when no huge page is available on the node).
+ *
+ * @param stripe The backing store stripe number.
+ *
+ * @return The exit code indicating the status of allocating the stripe.
+ */
+static int viosim_stripe_alloc(const unsigned stripe) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_stripe *strp = &viosim_stripes[stripe];
+    struct page          *page = NULL;
+
+    u64 ppn  = (u64) stripe * DEVICE_NUMBER_OF_PAGES_PER_STRIPE;
+    int node = viosim_stripe_node_pick(stripe);
+
+    unsigned i;
+
+    if (hugepages) {
+        page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO
+                                    | __GFP_COMP | __GFP_NOWARN,
+                                DEVICE_HUGE_PAGE_ORDER);
+
+        if (page == NULL) {
+            viosim_fallback_stripes++;
+        }
+    }
+
+    if (page != NULL) {
+        strp->order = DEVICE_HUGE_PAGE_ORDER;
+        strp->node  = page_to_nid(page);
+
+        for (i = 0; i < DEVICE_NUMBER_OF_PAGES_PER_STRIPE; i++) {
+            data_buffer[ppn + i] = (u8 *) page_address(page)
+                                 + (i * DEVICE_PAGE_SIZE);
+        }
+
+        atomic64_add(DEVICE_NUMBER_OF_PAGES_PER_STRIPE,
+                     &viosim_numa_stats[strp->node].alloc_pages);
+
+        viosim_huge_stripes++;
+
+        return ret;
+    }
+
+    for (i = 0; i < DEVICE_NUMBER_OF_PAGES_PER_STRIPE; i++) {
+        page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, 0);
+
+        if (page == NULL) {
+            ret = -ENOMEM;
+
+            return ret;
+        }
+
+        data_buffer[ppn + i] = page_address(page);
+
+        /*
+         * Recording where the page actually landed: the allocator may fall
+         * back to another node when the preferred one is short of memory.
+         */
+        atomic64_inc(&viosim_numa_stats[page_to_nid(page)].alloc_pages);
+
+        if (i == 0) {
+            strp->node = page_to_nid(page);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Sets up the compressed backing store: each page is compressed
+ * (or kept raw) when written.
+ *
+ * @return The exit code indicating the status of setting up the store.
+ */
+static int viosim_comp_init(void) {
+    int ret = EXIT_SUCCESS;
+
+    viosim_comp_tfm = crypto_alloc_comp(comp_algo, 0, 0);
+
+    if (IS_ERR(viosim_comp_tfm)) {
+        ret = PTR_ERR(viosim_comp_tfm);
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _COMP_ALGO_UNAVAILABLE_ERR _NEW_LINE, comp_algo);
+
+        return ret;
+    }
+
+    viosim_comp_pool   = zs_create_pool(_MODULE_NAME);
+    viosim_comp_buffer = kmalloc(DEVICE_COMP_BUFFER_SIZE, GFP_KERNEL);
+
+    if ((viosim_comp_pool == NULL) || (viosim_comp_buffer == NULL)) {
+        ret = -ENOMEM;
+
+        return ret;
+    }
+
+    pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+            _BACKING_STORE_COMPRESSED_MSG _NEW_LINE, comp_algo);
+
+    return ret;
+}
+
+/**
+ * Allocates the device backing store stripe by stripe.
+ *
+ * @return The exit code indicating the status of allocating the store.
+ */
+static int viosim_store_alloc(void) {
+    int ret = EXIT_SUCCESS;
+
+    unsigned stripe;
+    int      node;
+
+    if ((numa_node != NUMA_NO_NODE)
+        && ((numa_node < 0) || (numa_node >= nr_node_ids)
+                            || (!node_online(numa_node)))) {
+
+        ret = -EINVAL;
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _NUMA_NODE_INVALID_ERR _NEW_LINE, numa_node);
+
+        return ret;
+    }
+
+    if (nr_blocks == 0) {
+        ret = -EINVAL;
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _NR_BLOCKS_INVALID_ERR _NEW_LINE);
+
+        return ret;
+    }
+
+    if (hugepages && ((comp_algo[0] != '\0') || dedup)) {
+        ret = -EINVAL;
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _STORE_WITH_HUGEPAGES_ERR _NEW_LINE);
+
+        return ret;
+    }
+
+    if ((comp_algo[0] != '\0') && dedup) {
+        ret = -EINVAL;
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _COMP_WITH_DEDUP_ERR _NEW_LINE);
+
+        return ret;
+    }
+
+    if ((remote[0] != '\0') && (hugepages || (comp_algo[0] != '\0')
+                                         || zero_pages || dedup)) {
+
+        ret = -EINVAL;
+
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _REMOTE_WITH_STORE_ERR _NEW_LINE);
+
+        return ret;
+    }
+
+    viosim_nr_pages   = (u64) nr_blocks * DEVICE_NUMBER_OF_PAGES_PER_BLOCK;
+    viosim_nr_stripes = DIV_ROUND_UP(viosim_nr_pages,
+                                     DEVICE_NUMBER_OF_PAGES_PER_STRIPE);
+
+    /* A store kept by a user space server has no pages in the kernel. */
+    if (remote[0] == '\0') {
+        data_buffer = kvzalloc(sizeof(*data_buffer) * viosim_nr_pages,
+                               GFP_KERNEL);
+    }
+
+    viosim_stripes    = kcalloc(viosim_nr_stripes,
+                                sizeof(*viosim_stripes),    GFP_KERNEL);
+
+    viosim_numa_stats = kcalloc(nr_node_ids,
+                                sizeof(*viosim_numa_stats), GFP_KERNEL);
+
+    if (((data_buffer == NULL) && (remote[0] == '\0'))
+                              || (viosim_stripes    == NULL)
+                              || (viosim_numa_stats == NULL)) {
+
+        ret = -ENOMEM;
+
+        goto store_alloc_failed;
+    }
+
+    /* --- Setting up the page entry table - Begin ------------------------ */
+    if ((comp_algo[0] != '\0') || dedup || zero_pages) {
+        viosim_page_table = kvzalloc(sizeof(*viosim_page_table)
+                                   * viosim_nr_pages, GFP_KERNEL);
+
+        if (viosim_page_table == NULL) {
+            ret = -ENOMEM;
+
+            goto store_alloc_failed;
+        }
+    }
+
+    if (comp_algo[0] != '\0') {
+        ret = viosim_comp_init();
+
+        if (ret != EXIT_SUCCESS) {
+            goto store_alloc_failed;
+        }
+    }
+
+    /*
+     * Without huge pages, such a store is allocated on demand (or kept
+     * by a server): only recording the node each stripe is to be placed on.
+     */
+    if (((viosim_page_table != NULL) || (remote[0] != '\0'))
+                                     && (!hugepages)) {
+
+        for (stripe = 0; stripe < viosim_nr_stripes; stripe++) {
+            viosim_stripes[stripe].node = viosim_stripe_node_pick(stripe);
+
+            if (viosim_stripes[stripe].node == NUMA_NO_NODE) {
+                viosim_stripes[stripe].node = numa_node_id();
+            }
+        }
+
+        if (remote[0] != '\0') {
+            ret = viosim_remote_init();
+
+            if (ret != EXIT_SUCCESS) {
+                goto store_alloc_failed;
+            }
+        }
+
+        return ret;
+    }
+    /* --- Setting up the page entry table - End -------------------------- */
+
+    for (stripe = 0; stripe < viosim_nr_stripes; stripe++) {
+        ret = viosim_stripe_alloc(stripe);
 
-/**
- * The main working buffers:
- * <ul>
- * <li><code>page_buffer</code> is the container to store
- * page-sized device data portion.</li>
- * <li><code>data_buffer</code> is the container to store
- * all device data.</li>
- * </ul>
- */
-static u8 page_buffer[DEVICE_PAGE_SIZE];
-static u8 data_buffer[DEVICE_TOTAL_SIZE];
+        if (ret != EXIT_SUCCESS) {
+            goto store_alloc_failed;
+        }
 
-/** The device request size. */
-static unsigned viosim_req_size;
+        cond_resched();
+    }
 
-/** Processes requests that have been placed on the queue. */
-static void viosim_req_proc(void) {
-    /* Putting the task in the kernel-global workqueue. */
-    schedule_work(&viosim_req_task);
+    for_each_online_node(node) {
+        if (atomic64_read(&viosim_numa_stats[node].alloc_pages) > 0) {
+            pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+                    _BACKING_STORE_NODE_PAGES_MSG _NEW_LINE,
+    (long long) atomic64_read(&viosim_numa_stats[node].alloc_pages), node);
+        }
+    }
+
+    if (hugepages) {
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
+                _BACKING_STORE_HUGE_STRIPES_MSG _NEW_LINE,
+                viosim_huge_stripes, viosim_nr_stripes);
+    }
+
+    return ret;
+
+store_alloc_failed:
+    pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+             _ALLOCATE_BACKING_STORE_FAILED_ERR _NEW_LINE);
+
+    viosim_store_free();
+
+    return ret;
 }
 
 /**
- * Inner helper function.
- * Gets called from inside <code>viosim_dev_read(...)</code>
- * and <code>viosim_dev_write(...)</code> helpers.
+ * Shows per-NUMA-node backing store statistics
+ * through the debugfs <code>numa</code> file.
  *
- * @param ppn The physical page number (PPN).
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
  *
- * @return The exit code indicating the status of reading a page of data
- *         from the device.
+ * @return The exit code indicating the status of showing the statistics.
  */
-static int viosim_dev_read_page(const u64 ppn) {
-    int ret = EXIT_SUCCESS;
+static int viosim_numa_show(struct seq_file *m, void *v) {
+    int node;
 
-    if (ppn >= DEVICE_NUMBER_OF_PAGES) {
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                _READ_CAPACITY_REACHED_MSG _NEW_LINE);
+    seq_printf(m, "%-6s %12s %16s %16s" _NEW_LINE,
+               "node", "alloc_pages", "local_copies", "remote_copies");
 
-        /* Returning "success" anyway, because it's not an error. */
-        return ret;
+    for_each_online_node(node) {
+        seq_printf(m, "%-6d %12lld %16lld %16lld" _NEW_LINE, node,
+    (long long) atomic64_read(&viosim_numa_stats[node].alloc_pages),
+    (long long) atomic64_read(&viosim_numa_stats[node].local_copies),
+    (long long) atomic64_read(&viosim_numa_stats[node].remote_copies));
     }
 
-    /*
-     * Copying one-page data portion from the consolidated data buffer
-     * into the device page buffer, i.e. reading the data page.
-     */
-    memcpy(page_buffer, data_buffer + (ppn * DEVICE_PAGE_SIZE),
-        DEVICE_PAGE_SIZE);
-
-    return ret;
+    return EXIT_SUCCESS;
 }
 
+DEFINE_SHOW_ATTRIBUTE(viosim_numa);
+
 /**
- * Helper (wrapper) function.
- * Reads data from the device.
+ * Shows the backing store layout through the debugfs <code>store</code> file.
  *
- * @param req_map The <code>viosim_request_map</code> structure which holds
- *                the device read/write request mapping data.
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
  *
- * @return The exit code indicating the status of reading data from the device.
+ * @return The exit code indicating the status of showing the layout.
  */
-static int viosim_dev_read(struct viosim_request_map *req_map) {
-    int ret = EXIT_SUCCESS;
+static int viosim_store_show(struct seq_file *m, void *v) {
+    seq_printf(m, "pages:            %llu" _NEW_LINE, viosim_nr_pages);
+    seq_printf(m, "stripes:          %u"   _NEW_LINE, viosim_nr_stripes);
+    seq_printf(m, "huge_stripes:     %u"   _NEW_LINE, viosim_huge_stripes);
+    seq_printf(m, "fallback_stripes: %u"   _NEW_LINE,
+                                           viosim_fallback_stripes);
+    seq_printf(m, "on_demand_pages:  %lld" _NEW_LINE,
+                   (long long) atomic64_read(&viosim_raw_pages));
+
+    return EXIT_SUCCESS;
+}
 
-    struct viosim_page_map *page_map = &req_map->page_map;
+DEFINE_SHOW_ATTRIBUTE(viosim_store);
 
-    /* Getting the PPN from page map. */
-    u64 ppn = page_map->ppn;
+/**
+ * Shows the compressed backing store statistics
+ * through the debugfs <code>comp</code> file.
+ *
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
+ *
+ * @return The exit code indicating the status of showing the statistics.
+ */
+static int viosim_comp_show(struct seq_file *m, void *v) {
+    struct viosim_comp_stats *st = &viosim_comp_stats;
 
-    /* Calculating the offset from the starting sector to read data. */
-    u16 sector_offset = \
-        req_map->start_sector % DEVICE_NUMBER_OF_SECTORS_PER_PAGE;
+    /* Compression ratio and throughput, in hundredths and MB/s. */
+    u64 ratio  = 0;
+    u64 comp   = 0;
+    u64 decomp = 0;
 
-    /* Getting the number of sectors from request map. */
-    u64 num_of_sectors = req_map->num_of_sectors;
+    u64 comp_pages   = atomic64_read(&st->comp_pages);
+    u64 stored_bytes = atomic64_read(&st->stored_bytes);
 
-    /*
-     * Getting the pointer to the read/write request buffer. --
-     * I.e. where read data is stored.
-     */
-    void *req_buffer = req_map->req_buffer;
+    if (viosim_comp_tfm == NULL) {
+        seq_puts(m, "algorithm:      none" _NEW_LINE);
 
-    /* Don't do anything if the page map table's end reached. */
-    if (ppn == DEVICE_PAGE_MAP_TABLE_SIZE) {
-        return ret;
+        return EXIT_SUCCESS;
     }
 
-    /*
-     * Reading a page of data from the device.
-     * Here the page_buffer array is populated.
-     */
-    ret = viosim_dev_read_page(ppn);
+    if (stored_bytes > 0) {
+        ratio  = div64_u64(comp_pages * DEVICE_PAGE_SIZE * 100,
+                           stored_bytes);
+    }
 
-    /*
-     * Copying the amount of request sectors-occupied data portion
-     * from the device page buffer into the read/write request buffer.
-     */
-    memcpy(req_buffer, page_buffer + (sector_offset * DEVICE_SECTOR_SIZE),
-        (num_of_sectors * DEVICE_SECTOR_SIZE));
+    if (st->comp_ns > 0) {
+        comp   = div64_u64(st->comp_ops   * DEVICE_PAGE_SIZE * 1000,
+                           st->comp_ns);
+    }
 
-    viosim_r_block_wait_flag = true;
+    if (st->decomp_ns > 0) {
+        decomp = div64_u64(st->decomp_ops * DEVICE_PAGE_SIZE * 1000,
+                           st->decomp_ns);
+    }
 
-    return ret;
+    seq_printf(m, "algorithm:      %s"   _NEW_LINE, comp_algo);
+    seq_printf(m, "comp_pages:     %llu" _NEW_LINE, comp_pages);
+    seq_printf(m, "raw_pages:      %lld" _NEW_LINE,
+                   (long long) atomic64_read(&viosim_raw_pages));
+    seq_printf(m, "stored_bytes:   %llu" _NEW_LINE, stored_bytes);
+    seq_printf(m, "pool_bytes:     %llu" _NEW_LINE,
+        (u64) zs_get_total_pages(viosim_comp_pool) * PAGE_SIZE);
+    seq_printf(m, "ratio:          %llu.%02llu" _NEW_LINE,
+                                  ratio / 100, ratio % 100);
+    seq_printf(m, "comp_ops:       %llu" _NEW_LINE, st->comp_ops);
+    seq_printf(m, "comp_out_bytes: %llu" _NEW_LINE, st->comp_out_bytes);
+    seq_printf(m, "comp_mbps:      %llu" _NEW_LINE, comp);
+    seq_printf(m, "decomp_ops:     %llu" _NEW_LINE, st->decomp_ops);
+    seq_printf(m, "decomp_mbps:    %llu" _NEW_LINE, decomp);
+
+    return EXIT_SUCCESS;
 }
 
+DEFINE_SHOW_ATTRIBUTE(viosim_comp);
+
 /**
- * Inner helper function.
- * Gets called from inside <code>viosim_dev_write(...)</code> helper.
+ * Prints the copy mode, the number of cached and non-temporal copies,
+ * and the copy calibration (if done) into the debugfs file.
  *
- * @param ppnx The new physical page number (PPN).
+ * @param m The <code>seq_file</code> to print into.
+ * @param v N/A.
  *
- * @return The exit code indicating the status of writing a page of data
- *         to the device.
+ * @return <code>EXIT_SUCCESS</code>.
  */
-static int viosim_dev_write_page(const u64 ppnx) {
-    int ret = EXIT_SUCCESS;
+static int viosim_copy_show(struct seq_file *m, void *v) {
+    struct viosim_copy_stats *st = &viosim_copy_stats;
+
+    unsigned i;
+
+    seq_printf(m, "mode:           %s"   _NEW_LINE, copy_mode);
+    seq_printf(m, "nt_min_bytes:   %u"   _NEW_LINE, viosim_copy_nt_min);
+    seq_printf(m, "copies:         %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->copies));
+    seq_printf(m, "bytes:          %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->bytes));
+    seq_printf(m, "nt_copies:      %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->nt_copies));
+    seq_printf(m, "nt_bytes:       %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->nt_bytes));
+
+    if (st->calib_memcpy_ns[0] == 0) {
+        return EXIT_SUCCESS;
+    }
 
-    if (ppnx >= DEVICE_NUMBER_OF_PAGES) {
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                _WRITE_CAPACITY_REACHED_MSG _NEW_LINE);
+    seq_puts(m, "size    memcpy_ns       nt_ns" _NEW_LINE);
 
-        /* Returning "success" anyway, because it's not an error. */
-        return ret;
+    for (i = 0; i < DEVICE_COPY_CALIB_STEPS; i++) {
+        seq_printf(m, "%-4u   %10llu  %10llu" _NEW_LINE,
+                   DEVICE_SECTOR_SIZE << i,
+                   st->calib_memcpy_ns[i], st->calib_nt_ns[i]);
     }
 
-    /*
-     * Copying one-page data portion from the device page buffer
-     * into the consolidated data buffer, i.e. writing the data page.
-     */
-    memcpy(data_buffer + (ppnx * DEVICE_PAGE_SIZE), page_buffer,
-        DEVICE_PAGE_SIZE);
+    return EXIT_SUCCESS;
+}
 
-    return ret;
+DEFINE_SHOW_ATTRIBUTE(viosim_copy);
+
+/**
+ * Shows the FTL handshake statistics through the debugfs
+ * <code>ftl</code> file.
+ *
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
+ *
+ * @return The exit code indicating the status of showing the statistics.
+ */
+static int viosim_ftl_show(struct seq_file *m, void *v) {
+    struct viosim_ftl_stats *st = &viosim_ftl_stats;
+
+    seq_printf(m, "timeout_ms:     %u"   _NEW_LINE, ftl_timeout_ms);
+    seq_printf(m, "fallback:       %s"   _NEW_LINE, ftl_fallback);
+    seq_printf(m, "answered:       %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->answered));
+    seq_printf(m, "timeouts:       %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->timeouts));
+    seq_printf(m, "fallbacks:      %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->fallbacks));
+    seq_printf(m, "failures:       %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->failures));
+    seq_printf(m, "l2p_cache:      %s"   _NEW_LINE,
+                   (viosim_l2p != NULL) ? "on" : "off");
+    seq_printf(m, "l2p_hits:       %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->l2p_hits));
+    seq_printf(m, "l2p_misses:     %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->l2p_misses));
+    seq_printf(m, "l2p_invalidated: %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->l2p_invalidated));
+    seq_printf(m, "async_writes:   %s"   _NEW_LINE,
+                   async_writes ? "on" : "off");
+    seq_printf(m, "async_placed:   %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->async_writes));
+    seq_printf(m, "async_misses:   %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->async_misses));
+    seq_printf(m, "ppns_granted:   %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->ppns_granted));
+    seq_printf(m, "journal_drained: %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->journal_drained));
+
+    mutex_lock(&viosim_async_mutex);
+
+    seq_printf(m, "ppn_pool:       %u"   _NEW_LINE, viosim_ppn_pool_count);
+    seq_printf(m, "journal:        %u"   _NEW_LINE, viosim_journal_count);
+
+    mutex_unlock(&viosim_async_mutex);
+
+    seq_printf(m, "map_export:     %s"   _NEW_LINE,
+                   (viosim_map != NULL) ? "on" : "off");
+
+    if (viosim_map != NULL) {
+        seq_printf(m, "map_generation: %llu" _NEW_LINE,
+                       READ_ONCE(viosim_map_hdr->generation));
+    }
+
+    return EXIT_SUCCESS;
 }
 
+DEFINE_SHOW_ATTRIBUTE(viosim_ftl);
+
 /**
- * Helper (wrapper) function.
- * Writes data to the device.
+ * Shows the caps of reads and writes and the time requests were held
+ * to keep to them through the debugfs <code>throttle</code> file.
  *
- * @param req_map The <code>viosim_request_map</code> structure which holds
- *                the device read/write request mapping data.
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
  *
- * @return The exit code indicating the status of writing data to the device.
+ * @return The exit code indicating the status of showing the statistics.
  */
-static int viosim_dev_write(struct viosim_request_map *req_map) {
-    int ret = EXIT_SUCCESS;
+static int viosim_throttle_show(struct seq_file *m, void *v) {
+    struct viosim_throttle rd, wr;
+
+    spin_lock_irq(&viosim_lock);
+
+    rd = viosim_rd_throttle;
+    wr = viosim_wr_throttle;
+
+    spin_unlock_irq(&viosim_lock);
+
+    seq_puts(m,   "               read            write" _NEW_LINE);
+    seq_printf(m, "iops_cap:      %-15u %u"   _NEW_LINE,
+                   read_iops, write_iops);
+    seq_printf(m, "bps_cap:       %-15lu %lu" _NEW_LINE,
+                   read_bps, write_bps);
+    seq_printf(m, "burst_ms:      %-15u %u"   _NEW_LINE,
+                   read_burst_ms, write_burst_ms);
+    seq_printf(m, "dispatched:    %-15llu %llu" _NEW_LINE,
+                   rd.dispatched, wr.dispatched);
+    seq_printf(m, "bytes:         %-15llu %llu" _NEW_LINE,
+                   rd.bytes, wr.bytes);
+    seq_printf(m, "throttled:     %-15llu %llu" _NEW_LINE,
+                   rd.throttled, wr.throttled);
+    seq_printf(m, "throttled_us:  %-15llu %llu" _NEW_LINE,
+                   div_u64(rd.throttled_ns, NSEC_PER_USEC),
+                   div_u64(wr.throttled_ns, NSEC_PER_USEC));
+    seq_printf(m, "held:          %-15s %s"   _NEW_LINE,
+                   (rd.held_since_ns != 0) ? "yes" : "no",
+                   (wr.held_since_ns != 0) ? "yes" : "no");
+
+    return EXIT_SUCCESS;
+}
 
-    struct viosim_page_map *page_map = &req_map->page_map;
+DEFINE_SHOW_ATTRIBUTE(viosim_throttle);
 
-    /* Getting the PPN from page map. */
-    u64 ppn = page_map->ppn;
+/**
+ * Shows the I/O trace buffer setup and the number of records dropped
+ * through the debugfs <code>trace</code> file.
+ *
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
+ *
+ * @return The exit code indicating the status of showing the statistics.
+ */
+static int viosim_trace_show(struct seq_file *m, void *v) {
+    seq_printf(m, "buffers:        %s"   _NEW_LINE,
+                   (viosim_trace_chan != NULL) ? "on" : "off");
+    seq_printf(m, "recording:      %s"   _NEW_LINE,
+                   READ_ONCE(trace) ? "on" : "off");
+    seq_printf(m, "buffer_kb:      %u"   _NEW_LINE, trace_kb);
+    seq_printf(m, "record_bytes:   %zu"  _NEW_LINE,
+                   sizeof(struct viosim_trace_rec));
+    seq_printf(m, "dropped:        %lld" _NEW_LINE,
+                   (long long) atomic64_read(&viosim_trace_dropped));
+
+    return EXIT_SUCCESS;
+}
 
-    /* Getting the new PPN from page map (for write). */
-    u64 ppnx = page_map->ppnx;
+DEFINE_SHOW_ATTRIBUTE(viosim_trace);
 
-    /* Calculating the offset from the starting sector to read data. */
-    u16 sector_offset = \
-        req_map->start_sector % DEVICE_NUMBER_OF_SECTORS_PER_PAGE;
+/**
+ * Shows the backing store snapshots and their statistics
+ * through the debugfs <code>snap</code> file.
+ *
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
+ *
+ * @return The exit code indicating the status of showing the statistics.
+ */
+static int viosim_snap_show(struct seq_file *m, void *v) {
+    struct viosim_snap_stats *st = &viosim_snap_stats;
 
-    /* Getting the number of sectors from request map. */
-    u64 num_of_sectors = req_map->num_of_sectors;
+    unsigned i;
 
-    /*
-     * Getting the pointer to the read/write request buffer. --
-     * I.e. where read data is stored.
-     */
-    void *req_buffer = req_map->req_buffer;
+    down_read(&viosim_snap_sem);
 
-    /* --- Performing the "Read-Modify-Write" atomic operation - Begin ----- */
-    /* (1) Read                                 */
-    /* Reading a page of data from the device.  */
-    /* Here the page_buffer array is populated. */
-    ret = viosim_dev_read_page(ppn);
+    seq_puts(m, "slots:          ");
 
-    if (ret != EXIT_SUCCESS) {
-        return ret;
+    for (i = 0; i < DEVICE_SNAP_SLOTS; i++) {
+        if (viosim_snaps[i] != NULL) {
+            seq_printf(m, "%u ", i);
+        }
     }
 
-    /* (2) Modify                                                      */
-    /* Copying the amount of request sectors-occupied data portion     */
-    /* from the read/write request buffer into the device page buffer. */
-    memcpy(page_buffer + (sector_offset * DEVICE_SECTOR_SIZE), req_buffer,
-        (num_of_sectors * DEVICE_SECTOR_SIZE));
+    seq_puts(m, _NEW_LINE);
 
-    /* (3) Write                                */
-    /* Writing data page to the device.         */
-    /* Here the data_buffer array is populated. */
-    ret = viosim_dev_write_page(ppnx);
-    /* --- Performing the "Read-Modify-Write" atomic operation - End ------- */
+    seq_printf(m, "taken:          %llu" _NEW_LINE, st->taken);
+    seq_printf(m, "rollbacks:      %llu" _NEW_LINE, st->rollbacks);
+    seq_printf(m, "last_take_us:   %llu" _NEW_LINE,
+                   div_u64(st->last_take_ns,     NSEC_PER_USEC));
+    seq_printf(m, "last_rollback_us: %llu" _NEW_LINE,
+                   div_u64(st->last_rollback_ns, NSEC_PER_USEC));
+    seq_printf(m, "cow_pages:      %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->cow_pages));
 
-    viosim_w_block_wait_flag = false;
+    up_read(&viosim_snap_sem);
 
-    return ret;
+    return EXIT_SUCCESS;
 }
 
+DEFINE_SHOW_ATTRIBUTE(viosim_snap);
+
 /**
- * Processes the request fetched from the request queue, i.e.\ data transfer.
+ * Shows the remote store connections and statistics
+ * through the debugfs <code>remote</code> file.
  *
- * @param req The <code>request</code> structure containing the request
- *            to process.
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
  *
- * @return The exit code indicating the overall status of processing
- *         the request.
+ * @return The exit code indicating the status of showing the statistics.
  */
-static int viosim_req_transfer(const struct request *req) {
-    int ret = EXIT_SUCCESS;
+static int viosim_remote_show(struct seq_file *m, void *v) {
+    struct viosim_remote_stats *st = &viosim_remote_stats;
+    struct viosim_remote_conn  *conn;
 
-    char *transf_dir_s = NULL;
+    u64 ops = atomic64_read(&st->reads) + atomic64_read(&st->writes);
 
-    struct bio_vec      bv;
-    struct req_iterator iter;
+    unsigned in_flight = 0;
+    unsigned peak      = 0;
+    unsigned up        = 0;
+    unsigned i;
 
-    unsigned short i = 0;
+    for (i = 0; (viosim_remote_conns != NULL)
+                && (i < viosim_remote_nr); i++) {
+        conn = &viosim_remote_conns[i];
 
-    /* Getting the data transfer direction (read/write from/to the device). */
-    int transf_dir = rq_data_dir(req);
+        spin_lock(&conn->lock);
 
-    /* Getting the starting sector (current sector). */
-    sector_t start_sector  = blk_rq_pos(req);
-    sector_t sector_offset = 0;
+        in_flight += conn->nr_inflight;
+        peak       = max(peak, conn->peak);
+        up        += !conn->dead;
 
-    /* Getting the amount of sectors left in the entire request. */
-    unsigned num_of_sectors = blk_rq_sectors(req);
+        spin_unlock(&conn->lock);
+    }
 
-    viosim_req_size = num_of_sectors / DEVICE_REQUEST_SIZE_DIV;
+    seq_printf(m, "server:         %s"   _NEW_LINE,
+                   (remote[0] != '\0') ? remote : "none");
+    seq_printf(m, "connections:    %u (%u up)" _NEW_LINE,
+                   (viosim_remote_conns != NULL) ? viosim_remote_nr : 0, up);
+    seq_printf(m, "depth:          %u"   _NEW_LINE,
+                   clamp_t(unsigned, READ_ONCE(remote_depth),
+                           1, DEVICE_REMOTE_DEPTH_MAX));
+    seq_printf(m, "requests:       %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->reqs));
+    seq_printf(m, "req_in_flight:  %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->reqs_inflight));
+    seq_printf(m, "page_reads:     %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->reads));
+    seq_printf(m, "page_writes:    %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->writes));
+    seq_printf(m, "page_errors:    %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->errors));
+    seq_printf(m, "page_in_flight: %u"   _NEW_LINE, in_flight);
+    seq_printf(m, "peak_in_flight: %u"   _NEW_LINE, peak);
+    seq_printf(m, "tag_waits:      %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->slot_waits));
+    seq_printf(m, "mean_lat_us:    %llu" _NEW_LINE,
+                   (ops > 0) ? div64_u64(atomic64_read(&st->lat_ns),
+                                         ops * NSEC_PER_USEC) : 0);
+
+    return EXIT_SUCCESS;
+}
 
-    if (viosim_req_size == 0) {
-        viosim_req_size = 1;
-    }
+DEFINE_SHOW_ATTRIBUTE(viosim_remote);
 
-    /* --- DEBUG: Printing the data transfer direction - Begin ------------- */
-#define TRANSF_DIR_READ  "read from device"
-#define TRANSF_DIR_WRITE "write to device"
-#define TRANSF_DIR_MSG   "===> Data transfer dir: %d, i.e. %s"
+/**
+ * Inner helper function.
+ * Tells the latency within which a share of the requests of an I/O
+ * priority class completed, as the bound of the histogram bucket
+ * it falls into (the max latency for the last, open-ended one).
+ *
+ * @param st  The statistics of the class.
+ * @param pct The share of the requests (%).
+ *
+ * @return The latency (us), <code>0</code> if none completed.
+ */
+static u64 viosim_prio_lat_pct(const struct viosim_prio_stats *st,
+                               const unsigned                  pct) {
 
-    if (transf_dir == 0) {
-        transf_dir_s = kzalloc(sizeof(TRANSF_DIR_READ)  + 1, GFP_KERNEL);
-        transf_dir_s = strcpy(transf_dir_s, TRANSF_DIR_READ);
-    } else {
-        transf_dir_s = kzalloc(sizeof(TRANSF_DIR_WRITE) + 1, GFP_KERNEL);
-        transf_dir_s = strcpy(transf_dir_s, TRANSF_DIR_WRITE);
+    u64 want, seen = 0;
+
+    unsigned b;
+
+    if (st->completed == 0) {
+        return 0;
     }
 
-    pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-            TRANSF_DIR_MSG _NEW_LINE, transf_dir, transf_dir_s);
+    want = div_u64(st->completed * pct + 99, 100);
 
-    kfree(transf_dir_s);
-    /* --- DEBUG: Printing the data transfer direction - End --------------- */
+    for (b = 0; b < (DEVICE_PRIO_LAT_BUCKETS - 1); b++) {
+        seen += st->lat_hist[b];
 
-    viosim_r_reqsz_wait_flag = true;
+        if (seen >= want) {
+            return 1ULL << b;
+        }
+    }
 
-    /* Waking up the process before getting the request size. */
-    wake_up_interruptible(&viosim_r_reqsz_wait_qu);
+    return div_u64(st->max_lat_ns, NSEC_PER_USEC);
+}
 
-    viosim_req_map = kzalloc(
-        sizeof(struct viosim_request_map) * viosim_req_size, GFP_KERNEL);
+/**
+ * Shows the dispatch and latency statistics of each I/O priority class
+ * through the debugfs <code>prio</code> file.
+ *
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
+ *
+ * @return The exit code indicating the status of showing the statistics.
+ */
+static int viosim_prio_show(struct seq_file *m, void *v) {
+    struct viosim_prio_stats rt, be, idle;
+
+    spin_lock_irq(&viosim_lock);
+
+    rt   = viosim_prio_stats[DEVICE_PRIO_RT];
+    be   = viosim_prio_stats[DEVICE_PRIO_BE];
+    idle = viosim_prio_stats[DEVICE_PRIO_IDLE];
+
+    spin_unlock_irq(&viosim_lock);
+
+    seq_printf(m, "dispatch:      %s"   _NEW_LINE,
+                   READ_ONCE(prio_dispatch) ? "by class" : "fifo");
+    seq_printf(m, "aging_ms:      %u"   _NEW_LINE, READ_ONCE(prio_aging_ms));
+    seq_puts(m,   "               rt              be              idle"
+                   _NEW_LINE);
+    seq_printf(m, "queued:        %-15llu %-15llu %llu" _NEW_LINE,
+                   rt.queued, be.queued, idle.queued);
+    seq_printf(m, "dispatched:    %-15llu %-15llu %llu" _NEW_LINE,
+                   rt.dispatched, be.dispatched, idle.dispatched);
+    seq_printf(m, "aged:          %-15llu %-15llu %llu" _NEW_LINE,
+                   rt.aged, be.aged, idle.aged);
+    seq_printf(m, "completed:     %-15llu %-15llu %llu" _NEW_LINE,
+                   rt.completed, be.completed, idle.completed);
+    seq_printf(m, "errors:        %-15llu %-15llu %llu" _NEW_LINE,
+                   rt.errors, be.errors, idle.errors);
+    seq_printf(m, "mean_lat_us:   %-15llu %-15llu %llu" _NEW_LINE,
+        (rt.completed   > 0) ? div64_u64(rt.lat_ns,
+                                         rt.completed   * NSEC_PER_USEC) : 0,
+        (be.completed   > 0) ? div64_u64(be.lat_ns,
+                                         be.completed   * NSEC_PER_USEC) : 0,
+        (idle.completed > 0) ? div64_u64(idle.lat_ns,
+                                         idle.completed * NSEC_PER_USEC) : 0);
+    seq_printf(m, "p50_lat_us:    %-15llu %-15llu %llu" _NEW_LINE,
+                   viosim_prio_lat_pct(&rt,   50),
+                   viosim_prio_lat_pct(&be,   50),
+                   viosim_prio_lat_pct(&idle, 50));
+    seq_printf(m, "p99_lat_us:    %-15llu %-15llu %llu" _NEW_LINE,
+                   viosim_prio_lat_pct(&rt,   99),
+                   viosim_prio_lat_pct(&be,   99),
+                   viosim_prio_lat_pct(&idle, 99));
+    seq_printf(m, "max_lat_us:    %-15llu %-15llu %llu" _NEW_LINE,
+                   div_u64(rt.max_lat_ns,   NSEC_PER_USEC),
+                   div_u64(be.max_lat_ns,   NSEC_PER_USEC),
+                   div_u64(idle.max_lat_ns, NSEC_PER_USEC));
+
+    return EXIT_SUCCESS;
+}
 
-    if (viosim_req_map == NULL) {
-        ret = -ENOMEM;
+DEFINE_SHOW_ATTRIBUTE(viosim_prio);
 
-        return ret;
+/**
+ * Starts a new sub-buffer of an I/O trace buffer, unless the reader
+ * hasn't caught up: records are then dropped rather than overwritten.
+ *
+ * @param buf         The per-CPU buffer.
+ * @param subbuf      N/A. (Unused.)
+ * @param prev_subbuf N/A. (Unused.)
+ * @param prev_pad    N/A. (Unused.)
+ *
+ * @return <code>1</code> to go on, or <code>0</code> to drop the record.
+ */
+static int viosim_trace_subbuf_start(struct rchan_buf *buf,
+                                     void             *subbuf,
+                                     void             *prev_subbuf,
+                                     size_t            prev_pad) {
+
+    if (relay_buf_full(buf)) {
+        atomic64_inc(&viosim_trace_dropped);
+
+        return 0;
     }
 
-    /*
-     * Traversing <bio> segments in the request list.
-     * - bv   -- bio_vec structure, a vector representation of <bio>s:
-     * struct bio_vec {
-     *     struct   page *bv_page;
-     *     unsigned int   bv_len;
-     *     unsigned int   bv_offset;
-     * };
-     * - req  -- Request queue (runqueue) structure.
-     * - iter -- Request queue iterator (structure).
-     * See https://www.kernel.org/doc/Documentation/block/biodoc.txt ,
-     * section 3.2.1 for details.
-     */
-    rq_for_each_segment(bv, req, iter) {
-        struct viosim_request_map *viosim_rq_map = &viosim_req_map[i++];
-        struct viosim_page_map    *viosim_pg_map = &viosim_rq_map->page_map;
+    return 1;
+}
 
-        /* The logical block address (LBA). */
-        u64 lba = start_sector + sector_offset;
+/** Creates the debugfs relay file of a per-CPU I/O trace buffer. */
+static struct dentry *viosim_trace_create_file(const char       *filename,
+                                                struct dentry    *parent,
+                                                umode_t           mode,
+                                                struct rchan_buf *buf,
+                                                int              *global) {
+
+    struct dentry *dentry = debugfs_create_file(filename, mode, parent, buf,
+                                                &relay_file_operations);
 
-        /* The logical page number (LPN). */
-        viosim_pg_map->lpn = lba / DEVICE_NUMBER_OF_SECTORS_PER_PAGE;
+    return IS_ERR(dentry) ? NULL : dentry;
+}
 
-        viosim_pg_map->transf_dir = transf_dir; /* Read or write. */
+/** Removes the debugfs relay file of a per-CPU I/O trace buffer. */
+static int viosim_trace_remove_file(struct dentry *dentry) {
+    debugfs_remove(dentry);
 
-        viosim_rq_map->start_sector   = lba;
-        viosim_rq_map->num_of_sectors = bv.bv_len / DEVICE_SECTOR_SIZE;
-        viosim_rq_map->req_buffer     = page_address(bv.bv_page) + bv.bv_offset;
+    return EXIT_SUCCESS;
+}
 
-        if (viosim_rq_map->num_of_sectors > DEVICE_REQUEST_SIZE_DIV) {
-            ret = -EIO;
+/** The relay channel callbacks of the I/O trace buffers. */
+static struct rchan_callbacks viosim_trace_cbs = {
+    .subbuf_start    = viosim_trace_subbuf_start,
+    .create_buf_file = viosim_trace_create_file,
+    .remove_buf_file = viosim_trace_remove_file,
+};
 
-            return ret;
-        }
+/**
+ * Sets up the per-CPU I/O trace buffers (when <code>trace_kb</code>
+ * is set; their failure is not fatal).
+ */
+static void viosim_trace_init(void) {
+    size_t subbuf_size;
 
-        sector_offset += viosim_rq_map->num_of_sectors;
+    if ((trace_kb == 0) || IS_ERR_OR_NULL(viosim_dbgfs_dir)) {
+        return;
     }
 
-    viosim_r_block_wait_flag = true;
+    /* Whole records per sub-buffer, so that none is split. */
+    subbuf_size  = ((size_t) trace_kb * 1024) / DEVICE_TRACE_SUBBUFS;
+    subbuf_size -= subbuf_size % sizeof(struct viosim_trace_rec);
 
-    /* Waking up the process before reading. */
-    wake_up_interruptible(&viosim_r_block_wait_qu);
+    if (subbuf_size > 0) {
+        viosim_trace_chan = relay_open(DEVICE_DEBUGFS_TRACE_CPU_FILE_NAME,
+                                       viosim_dbgfs_dir, subbuf_size,
+                                       DEVICE_TRACE_SUBBUFS,
+                                       &viosim_trace_cbs, NULL);
+    }
 
-    /* Putting the process to sleep before writing. */
-    if (wait_event_interruptible(
-        viosim_w_block_wait_qu, viosim_w_block_wait_flag)) {
+    if (viosim_trace_chan == NULL) {
+        pr_warn(_MODULE_NAME _COLON_SPACE_SEP \
+                _TRACE_FAILED_ERR _NEW_LINE, trace_kb);
+    }
+}
 
-        /* When interrupted by a signal -- return with error. */
-        ret = -ERESTARTSYS;
+/**
+ * Shows the zero-page and deduplication statistics
+ * through the debugfs <code>dedup</code> file.
+ *
+ * @param m The <code>seq_file</code> structure to print into.
+ * @param v N/A. (Unused.)
+ *
+ * @return The exit code indicating the status of showing the statistics.
+ */
+static int viosim_dedup_show(struct seq_file *m, void *v) {
+    struct viosim_dedup_stats *st = &viosim_dedup_stats;
 
-        return ret;
+    /* Dedup hit rate, in hundredths of a percent. */
+    u64 rate = 0;
+
+    if ((st->hits + st->misses) > 0) {
+        rate = div64_u64(st->hits * 10000, st->hits + st->misses);
     }
 
-    viosim_w_block_wait_flag = false;
+    seq_printf(m, "zero_writes:  %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->zero_writes));
+    seq_printf(m, "zero_pages:   %lld" _NEW_LINE,
+                   (long long) atomic64_read(&st->zero_pages));
+    seq_printf(m, "dedup_hits:   %llu" _NEW_LINE, st->hits);
+    seq_printf(m, "dedup_misses: %llu" _NEW_LINE, st->misses);
+    seq_printf(m, "hit_rate:     %llu.%02llu%%" _NEW_LINE,
+                                  rate / 100, rate % 100);
+    seq_printf(m, "shared_pages: %llu" _NEW_LINE, st->shared_pages);
+    seq_printf(m, "shared_refs:  %llu" _NEW_LINE, st->shared_refs);
+
+    return EXIT_SUCCESS;
+}
+
+DEFINE_SHOW_ATTRIBUTE(viosim_dedup);
 
-    /* Actually performing read/write ops using the appropriate helpers. */
-    for (i = 0; i < viosim_req_size; i++) {
-        struct viosim_request_map *viosim_rq_map = &viosim_req_map[i];
-        struct viosim_page_map    *viosim_pg_map = &viosim_rq_map->page_map;
+/** The structure to hold and register device operations data and callbacks. */
+static struct block_device_operations viosim_ops = {
+    .open    = viosim_open_proc,    /* <== Doing something when           */
+                                    /*     engaging the device.           */
+    .release = viosim_release_proc, /* <== Doing something when           */
+                                    /*     releasing the device.          */
+    .ioctl   = viosim_ioctl_proc,   /* <== Making the ioctl() system call */
+                                    /*     to control device I/O ops.     */
+    .owner   = THIS_MODULE,
+};
 
-        viosim_pg_map->ppnx = viosim_pg_map->lpn;
-        viosim_pg_map->ppn  = viosim_pg_map->ppnx;
+/**
+ * Helper function.
+ * Times cached and non-temporal copies of each size (one sector up to
+ * one page) streaming into a buffer larger than the caches,
+ * the way request data goes to the backing store.
+ *
+ * @return The smallest size at which non-temporal copies are not slower,
+ *         or <code>0</code> when they are always slower (or no memory).
+ */
+static unsigned viosim_copy_calibrate(void) {
+    struct viosim_copy_stats *st = &viosim_copy_stats;
 
-        if (transf_dir == 0) {
-            ret = viosim_dev_read(viosim_rq_map);
-        } else {
-            ret = viosim_dev_write(viosim_rq_map);
-        }
+    unsigned crossover = 0;
+    unsigned i;
+
+    size_t len, off;
+
+    u64 start;
+
+    u8 *src = kzalloc(DEVICE_PAGE_SIZE, GFP_KERNEL);
+    u8 *dst = vmalloc(DEVICE_COPY_CALIB_SIZE);
+
+    if ((src == NULL) || (dst == NULL)) {
+        vfree(dst);
+        kfree(src);
+
+        return crossover;
     }
 
-    kfree(viosim_req_map);
+    /* Touching the buffer in so that neither pass pays for it. */
+    memset(dst, 0, DEVICE_COPY_CALIB_SIZE);
 
-    if (sector_offset != num_of_sectors) {
-        ret = -EXIT_FAILURE;
+    for (i = 0; i < DEVICE_COPY_CALIB_STEPS; i++) {
+        len = DEVICE_SECTOR_SIZE << i;
 
-        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
-                 _BIO_DOES_NOT_MATCH_REQUEST_ERR _NEW_LINE);
+        start = ktime_get_ns();
+
+        for (off = 0; off < DEVICE_COPY_CALIB_SIZE; off += len) {
+            memcpy(dst + off, src, len);
+        }
+
+        st->calib_memcpy_ns[i] = div_u64(ktime_get_ns() - start,
+                                         DEVICE_COPY_CALIB_SIZE / len);
+
+        start = ktime_get_ns();
+
+        for (off = 0; off < DEVICE_COPY_CALIB_SIZE; off += len) {
+            memcpy_flushcache(dst + off, src, len);
+        }
+
+        wmb();
+
+        st->calib_nt_ns[i]     = div_u64(ktime_get_ns() - start,
+                                         DEVICE_COPY_CALIB_SIZE / len);
+
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP _COPY_CALIB_MSG _NEW_LINE,
+                (unsigned) len, st->calib_memcpy_ns[i], st->calib_nt_ns[i]);
+
+        if ((crossover == 0) && (st->calib_nt_ns[i] <= st->calib_memcpy_ns[i])) {
+            crossover = len;
+        }
     }
 
-    return ret;
+    vfree(dst);
+    kfree(src);
+
+    return crossover;
 }
 
 /**
- * Executes a task prepared and waited to be run out of a workqueue.
+ * Sets up the copy mode given by the module parameters
+ * (calibrating copies first when it is <code>auto</code>
+ * or when self-tests are to run).
  *
- * @param task The <code>work_struct</code> device structure
- *             which contains the working task.
+ * @return The exit code indicating the status of setting up the copy mode.
  */
-static void viosim_req_exec(const struct work_struct *task) {
-    struct request *req;
+static int viosim_copy_init(void) {
+    unsigned crossover = 0;
 
-    int ret = EXIT_SUCCESS;
+    if (selftest || (strcmp(copy_mode, DEVICE_COPY_MODE_AUTO) == 0)) {
+        crossover = viosim_copy_calibrate();
+    }
 
-    /* Fetching the request from the request queue and handling it. */
-    while ((req = blk_fetch_request(viosim_req_qu)) != NULL) {
-        if (viosim_usr_app != NULL) {
-            /* Handling the request: its main processing is going there. */
-            ret = viosim_req_transfer(req);
-        }
+    if (strcmp(copy_mode, DEVICE_COPY_MODE_MEMCPY) == 0) {
+        viosim_copy_nt_min = 0;
+    } else if (strcmp(copy_mode, DEVICE_COPY_MODE_NT) == 0) {
+        viosim_copy_nt_min = max_t(unsigned, copy_nt_threshold, 1);
+    } else if (strcmp(copy_mode, DEVICE_COPY_MODE_AUTO) == 0) {
+        viosim_copy_nt_min = crossover;
+    } else {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _COPY_MODE_INVALID_ERR _NEW_LINE, copy_mode);
 
-        /* Completely finishing the request. */
-        __blk_end_request_all(req, ret);
+        return -EINVAL;
     }
+
+    pr_info(_MODULE_NAME _COLON_SPACE_SEP _COPY_MODE_MSG _NEW_LINE,
+            copy_mode, viosim_copy_nt_min);
+
+    return EXIT_SUCCESS;
 }
 
 /**
- * Implements engaging the device operation.
- *
- * @param blkdev The <code>block_device</code> structure describing the device.
- * @param mode   N/A. (TODO: Provide description.)
+ * Allocates the mapping export (nothing mapped, as known)
+ * and registers the misc device it is mapped through.
  *
- * @return The exit code indicating engaging the device operation
- *         execution status.
+ * @return The exit code indicating the status of setting up the export.
  */
-static int viosim_open_proc(struct block_device *blkdev, const fmode_t mode) {
-    int ret = EXIT_SUCCESS;
-
-    /* --- DEBUG: Printing the device private data - Begin ----------------- */
-#define OPEN_PROC_DBG_00 "===> 00: blkdev != NULL"
-#define OPEN_PROC_DBG_01 "===> 01: blkdev->bd_disk != NULL"
-#define OPEN_PROC_DBG_02 "===> 02: viosim_private_data == NULL"
-#define OPEN_PROC_DBG_03 "===> 03: viosim_private_data != NULL"
-#define OPEN_PROC_DBG_99 "Device engage: private_data: %s"
+static int viosim_map_init(void) {
+    int ret;
 
-    char *viosim_private_data = NULL;
+    size_t l2p_size   = PAGE_ALIGN(viosim_nr_pages * sizeof(u64));
+    size_t valid_size = PAGE_ALIGN(BITS_TO_LONGS(viosim_nr_pages)
+                                 * sizeof(unsigned long));
 
-    if (blkdev != NULL) {
-/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP OPEN_PROC_DBG_00 _NEW_LINE);*/
+    viosim_map     = vmalloc_user(PAGE_SIZE + l2p_size + valid_size);
+    viosim_map_p2l = kvmalloc_array(viosim_nr_pages, sizeof(u64), GFP_KERNEL);
 
-        if (blkdev->bd_disk != NULL) {
-/*            pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                    OPEN_PROC_DBG_01 _NEW_LINE);*/
+    if ((viosim_map == NULL) || (viosim_map_p2l == NULL)) {
+        vfree(viosim_map);
+        kvfree(viosim_map_p2l);
 
-            viosim_private_data = kzalloc(
-                sizeof(blkdev->bd_disk->private_data) + 1, GFP_KERNEL);
+        viosim_map     = NULL;
+        viosim_map_p2l = NULL;
 
-            viosim_private_data = strcpy(viosim_private_data,
-                                         blkdev->bd_disk->private_data);
-        }
+        return -ENOMEM;
     }
 
-    if (viosim_private_data == NULL) {
-/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP OPEN_PROC_DBG_02 _NEW_LINE);*/
+    viosim_map_hdr   = viosim_map;
+    viosim_map_l2p   = viosim_map + PAGE_SIZE;
+    viosim_map_valid = viosim_map + PAGE_SIZE + l2p_size;
 
-        ret = EXIT_FAILURE;
+    viosim_map_hdr->magic        = DEVICE_MAP_MAGIC;
+    viosim_map_hdr->nr_pages     = viosim_nr_pages;
+    viosim_map_hdr->l2p_offset   = PAGE_SIZE;
+    viosim_map_hdr->valid_offset = PAGE_SIZE + l2p_size;
+    viosim_map_hdr->size         = PAGE_SIZE + l2p_size + valid_size;
 
-        viosim_private_data = kzalloc(3 + 1, GFP_KERNEL);
+    viosim_map_reset();
 
-        viosim_private_data = strcpy(viosim_private_data, "N/A");
-    }
+    ret = misc_register(&viosim_map_misc);
 
-    if (viosim_private_data != NULL) {
-/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP OPEN_PROC_DBG_03 _NEW_LINE);*/
+    if (ret != EXIT_SUCCESS) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _MAP_EXPORT_FAILED_ERR _NEW_LINE, ret);
 
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                OPEN_PROC_DBG_99 _NEW_LINE, viosim_private_data);
+        vfree(viosim_map);
+        kvfree(viosim_map_p2l);
 
-        kfree(viosim_private_data);
+        viosim_map     = NULL;
+        viosim_map_p2l = NULL;
     }
-    /* --- DEBUG: Printing the device private data - End ------------------- */
 
     return ret;
 }
 
 /**
- * Implements releasing the device operation.
+ * Sets up what happens to requests the user space FTL doesn't answer
+ * in time, as given by the module parameters, along with the L2P cache
+ * and the mapping export.
  *
- * @param viosim_disc The <code>gendisk</code> structure describing the device.
- * @param mode        N/A. (TODO: Provide description.)
+ * @return The exit code indicating the status of setting up the fallback.
  */
-static void viosim_release_proc(      struct gendisk *viosim_disc,
-                                const        fmode_t  mode) {
-
-    /* --- DEBUG: Printing the device private data - Begin ----------------- */
-#define RLZZ_PROC_DBG_04 "===> 04: viosim_disc != NULL"
-#define RLZZ_PROC_DBG_05 "===> 05: viosim_private_data == NULL"
-#define RLZZ_PROC_DBG_06 "===> 06: viosim_private_data != NULL"
-#define RLZZ_PROC_DBG_99 "Device release: private_data: %s"
+static int viosim_ftl_init(void) {
+    int ret;
+
+    u64 lpn;
+
+    if (strcmp(ftl_fallback, DEVICE_FTL_FALLBACK_FAIL) == 0) {
+        viosim_ftl_fail = true;
+    } else if (strcmp(ftl_fallback, DEVICE_FTL_FALLBACK_LAST) == 0) {
+        viosim_ftl_last     = kvmalloc_array(viosim_nr_pages,
+                                             sizeof(*viosim_ftl_last),
+                                             GFP_KERNEL);
+        viosim_ftl_last_p2l = kvmalloc_array(viosim_nr_pages,
+                                             sizeof(*viosim_ftl_last_p2l),
+                                             GFP_KERNEL);
+
+        if ((viosim_ftl_last == NULL) || (viosim_ftl_last_p2l == NULL)) {
+            return -ENOMEM;
+        }
 
-    char *viosim_private_data = NULL;
+        /* Until the FTL says otherwise, pages are where they are. */
+        for (lpn = 0; lpn < viosim_nr_pages; lpn++) {
+            viosim_ftl_last[lpn]     = lpn;
+            viosim_ftl_last_p2l[lpn] = lpn;
+        }
+    } else if (strcmp(ftl_fallback, DEVICE_FTL_FALLBACK_IDENTITY) != 0) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _FTL_FALLBACK_INVALID_ERR _NEW_LINE, ftl_fallback);
 
-    if (viosim_disc != NULL) {
-/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP RLZZ_PROC_DBG_04 _NEW_LINE);*/
+        return -EINVAL;
+    }
 
-        viosim_private_data = kzalloc(
-            sizeof(viosim_disc->private_data) + 1, GFP_KERNEL);
+    if (map_export) {
+        ret = viosim_map_init();
 
-        viosim_private_data = strcpy(viosim_private_data,
-                                     viosim_disc->private_data);
+        if (ret != EXIT_SUCCESS) {
+            return ret;
+        }
     }
 
-    if (viosim_private_data == NULL) {
-/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP RLZZ_PROC_DBG_05 _NEW_LINE);*/
-
-        viosim_private_data = kzalloc(3 + 1, GFP_KERNEL);
+    /* Writes are stamped only for the mappings kept here to check. */
+    if (l2p_cache || map_export || (viosim_ftl_last != NULL)) {
+        viosim_wr_stamp = kvmalloc_array(viosim_nr_pages,
+                                         sizeof(*viosim_wr_stamp),
+                                         GFP_KERNEL | __GFP_ZERO);
 
-        viosim_private_data = strcpy(viosim_private_data, "N/A");
+        if (viosim_wr_stamp == NULL) {
+            return -ENOMEM;
+        }
     }
 
-    if (viosim_private_data != NULL) {
-/*        pr_info(_MODULE_NAME _COLON_SPACE_SEP RLZZ_PROC_DBG_06 _NEW_LINE);*/
+    if (!l2p_cache) {
+        return EXIT_SUCCESS;
+    }
 
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                RLZZ_PROC_DBG_99 _NEW_LINE, viosim_private_data);
+    /* PPNs are kept in 32 bits, with the top value meaning "not cached". */
+    if (viosim_nr_pages >= DEVICE_L2P_NONE) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
+                 _L2P_CACHE_TOO_LARGE_ERR _NEW_LINE, viosim_nr_pages);
 
-        kfree(viosim_private_data);
+        return -EINVAL;
     }
-    /* --- DEBUG: Printing the device private data - End ------------------- */
 
-    if (viosim_usr_app != current) {
-        return;
+    viosim_l2p = kvmalloc_array(viosim_nr_pages, sizeof(*viosim_l2p),
+                                GFP_KERNEL);
+
+    if (viosim_l2p == NULL) {
+        return -ENOMEM;
     }
 
-    /*
-     * Nullifying the user space calling process task pointer ->
-     * releasing the device.
-     */
-    viosim_usr_app = NULL;
+    viosim_l2p_invalidate(0, 0);
+
+    return EXIT_SUCCESS;
 }
 
+/* --- Copy path self-tests - Begin ---------------------------------------- */
+
 /**
- * Implements the ioctl() system call to control device I/O ops.
+ * The self-test cases: a write of <code>num_of_sectors</code> sectors
+ * starting at <code>lba</code> (relative to the first device page),
+ * then a read of the same sectors back.
+ */
+static const struct {
+    const char *name;
+    u64         lba;
+    unsigned    num_of_sectors;
+    unsigned    seg_sectors; /* <== Segment size (0 -- a single segment). */
+} viosim_selftest_cases[] = {
+    { "full page",               0, 8,  0 },
+    { "aligned partial page",    8, 1,  0 },
+    { "unaligned partial page", 11, 2,  0 },
+    { "partial page tail",      13, 3,  0 },
+    { "page-crossing",          20, 8,  0 },
+    { "multiple page-crossing",  6, 17, 0 },
+    { "coalesced segments",      1, 6,  1 },
+    { "coalesced page-crossing", 5, 14, 3 },
+};
+
+/**
+ * Helper function.
+ * Writes data to the device through the request map a request
+ * of <code>seg_sectors</code>-sized segments would get, then reads it back
+ * through the same map.
  *
- * @param blkdev The <code>block_device</code> structure describing the device.
- * @param mode   N/A. (TODO: Provide description.)
- * @param cmd    The ioctl() command ID to execute.
- * @param arg    The ioctl() argument to pass to a command set. (Optional.)
+ * @param lba            The starting sector.
+ * @param buffer         The data to write.
+ * @param out            Where to read the data back to.
+ * @param num_of_sectors The number of sectors.
+ * @param seg_sectors    The segment size (<code>0</code> &ndash; a single
+ *                       segment).
+ * @param page           The page buffer to use.
  *
- * @return The exit code indicating the ioctl() operation execution status.
+ * @return The exit code indicating the status of the copies.
  */
-static int viosim_ioctl_proc(      struct block_device  *blkdev,
-                             const        fmode_t        mode,
-                             const        unsigned       cmd,
-                             const        unsigned long  arg) {
+static int viosim_selftest_rw(const u64       lba,
+                                    u8       *buffer,
+                                    u8       *out,
+                              const unsigned  num_of_sectors,
+                              const unsigned  seg_sectors,
+                                    u8       *page) {
 
     int ret = EXIT_SUCCESS;
 
-    unsigned long dead_bytes = 0UL;
+    struct viosim_request_map req_map[DEVICE_SELFTEST_PAGES + 1];
+    struct viosim_request_seg req_segs[DEVICE_SELFTEST_PAGES
+                                     * DEVICE_NUMBER_OF_SECTORS_PER_PAGE];
 
-    /* --- DEBUG: Printing the ioctl() call ID - Begin --------------------- */
-#define IOCTL_PROC_CMD_AND_ARG_DBG \
-        "===> ioctl() call ID: %#010x " \
-        "(dir: %#x | size: %#05x | chr: %#04x '%c' | func: %#04x) " \
-        "===> arg: %lu"
+    unsigned step = (seg_sectors > 0) ? seg_sectors : num_of_sectors;
+    unsigned req_size = 0;
+    unsigned nr_segs  = 0;
+    unsigned count, i;
 
-    pr_info(_MODULE_NAME _COLON_SPACE_SEP IOCTL_PROC_CMD_AND_ARG_DBG _NEW_LINE,
-                      cmd,
-             _IOC_DIR(cmd),
-            _IOC_SIZE(cmd),
-            _IOC_TYPE(cmd), _IOC_TYPE(cmd),
-              _IOC_NR(cmd),
-                      arg);
+    for (i = 0; i < num_of_sectors; i += count) {
+        count = min_t(unsigned, step, num_of_sectors - i);
 
-#define IOCTL_PROC_CMD_SYM_0_DBG "===> REG_USER_CALLER"
-#define IOCTL_PROC_CMD_SYM_1_DBG "===> GET_REQUEST_SIZE"
-#define IOCTL_PROC_CMD_SYM_2_DBG "===> GET_BLOCK"
-#define IOCTL_PROC_CMD_SYM_3_DBG "===> SET_BLOCK"
-    /* --- DEBUG: Printing the ioctl() call ID - End ----------------------- */
+        viosim_req_map_fill(req_map, &req_size, req_segs, &nr_segs, lba + i,
+                            buffer + (i * DEVICE_SECTOR_SIZE),
+                            count * DEVICE_SECTOR_SIZE, 1);
+    }
 
-    switch(cmd) {
-    case DEVICE_IOCTL_REG_USER_CALLER:
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                IOCTL_PROC_CMD_SYM_0_DBG _NEW_LINE);
+    ret = viosim_req_map_exec(req_map, req_size, req_segs, nr_segs, 1, page);
 
-        /*
-         * <current> points to the task structure of the calling process
-         *           in user space.
-         */
-        viosim_usr_app = current;
+    if (ret != EXIT_SUCCESS) {
+        return ret;
+    }
 
-        break;
+    /* Reading back through the same map, only into the other buffer. */
+    for (i = 0; i < nr_segs; i++) {
+        req_segs[i].buffer = out + (req_segs[i].buffer - buffer);
+    }
 
-    case DEVICE_IOCTL_GET_REQUEST_SIZE:
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                IOCTL_PROC_CMD_SYM_1_DBG _NEW_LINE);
+    ret = viosim_req_map_exec(req_map, req_size, req_segs, nr_segs, 0, page);
 
-        /* Putting the process to sleep before reading. */
-        if (wait_event_interruptible(
-            viosim_r_reqsz_wait_qu, viosim_r_reqsz_wait_flag)) {
+    return ret;
+}
 
-            /* When interrupted by a signal -- return with error. */
-            ret = -ERESTARTSYS;
+/**
+ * Runs the copy path self-tests against a reference model (a flat copy
+ * of the pages written), then times each copy path. The pages tested
+ * are zeroed back afterwards.
+ *
+ * @return The exit code indicating the self-tests status.
+ */
+static int viosim_selftest_run(void) {
+    int ret = EXIT_SUCCESS;
 
-            return ret;
-        }
+    unsigned size = DEVICE_SELFTEST_PAGES * DEVICE_PAGE_SIZE;
+    unsigned nr_cases = ARRAY_SIZE(viosim_selftest_cases);
+    unsigned failed = 0;
+    unsigned i, j;
 
-        /* Returning the request size to user space. */
-        ret = put_user(viosim_req_size, (unsigned long __user *) arg);
+    struct viosim_request_map req_map;
+    struct viosim_request_seg req_seg;
 
-        if (ret != 0) {
-            return ret; /* <== -EFAULT */
-        }
+    unsigned req_size, nr_segs;
 
-        /*
-         * Setting the get-(read)-request-size-wait-flag back to FALSE
-         * to allow the next process to read from the device.
-         */
-/*        viosim_r_reqsz_wait_flag = false;*/
+    u8 *model, *buffer, *out, *page;
 
-        break;
+    u64 start;
 
-    case DEVICE_IOCTL_GET_BLOCK:
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                IOCTL_PROC_CMD_SYM_2_DBG _NEW_LINE);
+    if (viosim_nr_pages < DEVICE_SELFTEST_PAGES) {
+        return -EINVAL;
+    }
 
-        /* Putting the process to sleep before reading. */
-        if (wait_event_interruptible(
-            viosim_r_block_wait_qu, viosim_r_block_wait_flag)) {
+    model  = kzalloc(size, GFP_KERNEL);
+    buffer = kzalloc(size, GFP_KERNEL);
+    out    = kzalloc(size, GFP_KERNEL);
+    page   = kzalloc(DEVICE_PAGE_SIZE, GFP_KERNEL);
 
-            /* When interrupted by a signal -- return with error. */
-            ret = -ERESTARTSYS;
+    if ((model == NULL) || (buffer == NULL) || (out == NULL)
+                                           || (page == NULL)) {
+        ret = -ENOMEM;
 
-            return ret;
-        }
+        goto out_free;
+    }
 
-        /* Returning block of data to user space. */
-        dead_bytes = copy_to_user(
-          (struct viosim_request_map __user *) arg, /* <== Dest address.     */
-          viosim_req_map,                           /* <== Source address.   */
-          (sizeof(*viosim_req_map) *                /* <== How much to copy? */
-                   viosim_req_size));
+    /* Starting off all-zero pages, as the model does. */
+    for (j = 0; j < DEVICE_SELFTEST_PAGES; j++) {
+        viosim_dev_write_page(j, page);
+    }
 
-        if (dead_bytes > 0UL) {
-            pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
-                     _COPY_TO_USER_DEAD_BYTES_EXIST_ERR _NEW_LINE,
-                     dead_bytes);
-        }
+    /* --- Correctness against the model - Begin -------------------------- */
+    for (i = 0; i < nr_cases; i++) {
+        u64      lba = viosim_selftest_cases[i].lba;
+        unsigned len = viosim_selftest_cases[i].num_of_sectors
+                     * DEVICE_SECTOR_SIZE;
 
-        /*
-         * Setting the read wait flag back to FALSE to allow the next process
-         * to read from the device.
-         */
-/*        viosim_r_block_wait_flag = false;*/
+        bool ok;
 
-        break;
+        for (j = 0; j < len; j++) {
+            buffer[j] = (u8) ((i + 1) * 37 + j * 11);
+        }
 
-    case DEVICE_IOCTL_SET_BLOCK:
-        pr_info(_MODULE_NAME _COLON_SPACE_SEP \
-                IOCTL_PROC_CMD_SYM_3_DBG _NEW_LINE);
+        memcpy(model + (lba * DEVICE_SECTOR_SIZE), buffer, len);
 
-        /* Passing block of data to kernel space. */
-        dead_bytes = copy_from_user(
-          viosim_req_map,                           /* <== Dest address.     */
-          (struct viosim_request_map __user *) arg, /* <== Source address.   */
-          (sizeof(*viosim_req_map) *                /* <== How much to copy? */
-                   viosim_req_size));
+        memset(out, 0, len);
 
-        if (dead_bytes > 0UL) {
-            pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
-                     _COPY_FROM_USER_DEAD_BYTES_EXIST_ERR _NEW_LINE,
-                     dead_bytes);
+        ok = (viosim_selftest_rw(lba, buffer, out, len / DEVICE_SECTOR_SIZE,
+                                 viosim_selftest_cases[i].seg_sectors,
+                                 page) == EXIT_SUCCESS)
+          && (memcmp(out, buffer, len) == 0);
+
+        /* The read-modify-write mustn't have touched the rest of pages. */
+        for (j = 0; ok && (j < DEVICE_SELFTEST_PAGES); j++) {
+            ok = (viosim_dev_read_page(j, page) == EXIT_SUCCESS)
+              && (memcmp(page, model + (j * DEVICE_PAGE_SIZE),
+                         DEVICE_PAGE_SIZE) == 0);
         }
 
-        /*
-         * Setting the write wait flag back to TRUE to put the next write
-         * process to sleep.
-         */
-        viosim_w_block_wait_flag = true;
+        if (!ok) {
+            failed++;
+        }
 
-        /* Waking up the process before writing. */
-        wake_up_interruptible(&viosim_w_block_wait_qu);
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP _SELFTEST_CASE_MSG _NEW_LINE,
+                ok ? "ok" : "not ok", i + 1, viosim_selftest_cases[i].name);
+    }
+    /* --- Correctness against the model - End ---------------------------- */
+
+    /* --- Microbenchmarks - Begin ---------------------------------------- */
+#define SELFTEST_BENCH(name, op)                                            \
+    do {                                                                    \
+        start = ktime_get_ns();                                             \
+                                                                            \
+        for (j = 0; j < DEVICE_SELFTEST_BENCH_LOOPS; j++) {                 \
+            op;                                                             \
+        }                                                                   \
+                                                                            \
+        pr_info(_MODULE_NAME _COLON_SPACE_SEP _SELFTEST_BENCH_MSG _NEW_LINE,\
+                name, div_u64(ktime_get_ns() - start,                       \
+                              DEVICE_SELFTEST_BENCH_LOOPS));                \
+    } while (0)
+
+    SELFTEST_BENCH("read_page",
+        viosim_dev_read_page(j % DEVICE_SELFTEST_PAGES, page));
+
+    SELFTEST_BENCH("write_page",
+        viosim_dev_write_page(j % DEVICE_SELFTEST_PAGES, page));
+
+    req_size = 0;
+    nr_segs  = 0;
+
+    viosim_req_map_fill(&req_map, &req_size, &req_seg, &nr_segs, 0, buffer,
+                        DEVICE_PAGE_SIZE, 0);
+
+    SELFTEST_BENCH("read (full page)",
+        viosim_dev_read( &req_map, &req_seg, 1, page));
+    SELFTEST_BENCH("write (full page)",
+        viosim_dev_write(&req_map, &req_seg, 1, page));
+
+    req_size = 0;
+    nr_segs  = 0;
+
+    viosim_req_map_fill(&req_map, &req_size, &req_seg, &nr_segs, 3, buffer,
+                        DEVICE_SECTOR_SIZE, 0);
+
+    SELFTEST_BENCH("read (one sector)",
+        viosim_dev_read( &req_map, &req_seg, 1, page));
+    SELFTEST_BENCH("write (one sector)",
+        viosim_dev_write(&req_map, &req_seg, 1, page));
+
+#undef SELFTEST_BENCH
+    /* --- Microbenchmarks - End ------------------------------------------ */
+
+    /* Zeroing the pages tested back. */
+    memset(page, 0, DEVICE_PAGE_SIZE);
+
+    for (j = 0; j < DEVICE_SELFTEST_PAGES; j++) {
+        viosim_dev_write_page(j, page);
+    }
 
-        break;
+    if (failed > 0) {
+        pr_alert(_MODULE_NAME _COLON_SPACE_SEP _SELFTEST_FAILED_ERR _NEW_LINE,
+                 failed, nr_cases);
 
-    default:
-        ret = -ENOTTY;
+        ret = -EINVAL;
     }
 
+out_free:
+    kfree(page);
+    kfree(out);
+    kfree(buffer);
+    kfree(model);
+
     return ret;
 }
 
-/** The structure to hold and register device operations data and callbacks. */
-static struct block_device_operations viosim_ops = {
-    .open    = viosim_open_proc,    /* <== Doing something when           */
-                                    /*     engaging the device.           */
-    .release = viosim_release_proc, /* <== Doing something when           */
-                                    /*     releasing the device.          */
-    .ioctl   = viosim_ioctl_proc,   /* <== Making the ioctl() system call */
-                                    /*     to control device I/O ops.     */
-    .owner   = THIS_MODULE,
-};
+/* --- Copy path self-tests - End ------------------------------------------ */
 
 /**
  * Initializes a block device driver module.
@@ -691,6 +6391,8 @@ static struct block_device_operations viosim_ops = {
 static int __init virtblkiosim_init(void) {
     int ret = EXIT_SUCCESS;
 
+    unsigned i;
+
     pr_info(_MODULE_NAME        _COLON_SPACE_SEP                            \
             _MODULE_DESCRIPTION _COMMA_SPACE_SEP                            \
             _MODULE_VERSION_S__ _ONE_SPACE_STRING _MODULE_VERSION _NEW_LINE \
@@ -718,10 +6420,53 @@ static int __init virtblkiosim_init(void) {
     pr_info(_MODULE_NAME _COLON_SPACE_SEP \
             _REGISTER_DEVICE_SUCCEED_MSG _NEW_LINE, major_num);
 
-    /* (2)                                       */
+    /* Initializing the backing store page locks. */
+    for (i = 0; i < DEVICE_PAGE_LOCKS; i++) {
+        init_rwsem(&viosim_page_locks[i]);
+    }
+
+    /* (2)                                                          */
+    /* Allocating the backing store according to NUMA placement     */
+    /* module parameters.                                           */
+    ret = viosim_store_alloc();
+
+    if (ret != EXIT_SUCCESS) {
+        /* Deregistering the block device. */
+        unregister_blkdev(major_num, DEVICE_NAME);
+
+        return ret;
+    }
+
+    /* Setting up the copy mode and running the copy path self-tests. */
+    ret = viosim_copy_init();
+
+    if (ret == EXIT_SUCCESS) {
+        ret = viosim_ftl_init();
+    }
+
+    if ((ret == EXIT_SUCCESS) && selftest) {
+        ret = viosim_selftest_run();
+    }
+
+    if (ret != EXIT_SUCCESS) {
+        /* Freeing the backing store. */
+        viosim_store_free();
+
+        /* Deregistering the block device. */
+        unregister_blkdev(major_num, DEVICE_NAME);
+
+        return ret;
+    }
+
     /* Initializing the request queue spin lock. */
     spin_lock_init(&viosim_lock);
 
+    /* Initializing the dispatch lists guarded by it. */
+    for (i = 0; i < DEVICE_PRIO_CLASSES; i++) {
+        INIT_LIST_HEAD(&viosim_rd_reqs[i]);
+        INIT_LIST_HEAD(&viosim_wr_reqs[i]);
+    }
+
     /* (3)                                    */
     /* Initializing the request queue itself. */
     viosim_req_qu = blk_init_queue((request_fn_proc *) viosim_req_proc,
@@ -733,6 +6478,12 @@ static int __init virtblkiosim_init(void) {
         pr_alert(_MODULE_NAME _COLON_SPACE_SEP \
                  _ALLOCATE_REQ_QU_FAILED_ERR _NEW_LINE);
 
+        /* Freeing the backing store. */
+        viosim_store_free();
+
+        /* Deregistering the block device. */
+        unregister_blkdev(major_num, DEVICE_NAME);
+
         return ret;
     }
 
@@ -754,6 +6505,9 @@ static int __init virtblkiosim_init(void) {
         /* Destroying the request queue. */
         blk_cleanup_queue(viosim_req_qu);
 
+        /* Freeing the backing store. */
+        viosim_store_free();
+
         /* Deregistering the block device. */
         unregister_blkdev(major_num, DEVICE_NAME);
 
@@ -772,7 +6526,7 @@ static int __init virtblkiosim_init(void) {
     viosim_disk->private_data = DEVICE_NAME; /* <== Does it need for debug */
                                              /*     purposes only?         */
 
-    set_capacity(viosim_disk, DEVICE_NUMBER_OF_PAGES * \
+    set_capacity(viosim_disk, viosim_nr_pages * \
                               DEVICE_NUMBER_OF_SECTORS_PER_PAGE);
     /* --- Filling the "gendisk" device structure - End -------------------- */
 
@@ -781,11 +6535,51 @@ static int __init virtblkiosim_init(void) {
     init_waitqueue_head(&viosim_r_reqsz_wait_qu);
     init_waitqueue_head(&viosim_r_block_wait_qu);
     init_waitqueue_head(&viosim_w_block_wait_qu);
+    init_waitqueue_head(&viosim_ftl_batch_wait_qu);
 
     /* (9)                                                                  */
     /* Setting up the "work_struct" device structure which represents tasks */
     /* to be run out of a workqueue.                                        */
-    INIT_WORK(&viosim_req_task, (void *) viosim_req_exec);
+    INIT_DELAYED_WORK(&viosim_rd_task, (void *) viosim_rd_exec);
+    INIT_DELAYED_WORK(&viosim_wr_task, (void *) viosim_wr_exec);
+
+    /* Exposing device statistics through debugfs (best effort). */
+    viosim_dbgfs_dir = debugfs_create_dir(DEVICE_DEBUGFS_DIR_NAME, NULL);
+
+    debugfs_create_file(DEVICE_DEBUGFS_NUMA_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_numa_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_STORE_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_store_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_COMP_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_comp_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_DEDUP_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_dedup_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_COPY_FILE_NAME,  0444,
+                        viosim_dbgfs_dir, NULL, &viosim_copy_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_FTL_FILE_NAME,   0444,
+                        viosim_dbgfs_dir, NULL, &viosim_ftl_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_THROTTLE_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_throttle_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_TRACE_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_trace_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_SNAP_FILE_NAME,  0444,
+                        viosim_dbgfs_dir, NULL, &viosim_snap_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_REMOTE_FILE_NAME, 0444,
+                        viosim_dbgfs_dir, NULL, &viosim_remote_fops);
+
+    debugfs_create_file(DEVICE_DEBUGFS_PRIO_FILE_NAME,  0444,
+                        viosim_dbgfs_dir, NULL, &viosim_prio_fops);
+
+    viosim_trace_init();
 
     /* (10)                                                        */
     /* Adding the device into the system, i.e. allowing the kernel */
@@ -808,7 +6602,21 @@ static void __exit virtblkiosim_exit(void) {
     /* Destroying the request queue. */
     blk_cleanup_queue(viosim_req_qu);
 
-    /* (4)                             */
+    /* (4)                                           */
+    /* Making sure no request work is still running. */
+    cancel_delayed_work_sync(&viosim_rd_task);
+    cancel_delayed_work_sync(&viosim_wr_task);
+
+    /* (5)                                           */
+    /* Removing debugfs entries, freeing the store.  */
+    if (viosim_trace_chan != NULL) {
+        relay_close(viosim_trace_chan);
+    }
+
+    debugfs_remove_recursive(viosim_dbgfs_dir);
+    viosim_store_free();
+
+    /* (6)                             */
     /* Deregistering the block device. */
     unregister_blkdev(major_num, DEVICE_NAME);
 
@@ -17,6 +17,42 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/numa.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/crypto.h>
+#include <linux/zsmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/hashtable.h>
+#include <linux/xxhash.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/rwsem.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/bitops.h>
+#include <linux/eventfd.h>
+#include <linux/version.h>
+#include <linux/relay.h>
+#include <linux/err.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/un.h>
+#include <linux/inet.h>
+#include <linux/tcp.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/ioprio.h>
 
 /* Helper constants. */
 #define  EXIT_FAILURE        1 /*    Failing exit status. */
@@ -35,7 +71,12 @@
 #define _MODULE_VERSION     "0.9.10"
 #define _MODULE_COPYRIGHT__ "Copyright (C) 2016-2026"
 #define _MODULE_AUTHOR      "Radislav Golubtsov <rgolubtsov@protonmail.com>"
-#define _MODULE_LICENSE     "MIT"
+/*
+ * The driver is MIT-licensed (see LICENSE) and dual-licensed under the GPL
+ * for the kernel's sake: debugfs, relay, eventfd, zsmalloc, the crypto API
+ * and ktime_get_ns() are all exported to GPL-compatible modules only.
+ */
+#define _MODULE_LICENSE     "Dual MIT/GPL"
 
 /** Constant: Print this when registering the device failed. */
 #define _REGISTER_DEVICE_FAILED_ERR "Failed to register device"
@@ -51,6 +92,124 @@
 #define _ALLOCATE_DEVICE_STRUCT_FAILED_ERR \
          "Failed to allocate device structure"
 
+/** Constant: Print this when the requested NUMA node is not usable. */
+#define _NUMA_NODE_INVALID_ERR \
+         "NUMA node %d is not online; refusing to allocate backing store"
+
+/** Constant: Print this when the requested device size is zero. */
+#define _NR_BLOCKS_INVALID_ERR "Device size must be at least one block"
+
+/** Constant: Print this when allocating the device backing store failed. */
+#define _ALLOCATE_BACKING_STORE_FAILED_ERR \
+         "Failed to allocate device backing store"
+
+/**
+ * Constant: Print this for each NUMA node holding backing store pages
+ *           just after the store has been allocated.
+ */
+#define _BACKING_STORE_NODE_PAGES_MSG \
+         "Backing store: %llu page(s) allocated on node %d"
+
+/**
+ * Constant: Print this when the backing store has been allocated
+ *           with huge pages requested.
+ */
+#define _BACKING_STORE_HUGE_STRIPES_MSG \
+         "Backing store: %u of %u stripe(s) backed by huge pages"
+
+/** Constant: Print this when the compressed store is set up. */
+#define _BACKING_STORE_COMPRESSED_MSG \
+         "Backing store: pages are compressed with %s"
+
+/**
+ * Constant: Print this when the requested compression algorithm
+ *           is not available.
+ */
+#define _COMP_ALGO_UNAVAILABLE_ERR \
+         "Compression algorithm %s is not available"
+
+/**
+ * Constant: Print this when huge pages are requested along with
+ *           the compressed or deduplicated store.
+ */
+#define _STORE_WITH_HUGEPAGES_ERR \
+         "Compressed or deduplicated backing store " \
+         "cannot be backed by huge pages"
+
+/**
+ * Constant: Print this when both the compressed store and deduplication
+ *           are requested.
+ */
+#define _COMP_WITH_DEDUP_ERR \
+         "Compression and deduplication cannot be used together"
+
+/** Constant: Print this when decompressing a stored page failed. */
+#define _DECOMPRESS_PAGE_FAILED_ERR \
+         "Failed to decompress page %llu"
+
+/** Constant: Print this when the copy mode given is unknown. */
+#define _COPY_MODE_INVALID_ERR \
+         "Unknown copy mode: %s (memcpy, nt, or auto)"
+
+/** Constant: Print this to report the copy mode in use. */
+#define _COPY_MODE_MSG "Copy mode: %s, non-temporal copies from %u bytes"
+
+/** Constant: Print this for each copy calibration step. */
+#define _COPY_CALIB_MSG "Copy calibration: %4u bytes: %5llu ns memcpy, " \
+                        "%5llu ns non-temporal"
+
+/** Constant: Print this when the FTL fallback given is unknown. */
+#define _FTL_FALLBACK_INVALID_ERR \
+         "Unknown FTL fallback: %s (identity, last, or fail)"
+
+/** Constant: Print this when the device is too large for the L2P cache. */
+#define _L2P_CACHE_TOO_LARGE_ERR \
+         "Device of %llu pages is too large for the L2P cache"
+
+/** Constant: Print this when writes were placed but couldn't be journaled. */
+#define _JOURNAL_LOST_ERR \
+         "Write to page %llu failed, its PPN %llu is not given back to the FTL"
+
+/** Constant: Print this when the mapping export device can't be set up. */
+#define _MAP_EXPORT_FAILED_ERR "Cannot register the mapping export device: %d"
+
+/** Constant: Print this when the I/O trace buffers can't be set up. */
+#define _TRACE_FAILED_ERR "Cannot set up the I/O trace buffers (%u KiB per CPU)"
+
+/** Constant: Print this when the remote store can't be used with others. */
+#define _REMOTE_WITH_STORE_ERR \
+         "A remote store cannot be used with hugepages, comp_algo, " \
+         "zero_pages, or dedup"
+
+/** Constant: Print this when the remote store address is not valid. */
+#define _REMOTE_ADDR_INVALID_ERR \
+         "Invalid remote store address: %s (a socket path, or IPv4:port)"
+
+/** Constant: Print this when unable to connect to the remote store. */
+#define _REMOTE_CONNECT_FAILED_ERR \
+         "Cannot connect to the remote store at %s (connection %u): %d"
+
+/** Constant: Print this once connected to the remote store. */
+#define _REMOTE_CONNECTED_MSG \
+         "Backing store: remote at %s, %u connection(s), %u in flight each"
+
+/** Constant: Print this when a remote store connection is lost. */
+#define _REMOTE_CONN_LOST_ERR \
+         "Remote store connection %u lost, failing its requests"
+
+/** Constant: Print this when the FTL didn't answer a request in time. */
+#define _FTL_TIMEOUT_ERR \
+         "FTL did not answer request at sector %llu in %u ms (%s)"
+
+/** Constant: Print this for each copy path self-test case. */
+#define _SELFTEST_CASE_MSG "selftest: %s %u - %s"
+
+/** Constant: Print this for each copy path microbenchmark. */
+#define _SELFTEST_BENCH_MSG "selftest: %-22s %6llu ns/op"
+
+/** Constant: Print this when any copy path self-test case failed. */
+#define _SELFTEST_FAILED_ERR "selftest: %u of %u case(s) failed"
+
 /** Constant: Print this when unable to copy some data to user space. */
 #define _COPY_TO_USER_DEAD_BYTES_EXIST_ERR \
          "Cannot copy %lu byte(s) to user space"
@@ -67,14 +226,8 @@
          "<bio> segment data does not match with request data"
 
 /**
- * Constant: Print this when the device capacity reached
- *           during a sequential read try.
- */
-#define _READ_CAPACITY_REACHED_MSG "Device read capacity reached"
-
-/**
- * Constant: Print this when the device capacity reached
- *           during a sequential write try.
+ * Constant: Print this when a page is written with no page to go to
+ *           (beyond the device capacity, e.g. the FTL is out of space).
  */
 #define _WRITE_CAPACITY_REACHED_MSG "Device write capacity reached"
 
@@ -103,25 +256,151 @@
  */
 #define DEVICE_REQ_QU_MAX_HW_SECTORS 1024
 
+/**
+ * Constant: The default number of times in a row the user space FTL
+ *           is handed a read ahead of a waiting write.
+ */
+#define DEVICE_WRITES_STARVED 2
+
+/** Constant: The default time (ms) a request waits for the FTL's answer. */
+#define DEVICE_FTL_TIMEOUT_MS 5000
+
+/**
+ * Constant: The default burst (ms) of the throttling token buckets,
+ *           i.e.\ how long the full rate may be exceeded for.
+ */
+#define DEVICE_THROTTLE_BURST_MS 100
+
+/** Constant: The number of sub-buffers of each per-CPU I/O trace buffer. */
+#define DEVICE_TRACE_SUBBUFS 8
+
+/** Constants: The operations recorded in the I/O trace. */
+#define DEVICE_TRACE_OP_READ  0
+#define DEVICE_TRACE_OP_WRITE 1
+
+/**
+ * Constants: The I/O priority classes requests are dispatched by
+ *            (the lower, the sooner), and their number.
+ */
+#define DEVICE_PRIO_RT      0
+#define DEVICE_PRIO_BE      1
+#define DEVICE_PRIO_IDLE    2
+#define DEVICE_PRIO_CLASSES 3
+
+/**
+ * Constant: The default time (ms) a request may be passed over
+ *           by requests of a higher I/O priority class.
+ */
+#define DEVICE_PRIO_AGING_MS 1000
+
+/**
+ * Constant: The number of request latency histogram buckets
+ *           (powers of two of microseconds, the last one open-ended).
+ */
+#define DEVICE_PRIO_LAT_BUCKETS 24
+
+/** Constant: The number of backing store snapshot slots. */
+#define DEVICE_SNAP_SLOTS 8
+
+/** Constant: The max length of the remote store address. */
+#define DEVICE_REMOTE_ADDR_MAX 108
+
+/** Constants: The default and the max number of remote store connections. */
+#define DEVICE_REMOTE_CONNS     4
+#define DEVICE_REMOTE_CONNS_MAX 64
+
+/**
+ * Constants: The default and the max number of page requests
+ *            in flight per remote store connection.
+ */
+#define DEVICE_REMOTE_DEPTH     32
+#define DEVICE_REMOTE_DEPTH_MAX 256
+
+/** Constant: The L2P cache entry of a page not cached. */
+#define DEVICE_L2P_NONE U32_MAX
+
+/** Constant: The max number of PPNs or journal entries passed at a time. */
+#define DEVICE_PPN_BATCH_MAX 128
+
+/** Constant: The capacity of the pool of PPNs granted by the FTL. */
+#define DEVICE_PPN_POOL_MAX 1024
+
+/** Constant: The capacity of the journal of writes placed by the kernel. */
+#define DEVICE_JOURNAL_MAX 1024
+
+/** Constant: The max length of the FTL fallback name. */
+#define DEVICE_FTL_FALLBACK_NAME_MAX 10
+
+/**
+ * Constants: The FTL fallbacks, i.e.\ what happens to a request
+ *            the FTL didn't answer in time.
+ */
+#define DEVICE_FTL_FALLBACK_IDENTITY "identity"
+#define DEVICE_FTL_FALLBACK_LAST     "last"
+#define DEVICE_FTL_FALLBACK_FAIL     "fail"
+
+/** Constant: The max number of requests fetched or answered in a batch. */
+#define DEVICE_FTL_BATCH_MAX 64
+
 /** Constant: The device first minor number. */
 #define DEVICE_MINOR_NUM_FIRST 0
 
 /** Constant: The device minor numbers amount. */
 #define DEVICE_MINOR_NUMS_MAX 16
 
-/** Constant: The number of 512-byte blocks. */
+/**
+ * Constant: The default device size in blocks (the device size is set
+ *           at load through <code>nr_blocks</code>).
+ */
 #define DEVICE_NUMBER_OF_BLOCKS 8
 
-/** Constant: The number of pages per 512-byte block. */
+/** Constant: The number of pages per block (4 MiB). */
 #define DEVICE_NUMBER_OF_PAGES_PER_BLOCK 1024
 
-/** Constant: The number of pages. */
-#define DEVICE_NUMBER_OF_PAGES (DEVICE_NUMBER_OF_BLOCKS * \
-                                DEVICE_NUMBER_OF_PAGES_PER_BLOCK)
+/**
+ * Constant: The allocation order of a huge page backing a whole stripe
+ *           (2 MiB with 4 KiB base pages).
+ */
+#define DEVICE_HUGE_PAGE_ORDER 9
+
+/**
+ * Constant: The number of pages per backing store stripe, i.e.\ the unit
+ *           of interleaving backing store pages across NUMA nodes
+ *           and of huge page allocation (2 MiB).
+ */
+#define DEVICE_NUMBER_OF_PAGES_PER_STRIPE (1 << DEVICE_HUGE_PAGE_ORDER)
 
 /** Constant: The device page size. */
 #define DEVICE_PAGE_SIZE 4096
 
+/** Constant: The max length of a compression algorithm name. */
+#define DEVICE_COMP_ALGO_NAME_MAX 32
+
+/**
+ * Constant: The max size of a compressed page still worth keeping
+ *           compressed (3/4 of a page); bigger ones are kept raw.
+ */
+#define DEVICE_COMP_MAX_SIZE (DEVICE_PAGE_SIZE / 4 * 3)
+
+/**
+ * Constant: The size of the compression scratch buffer (some algorithms
+ *           expand incompressible input).
+ */
+#define DEVICE_COMP_BUFFER_SIZE (DEVICE_PAGE_SIZE * 2)
+
+/** Constant: The number of bits of the shared (deduplicated) page hash. */
+#define DEVICE_DEDUP_HASH_BITS 16
+
+/** Constant: The page entry flag: the page is all zeros. */
+#define DEVICE_PAGE_FLAG_ZERO 0x1
+
+/**
+ * Constant: The number of bits of the page lock hash (PPNs share
+ *           <code>DEVICE_PAGE_LOCKS</code> locks).
+ */
+#define DEVICE_PAGE_LOCK_BITS 8
+#define DEVICE_PAGE_LOCKS     (1 << DEVICE_PAGE_LOCK_BITS)
+
 /** Constant: The device sector size. */
 #define DEVICE_SECTOR_SIZE 512
 
@@ -129,16 +408,96 @@
 #define DEVICE_NUMBER_OF_SECTORS_PER_PAGE (DEVICE_PAGE_SIZE / \
                                            DEVICE_SECTOR_SIZE)
 
-/** Constant: The size of the table containing device page map entries. */
-#define DEVICE_PAGE_MAP_TABLE_SIZE (DEVICE_NUMBER_OF_PAGES * \
-                                    DEVICE_NUMBER_OF_SECTORS_PER_PAGE)
+/** Constant: The max length of the copy mode name. */
+#define DEVICE_COPY_MODE_NAME_MAX 8
 
-/** Constant: The device total size. */
-#define DEVICE_TOTAL_SIZE (DEVICE_NUMBER_OF_PAGES * \
-                           DEVICE_PAGE_SIZE)
+/** Constants: The copy modes. */
+#define DEVICE_COPY_MODE_MEMCPY "memcpy"
+#define DEVICE_COPY_MODE_NT     "nt"
+#define DEVICE_COPY_MODE_AUTO   "auto"
 
-/** Constant: The device request size divisor. */
-#define DEVICE_REQUEST_SIZE_DIV 8
+/**
+ * Constant: The size of the buffer the copy calibration streams
+ *           into (larger than the last level cache of most hosts).
+ */
+#define DEVICE_COPY_CALIB_SIZE (32 << 20)
+
+/**
+ * Constant: The number of copy sizes calibrated: from one sector
+ *           up to one page, doubling.
+ */
+#define DEVICE_COPY_CALIB_STEPS 4
+
+/** Constant: The number of device pages the self-tests run over. */
+#define DEVICE_SELFTEST_PAGES 4
+
+/** Constant: The number of iterations of each self-test microbenchmark. */
+#define DEVICE_SELFTEST_BENCH_LOOPS 100000
+
+/** Constant: The name of the debugfs directory holding device statistics. */
+#define DEVICE_DEBUGFS_DIR_NAME _MODULE_NAME
+
+/** Constant: The name of the debugfs file reporting NUMA placement. */
+#define DEVICE_DEBUGFS_NUMA_FILE_NAME "numa"
+
+/** Constant: The name of the debugfs file reporting backing store layout. */
+#define DEVICE_DEBUGFS_STORE_FILE_NAME "store"
+
+/** Constant: The name of the debugfs file reporting compression stats. */
+#define DEVICE_DEBUGFS_COMP_FILE_NAME "comp"
+
+/** Constant: The name of the debugfs file reporting dedup stats. */
+#define DEVICE_DEBUGFS_DEDUP_FILE_NAME "dedup"
+
+/** Constant: The name of the debugfs file reporting copy stats. */
+#define DEVICE_DEBUGFS_COPY_FILE_NAME "copy"
+
+/** Constant: The name of the debugfs file reporting FTL handshake stats. */
+#define DEVICE_DEBUGFS_FTL_FILE_NAME "ftl"
+
+/** Constant: The name of the debugfs file reporting throttling stats. */
+#define DEVICE_DEBUGFS_THROTTLE_FILE_NAME "throttle"
+
+/** Constant: The name of the debugfs file reporting snapshot stats. */
+#define DEVICE_DEBUGFS_SNAP_FILE_NAME "snap"
+
+/** Constant: The name of the debugfs file reporting remote store stats. */
+#define DEVICE_DEBUGFS_REMOTE_FILE_NAME "remote"
+
+/** Constant: The name of the debugfs file reporting I/O priority stats. */
+#define DEVICE_DEBUGFS_PRIO_FILE_NAME "prio"
+
+/** Constant: The name of the debugfs file reporting I/O trace stats. */
+#define DEVICE_DEBUGFS_TRACE_FILE_NAME "trace"
+
+/**
+ * Constant: The base name of the debugfs relay files holding
+ *           the I/O trace (the CPU number is appended).
+ */
+#define DEVICE_DEBUGFS_TRACE_CPU_FILE_NAME "trace-cpu"
+
+/** Constant: The name of the misc device the mapping is exported through. */
+#define DEVICE_MAP_MISC_NAME DEVICE_NAME "-map"
+
+/** Constant: The magic number the mapping export header starts with. */
+#define DEVICE_MAP_MAGIC 0x70616d6d69736f69ULL /* <== "iosimmap". */
+
+/** Constant: The mapping export entry of a page not mapped (as known). */
+#define DEVICE_MAP_PPN_NONE U64_MAX
+
+/** Constant: The magic number each remote store message starts with. */
+#define DEVICE_REMOTE_MAGIC 0x6d727376 /* <== "vsrm". */
+
+/**
+ * Constants: The remote store operations: telling the server the device
+ *            size on connecting, and reading and writing (part of) a page.
+ */
+#define DEVICE_REMOTE_OP_HELLO 0
+#define DEVICE_REMOTE_OP_READ  1
+#define DEVICE_REMOTE_OP_WRITE 2
+
+/** Constant: The source page of a write meaning "zeros" (none to copy). */
+#define DEVICE_REMOTE_PPN_ZERO U64_MAX
 
 /**
  * Constant: The ioctl() type letter used to create a corresponding number
@@ -150,6 +509,14 @@
 #define DEVICE_IOCTL_REG_USER_CALLER \
         _IO(DEVICE_IOCTL_TYPE_LETTER,  0)
 
+/**
+ * Constant: The flag passed as the argument of registering a user space
+ *           caller declaring it maps each page to itself (LPN = PPN),
+ *           which lets writes it doesn't answer in time go through
+ *           with the FTL fallback, too (they fail otherwise).
+ */
+#define DEVICE_REG_FLAG_IDENTITY 0x1
+
 /** Constant: The ioctl() command to get the request size. */
 #define DEVICE_IOCTL_GET_REQUEST_SIZE \
         _IOR(DEVICE_IOCTL_TYPE_LETTER, 1, unsigned long)
@@ -162,6 +529,80 @@
 #define DEVICE_IOCTL_SET_BLOCK \
         _IOW(DEVICE_IOCTL_TYPE_LETTER, 3, unsigned long)
 
+/**
+ * Constant: The ioctl() command to copy a physical page onto another one
+ *           (used by the user space FTL to relocate pages on GC).
+ */
+#define DEVICE_IOCTL_COPY_PAGE \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 4, struct viosim_page_copy)
+
+/**
+ * Constant: The ioctl() command to invalidate a range of the kernel L2P
+ *           cache (used by the user space FTL when it remaps pages other
+ *           than by answering a write, e.g.\ on GC).
+ */
+#define DEVICE_IOCTL_INVALIDATE_L2P \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 5, struct viosim_l2p_range)
+
+/**
+ * Constant: The ioctl() command to grant the kernel free PPNs it places
+ *           writes to on its own (when <code>async_writes</code> is set).
+ */
+#define DEVICE_IOCTL_GRANT_PPNS \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 6, struct viosim_ppn_grant)
+
+/**
+ * Constant: The ioctl() command to drain the journal of writes the kernel
+ *           has placed on its own. The FTL has to drain it after getting
+ *           a request and before answering it, so that it never answers
+ *           a request with a mapping older than one already journaled.
+ */
+#define DEVICE_IOCTL_DRAIN_JOURNAL \
+        _IOR(DEVICE_IOCTL_TYPE_LETTER, 7, struct viosim_journal_batch)
+
+/**
+ * Constant: The ioctl() command to have an eventfd signaled whenever
+ *           a request is queued for the user space FTL (<code>-1</code>
+ *           &ndash; none). Along with the device opened with
+ *           <code>O_NONBLOCK</code> (making the GET ioctl()s fail with
+ *           <code>EAGAIN</code> instead of waiting), this lets the FTL
+ *           serve the device out of an event loop.
+ */
+#define DEVICE_IOCTL_SET_EVENTFD \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 8, int)
+
+/**
+ * Constant: The ioctl() command to fetch a batch of requests waiting
+ *           for the user space FTL (waiting for one, unless opened
+ *           non-blocking). Fetched requests stay handed to the FTL
+ *           until answered by their tags, so that many of them
+ *           may be in flight.
+ */
+#define DEVICE_IOCTL_GET_BATCH \
+        _IOWR(DEVICE_IOCTL_TYPE_LETTER, 9, struct viosim_ftl_batch)
+
+/** Constant: The ioctl() command to answer a batch of fetched requests. */
+#define DEVICE_IOCTL_SET_BATCH \
+        _IOWR(DEVICE_IOCTL_TYPE_LETTER, 10, struct viosim_ftl_batch)
+
+/**
+ * Constants: The ioctl() calls to take a snapshot of the backing store
+ *            into a slot, to clone a snapshot into another slot, to roll
+ *            the device back to a snapshot (which is kept), and to drop
+ *            a snapshot. Pages are shared by reference and copied when
+ *            first written after a snapshot; only the raw backing store
+ *            (not compressed, deduplicated, zero-page, or huge-page one)
+ *            can be snapshotted.
+ */
+#define DEVICE_IOCTL_SNAP_TAKE \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 11, unsigned)
+#define DEVICE_IOCTL_SNAP_CLONE \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 12, struct viosim_snap_clone)
+#define DEVICE_IOCTL_SNAP_ROLLBACK \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 13, unsigned)
+#define DEVICE_IOCTL_SNAP_DROP \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 14, unsigned)
+
 /**
  * The structure to hold the device page mapping data.
  * It is used to communicate with user space.
@@ -172,13 +613,14 @@ struct viosim_page_map {
 
     /**
      * The physical page number (PPN). Provided by the user
-     * and is based on <code>lpn</code>.
+     * and is based on <code>lpn</code>. Prefilled with <code>lpn</code>
+     * by the kernel (identity mapping).
      */
     u64 ppn;
 
     /**
      * The new physical page number. Provided by the user
-     * for write ops only.
+     * for write ops only. Prefilled with <code>lpn</code> by the kernel.
      */
     u64 ppnx;
 
@@ -207,6 +649,555 @@ struct viosim_request_map {
     void *req_buffer;
 };
 
+/**
+ * The structure to hold a request data segment within a device page.
+ * The request map has one entry per page (as handed to the user space
+ * FTL), whereas the data of a page may come in several segments
+ * (bio_vecs), which are kept in a list of their own for the copy loop.
+ */
+struct viosim_request_seg {
+    /** The index of the request map entry (page) the segment belongs to. */
+    unsigned entry;
+
+    /** The number of sectors of the segment. */
+    unsigned num_of_sectors;
+
+    /** The starting sector of the segment. */
+    u64 start_sector;
+
+    /** The pointer to the segment data in the read/write request buffer. */
+    u8 *buffer;
+};
+
+/** The structure to hold a request waiting for the user space FTL. */
+struct viosim_ftl_req {
+    /** The node in the list of requests of the same direction waiting. */
+    struct list_head node;
+
+    /** The request map entries. */
+    struct viosim_request_map *req_map;
+
+    /** The number of request map entries. */
+    unsigned req_size;
+
+    /** Whether the FTL has answered (or is gone). */
+    bool answered;
+
+    /** The tag the request is answered by (when fetched in a batch). */
+    u32 tag;
+
+    /** The write sequence number as of handing the request to the FTL. */
+    u64 wr_seq;
+};
+
+/**
+ * The structure to describe a batch of requests fetched or answered
+ * by the user space FTL: <code>len</code> bytes at <code>addr</code>
+ * holding <code>nr_reqs</code> <code>viosim_ftl_batch_req</code>
+ * records one after another.
+ */
+struct viosim_ftl_batch {
+    /** The user space address of the records. */
+    u64 addr;
+
+    /** The size of the buffer the records are in (in bytes). */
+    u32 len;
+
+    /**
+     * The number of records: fetched (<code>GET_BATCH</code>),
+     * or to answer in, then answered (<code>SET_BATCH</code>).
+     */
+    u32 nr_reqs;
+};
+
+/** The structure to describe a request in a batch. */
+struct viosim_ftl_batch_req {
+    /** The tag to answer the request by. */
+    u32 tag;
+
+    /** The number of request map entries. */
+    u32 req_size;
+
+    /** The request map entries. */
+    struct viosim_request_map req_map[];
+};
+
+/**
+ * The structure to describe a range of logical pages whose L2P cache
+ * entries the user space FTL invalidates (<code>nr_pages</code>
+ * of <code>0</code> &ndash; the whole cache).
+ */
+struct viosim_l2p_range {
+    /** The first logical page number (LPN). */
+    u64 lpn;
+
+    /** The number of pages. */
+    u64 nr_pages;
+};
+
+/**
+ * The structure to describe a batch of free physical pages
+ * the user space FTL grants the kernel to place writes to.
+ */
+struct viosim_ppn_grant {
+    /** The number of PPNs in the batch. */
+    u64 nr_ppns;
+
+    /** The physical page numbers (PPNs). */
+    u64 ppns[DEVICE_PPN_BATCH_MAX];
+};
+
+/**
+ * The structure to describe the mapping exported read-only through
+ * <code>mmap()</code>: this header page is followed by the L2P table
+ * (a <code>u64</code> PPN per LPN, <code>DEVICE_MAP_PPN_NONE</code>
+ * &ndash; not known) and the valid bitmap (a bit per PPN, in
+ * <code>unsigned long</code> words), each at its page-aligned offset.
+ * The generation is odd while the mapping is being updated and grows
+ * by two with each update: a reader takes a consistent snapshot
+ * by re-reading it until it's even and unchanged across the copy.
+ */
+struct viosim_map_header {
+    /** The magic number: <code>DEVICE_MAP_MAGIC</code>. */
+    u64 magic;
+
+    /** The generation counter. */
+    u64 generation;
+
+    /** The number of pages (entries of the table, bits of the bitmap). */
+    u64 nr_pages;
+
+    /** The offsets (bytes) of the L2P table and the valid bitmap. */
+    u64 l2p_offset;
+    u64 valid_offset;
+
+    /** The size (bytes) of the whole mapping export. */
+    u64 size;
+};
+
+/** The structure to describe a write placed by the kernel on its own. */
+struct viosim_journal_entry {
+    /** The logical page number (LPN) written. */
+    u64 lpn;
+
+    /** The granted physical page number (PPN) it has been written to. */
+    u64 ppn;
+};
+
+/**
+ * The structure to describe a batch of journal entries
+ * drained by the user space FTL (oldest first).
+ */
+struct viosim_journal_batch {
+    /** The number of entries in the batch. */
+    u64 nr_entries;
+
+    /** The journal entries. */
+    struct viosim_journal_entry entries[DEVICE_PPN_BATCH_MAX];
+};
+
+/**
+ * The structure to describe a physical page copy
+ * requested by the user space FTL.
+ */
+struct viosim_page_copy {
+    /** The physical page number (PPN) to copy from. */
+    u64 src_ppn;
+
+    /** The physical page number (PPN) to copy to. */
+    u64 dst_ppn;
+};
+
+/** The structure to describe a snapshot to clone into another slot. */
+struct viosim_snap_clone {
+    /** The slot to clone into (must be free). */
+    u32 slot;
+
+    /** The slot of the snapshot to clone. */
+    u32 src;
+};
+
+/** The structure to hold the backing store snapshot statistics. */
+struct viosim_snap_stats {
+    /** The number of snapshots taken (or cloned), and rollbacks done. */
+    u64 taken;
+    u64 rollbacks;
+
+    /** The time (ns) the last snapshot and the last rollback took. */
+    u64 last_take_ns;
+    u64 last_rollback_ns;
+
+    /** The number of pages copied on first write while shared. */
+    atomic64_t cow_pages;
+};
+
+/**
+ * The structure to describe a remote store message: a request, or
+ * the answer to it (echoing the tag). A write request is followed by
+ * the data, and so is the answer to a read request that went well.
+ * Both ends are on the same host so far: it is in host byte order.
+ */
+struct viosim_remote_msg {
+    /** The magic number (<code>DEVICE_REMOTE_MAGIC</code>). */
+    u32 magic;
+
+    /** The operation (<code>DEVICE_REMOTE_OP_*</code>). */
+    u16 op;
+
+    /** The status (the answer only): <code>0</code> or an errno value. */
+    u16 status;
+
+    /** The tag the answer is matched to the request by. */
+    u32 tag;
+
+    /** The number of bytes read or written. */
+    u32 len;
+
+    /** The page read or written (the number of pages for the hello). */
+    u64 ppn;
+
+    /**
+     * The page the rest of the page written comes from (if not the page
+     * itself), or <code>DEVICE_REMOTE_PPN_ZERO</code> to zero the rest.
+     */
+    u64 src_ppn;
+
+    /** The offset within the page read or written. */
+    u32 offset;
+
+    /** Reserved (zero). */
+    u32 reserved;
+};
+
+/** The structure to describe a page request sent to the remote store. */
+struct viosim_remote_io {
+    /** The request (of the device, or a single page) it is part of. */
+    struct viosim_remote_req *rreq;
+
+    /** The buffer read into (or written from), and its length. */
+    u8  *buffer;
+    u32  len;
+
+    /** The operation (<code>DEVICE_REMOTE_OP_*</code>). */
+    u16 op;
+
+    /** The time (ns) it was sent at. */
+    u64 start_ns;
+};
+
+/**
+ * The structure to describe a request served by the remote store:
+ * it is done once all of its page requests are answered.
+ */
+struct viosim_remote_req {
+    /** The page requests in flight (plus one while still sending). */
+    atomic_t pending;
+
+    /** The status: the first error, if any. */
+    int error;
+
+    /** Gets called once done. */
+    void (*done)(struct viosim_remote_req *rreq);
+
+    /** The device request, and its map (none for a single page). */
+    struct request            *req;
+    struct viosim_request_map *req_map;
+    struct viosim_request_seg *req_segs;
+    struct viosim_remote_io   *ios;
+    unsigned                   req_size;
+    int                        transf_dir;
+
+    /** Whether the written pages are to be cached, and committed. */
+    bool update;
+    bool placed;
+
+    /** Waited for by the caller of a single page request. */
+    struct completion waited;
+};
+
+/** The structure to hold a remote store connection. */
+struct viosim_remote_conn {
+    /** The connection number. */
+    unsigned index;
+
+    /** The socket. */
+    struct socket *sock;
+
+    /** Serializes sending the requests. */
+    struct mutex send_mutex;
+
+    /** Guards the requests in flight. */
+    spinlock_t lock;
+
+    /** Waited on for a tag to become free. */
+    wait_queue_head_t slot_wait;
+
+    /** The requests in flight, by tag. */
+    struct viosim_remote_io *inflight[DEVICE_REMOTE_DEPTH_MAX];
+
+    /** The number of requests in flight, and the most ever. */
+    unsigned nr_inflight;
+    unsigned peak;
+
+    /** The next tag to try. */
+    unsigned next_tag;
+
+    /** Whether the connection is lost (its requests all failed). */
+    bool dead;
+
+    /** The thread receiving the answers. */
+    struct task_struct *rx_task;
+};
+
+/** The structure to hold the remote store statistics. */
+struct viosim_remote_stats {
+    /** The number of device requests sent, and still in flight. */
+    atomic64_t reqs;
+    atomic64_t reqs_inflight;
+
+    /** The number of page reads and writes answered. */
+    atomic64_t reads;
+    atomic64_t writes;
+
+    /** The number of page requests failed. */
+    atomic64_t errors;
+
+    /** The total time (ns) page requests took to be answered. */
+    atomic64_t lat_ns;
+
+    /** The number of times a connection had no tag free to send with. */
+    atomic64_t slot_waits;
+};
+
+/** The structure to hold the backing store stripe allocation data. */
+struct viosim_stripe {
+    /** The NUMA node the stripe is allocated on. */
+    int node;
+
+    /**
+     * The allocation order of the stripe: <code>0</code> &ndash;
+     * allocated page by page; a single compound page otherwise.
+     */
+    unsigned order;
+};
+
+/**
+ * The structure to hold per-NUMA-node backing store statistics.
+ * It is used to verify backing store placement.
+ */
+struct viosim_numa_stats {
+    /** The number of backing store pages allocated on the node. */
+    atomic64_t alloc_pages;
+
+    /** The number of page copies done by a CPU of the same node. */
+    atomic64_t local_copies;
+
+    /** The number of page copies done by a CPU of another node. */
+    atomic64_t remote_copies;
+};
+
+/** The structure to hold a shared (deduplicated) backing store page. */
+struct viosim_dedup_page {
+    /** The node in the shared page hash table. */
+    struct hlist_node node;
+
+    /** The content hash. */
+    u64 hash;
+
+    /** The number of device pages referencing this one. */
+    unsigned refcount;
+
+    /** The page data. */
+    u8 *data;
+};
+
+/** The structure to hold a backing store page entry. */
+struct viosim_page_entry {
+    /** The zsmalloc handle (<code>0</code> &ndash; not compressed). */
+    unsigned long handle;
+
+    /** The shared page (<code>NULL</code> &ndash; not shared). */
+    struct viosim_dedup_page *dup;
+
+    /** The compressed page size. */
+    u16 size;
+
+    /** The page flags (<code>DEVICE_PAGE_FLAG_*</code>). */
+    u16 flags;
+};
+
+/** The structure to hold compressed backing store statistics. */
+struct viosim_comp_stats {
+    /** The number of pages currently stored compressed. */
+    atomic64_t comp_pages;
+
+    /** The number of bytes the compressed pages currently occupy. */
+    atomic64_t stored_bytes;
+
+    /** The number of compress calls and the time spent in them (ns). */
+    u64 comp_ops;
+    u64 comp_ns;
+
+    /** The number of bytes produced by successful compress calls. */
+    u64 comp_out_bytes;
+
+    /** The number of decompress calls and the time spent in them (ns). */
+    u64 decomp_ops;
+    u64 decomp_ns;
+};
+
+/** The structure to hold zero-page and deduplication statistics. */
+struct viosim_dedup_stats {
+    /** The number of all-zero page writes. */
+    atomic64_t zero_writes;
+
+    /** The number of pages currently recorded as all-zero. */
+    atomic64_t zero_pages;
+
+    /** The number of writes matching an existing shared page. */
+    u64 hits;
+
+    /** The number of writes of content not seen before. */
+    u64 misses;
+
+    /** The number of shared pages, i.e.\ distinct contents stored. */
+    u64 shared_pages;
+
+    /** The number of device pages referencing shared pages. */
+    u64 shared_refs;
+};
+
+/** The structure to hold copy path statistics. */
+struct viosim_copy_stats {
+    /** The number of plain (cached) copies and the bytes copied. */
+    atomic64_t copies;
+    atomic64_t bytes;
+
+    /** The number of non-temporal copies and the bytes copied. */
+    atomic64_t nt_copies;
+    atomic64_t nt_bytes;
+
+    /**
+     * The calibrated time per copy (ns) of each size (one sector
+     * up to one page, doubling); zero when not calibrated.
+     */
+    u64 calib_memcpy_ns[DEVICE_COPY_CALIB_STEPS];
+    u64 calib_nt_ns[DEVICE_COPY_CALIB_STEPS];
+};
+
+/** The structure to hold FTL handshake statistics. */
+struct viosim_ftl_stats {
+    /** The number of requests answered by the FTL. */
+    atomic64_t answered;
+
+    /** The number of requests the FTL didn't answer in time. */
+    atomic64_t timeouts;
+
+    /** The number of those completed with the fallback mapping. */
+    atomic64_t fallbacks;
+
+    /** The number of those failed. */
+    atomic64_t failures;
+
+    /** The number of reads served by the L2P cache, and forwarded. */
+    atomic64_t l2p_hits;
+    atomic64_t l2p_misses;
+
+    /** The number of L2P cache entries invalidated by the FTL. */
+    atomic64_t l2p_invalidated;
+
+    /**
+     * The number of writes placed by the kernel on its own, and forwarded
+     * to the FTL (with too few PPNs granted or pages to be read unknown).
+     */
+    atomic64_t async_writes;
+    atomic64_t async_misses;
+
+    /** The number of PPNs granted by the FTL, and journal entries drained. */
+    atomic64_t ppns_granted;
+    atomic64_t journal_drained;
+};
+
+/**
+ * The structure to describe an I/O trace record, logged on the CPU
+ * completing the request.
+ */
+struct viosim_trace_rec {
+    /** The time (ns, monotonic clock) the request was completed at. */
+    u64 time_ns;
+
+    /** The time (ns) from the request being issued till completed. */
+    u64 lat_ns;
+
+    /** The first sector (LBA, 512 bytes each). */
+    u64 sector;
+
+    /** The request size in bytes. */
+    u32 bytes;
+
+    /** The operation (<code>DEVICE_TRACE_OP_*</code>). */
+    u16 op;
+
+    /** Whether the request failed. */
+    u16 error;
+};
+
+/**
+ * The structure to describe the throttling state and statistics
+ * of a dispatch list (read or write requests), guarded by the request queue
+ * spin lock. Each token bucket is kept as the time it will be full again,
+ * so that the tokens never need topping up.
+ */
+struct viosim_throttle {
+    /** The time (ns) the IOPS and bandwidth buckets will be full again. */
+    u64 iops_full_ns;
+    u64 bps_full_ns;
+
+    /** The time (ns) the request at the head of the list got held (or 0). */
+    u64 held_since_ns;
+
+    /** The number of requests held, and the total time they were held (ns). */
+    u64 throttled;
+    u64 throttled_ns;
+
+    /** The number of requests and bytes dispatched. */
+    u64 dispatched;
+    u64 bytes;
+};
+
+/**
+ * The structure to hold the dispatch and latency statistics
+ * of an I/O priority class, guarded by the request queue spin lock.
+ */
+struct viosim_prio_stats {
+    /** The number of requests waiting in the dispatch lists. */
+    u64 queued;
+
+    /** The number of requests dispatched. */
+    u64 dispatched;
+
+    /**
+     * The number of requests dispatched ahead of those of a higher class
+     * because they had waited for longer than <code>prio_aging_ms</code>.
+     */
+    u64 aged;
+
+    /** The number of requests completed, and those failed. */
+    u64 completed;
+    u64 errors;
+
+    /** The total and the max time (ns) from a request issued till completed. */
+    u64 lat_ns;
+    u64 max_lat_ns;
+
+    /**
+     * The latency histogram: bucket <code>b</code> counts requests
+     * completed in under 2^b microseconds (and no sooner than the bucket
+     * before allows).
+     */
+    u64 lat_hist[DEVICE_PRIO_LAT_BUCKETS];
+};
+
 #endif /* __LINUX__VIRTBLKIOSIM_H */
 
 /* vim:set nu et ts=4 sw=4: */
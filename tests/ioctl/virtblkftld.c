@@ -0,0 +1,829 @@
+/*
+ * tests/ioctl/virtblkftld.c
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This daemon is a reference user space page-mapped FTL (flash translation
+ * layer) serving the device through the ioctl() system call.
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#include "virtblkftld.h"
+
+/** The request mapping entries buffer. */
+static struct viosim_request_map viosim_req_map[DEVICE_REQ_MAP_ENTRIES_MAX];
+
+/** The buffers of PPNs granted and journal entries drained. */
+static struct viosim_ppn_grant     viosim_ppn_grant;
+static struct viosim_journal_batch viosim_journal_batch;
+
+/** The flag telling the daemon to stop (set on SIGINT/SIGTERM). */
+static volatile sig_atomic_t viosim_ftld_stop = 0;
+
+/** The flag telling the daemon to print stats (set on SIGALRM/SIGUSR1). */
+static volatile sig_atomic_t viosim_ftld_dump = 0;
+
+/* Helper function. Handles the signals the daemon is driven by. */
+static void _viosim_ftld_signal(const int sig) {
+    if ((sig == SIGALRM) || (sig == SIGUSR1)) {
+        viosim_ftld_dump = 1;
+    } else {
+        viosim_ftld_stop = 1;
+    }
+}
+
+/**
+ * Allocates the FTL tables for the given geometry, all pages unmapped
+ * and all blocks free.
+ *
+ * @param ftl         The FTL to initialize.
+ * @param nr_pages    The number of pages of the device.
+ * @param block_pages The number of pages per erase block.
+ * @param gc_blocks   The number of free blocks GC keeps at least.
+ *
+ * @return <code>EXIT_SUCCESS</code> or <code>EXIT_FAILURE</code>
+ *         when out of memory.
+ */
+static int viosim_ftl_init(      struct viosim_ftl *ftl,
+                           const unsigned long      nr_pages,
+                           const unsigned long      block_pages,
+                           const unsigned long      gc_blocks) {
+
+    unsigned long i;
+
+    memset(ftl, 0, sizeof(*ftl));
+
+    ftl->nr_pages       = nr_pages;
+    ftl->block_pages    = block_pages;
+    ftl->nr_blocks      = nr_pages / block_pages;
+    ftl->gc_free_blocks = gc_blocks;
+    ftl->active         = FTL_PPN_UNMAPPED;
+
+    ftl->l2p         = malloc(sizeof(*ftl->l2p)         * nr_pages);
+    ftl->p2l         = malloc(sizeof(*ftl->p2l)         * nr_pages);
+    ftl->valid       = calloc(ftl->nr_blocks, sizeof(*ftl->valid));
+    ftl->state       = calloc(ftl->nr_blocks, sizeof(*ftl->state));
+    ftl->granted     = calloc(ftl->nr_blocks, sizeof(*ftl->granted));
+    ftl->free_blocks = malloc(sizeof(*ftl->free_blocks) * ftl->nr_blocks);
+
+    if ((ftl->l2p   == NULL) || (ftl->p2l   == NULL)
+     || (ftl->valid == NULL) || (ftl->state == NULL)
+     || (ftl->granted == NULL) || (ftl->free_blocks == NULL)) {
+
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < nr_pages; i++) {
+        ftl->l2p[i] = FTL_PPN_UNMAPPED;
+        ftl->p2l[i] = FTL_PPN_UNMAPPED;
+    }
+
+    /* Pushing blocks so that block 0 gets popped first. */
+    for (i = 0; i < ftl->nr_blocks; i++) {
+        ftl->free_blocks[ftl->nr_free++] = ftl->nr_blocks - 1 - i;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Releases the FTL tables. */
+static void viosim_ftl_free(struct viosim_ftl *ftl) {
+    free(ftl->l2p);
+    free(ftl->p2l);
+    free(ftl->valid);
+    free(ftl->state);
+    free(ftl->granted);
+    free(ftl->free_blocks);
+}
+
+/**
+ * Returns the number of pages that can still be written
+ * without reclaiming any block.
+ */
+static unsigned long viosim_ftl_free_pages(const struct viosim_ftl *ftl) {
+    unsigned long pages = ftl->nr_free * ftl->block_pages;
+
+    if (ftl->active != FTL_PPN_UNMAPPED) {
+        pages += ftl->block_pages - ftl->wp;
+    }
+
+    return pages;
+}
+
+/**
+ * Allocates the next page of the active block, opening a free block
+ * when the active one is full.
+ *
+ * @return The PPN allocated or <code>FTL_PPN_UNMAPPED</code> when no free
+ *         page is left.
+ */
+static unsigned long viosim_ftl_page_alloc(struct viosim_ftl *ftl) {
+    if ((ftl->active == FTL_PPN_UNMAPPED) || (ftl->wp == ftl->block_pages)) {
+        if (ftl->active != FTL_PPN_UNMAPPED) {
+            ftl->state[ftl->active] = FTL_BLOCK_FULL;
+
+            ftl->active = FTL_PPN_UNMAPPED;
+        }
+
+        if (ftl->nr_free == 0) {
+            return FTL_PPN_UNMAPPED;
+        }
+
+        ftl->active = ftl->free_blocks[--ftl->nr_free];
+        ftl->wp     = 0;
+
+        ftl->state[ftl->active] = FTL_BLOCK_ACTIVE;
+    }
+
+    return (ftl->active * ftl->block_pages) + ftl->wp++;
+}
+
+/* Maps the LPN onto the PPN, invalidating the page it was mapped onto. */
+static void viosim_ftl_map(      struct viosim_ftl *ftl,
+                           const unsigned long      lpn,
+                           const unsigned long      ppn) {
+
+    unsigned long old_ppn = ftl->l2p[lpn];
+
+    if (old_ppn != FTL_PPN_UNMAPPED) {
+        ftl->p2l[old_ppn] = FTL_PPN_UNMAPPED;
+
+        ftl->valid[old_ppn / ftl->block_pages]--;
+    }
+
+    ftl->l2p[lpn] = ppn;
+    ftl->p2l[ppn] = lpn;
+
+    ftl->valid[ppn / ftl->block_pages]++;
+}
+
+/**
+ * Greedy garbage collection: reclaims full blocks with the fewest valid
+ * pages, relocating those through the driver, until at least
+ * <code>gc_free_blocks</code> blocks and <code>needed</code> pages are free.
+ * Runs before a request is answered, so no page it moves
+ * has a pending write.
+ *
+ * @param ftl     The FTL.
+ * @param devnode The device node file descriptor.
+ * @param needed  The number of pages the request about to be served may write.
+ *
+ * @return <code>EXIT_SUCCESS</code> or <code>EXIT_FAILURE</code>
+ *         when a relocation failed.
+ */
+static int viosim_ftl_gc(      struct viosim_ftl *ftl,
+                         const int                devnode,
+                         const unsigned long      needed) {
+
+    struct viosim_page_copy page_copy;
+    struct viosim_l2p_range l2p_range;
+
+    unsigned long victim;
+    unsigned long ppn, lpn;
+    unsigned long i;
+
+    while ((ftl->nr_free < ftl->gc_free_blocks)
+        || (viosim_ftl_free_pages(ftl) < needed)) {
+
+        victim = FTL_PPN_UNMAPPED;
+
+        for (i = 0; i < ftl->nr_blocks; i++) {
+            if ((ftl->state[i] == FTL_BLOCK_FULL) && (ftl->granted[i] == 0)
+                && ((victim == FTL_PPN_UNMAPPED)
+                    || (ftl->valid[i] < ftl->valid[victim]))) {
+
+                victim = i;
+            }
+        }
+
+        /* Nothing to gain: every full block holds only valid pages. */
+        if ((victim == FTL_PPN_UNMAPPED)
+            || (ftl->valid[victim] == ftl->block_pages)
+            || (ftl->valid[victim] > viosim_ftl_free_pages(ftl))) {
+
+            break;
+        }
+
+        for (i = 0; (i < ftl->block_pages) && (ftl->valid[victim] > 0); i++) {
+            ppn = (victim * ftl->block_pages) + i;
+            lpn = ftl->p2l[ppn];
+
+            if (lpn == FTL_PPN_UNMAPPED) {
+                continue;
+            }
+
+            page_copy.src_ppn = ppn;
+            page_copy.dst_ppn = viosim_ftl_page_alloc(ftl);
+
+            if (ioctl(devnode, DEVICE_IOCTL_COPY_PAGE, &page_copy) < 0) {
+                fprintf(stderr, _FTLD_COPY_PAGE_FAILED_ERR _NEW_LINE,
+                        _FTLD_APP_NAME, page_copy.src_ppn,
+                        page_copy.dst_ppn, strerror(errno));
+
+                return EXIT_FAILURE;
+            }
+
+            viosim_ftl_map(ftl, lpn, page_copy.dst_ppn);
+
+            /* The kernel may have cached the page's old location. */
+            l2p_range.lpn      = lpn;
+            l2p_range.nr_pages = 1;
+
+            if (ioctl(devnode, DEVICE_IOCTL_INVALIDATE_L2P, &l2p_range) < 0) {
+                fprintf(stderr, _FTLD_INVALIDATE_L2P_FAILED_ERR _NEW_LINE,
+                        _FTLD_APP_NAME, lpn, strerror(errno));
+
+                return EXIT_FAILURE;
+            }
+
+            ftl->gc_writes++;
+        }
+
+        /* Erasing the victim. */
+        ftl->state[victim] = FTL_BLOCK_FREE;
+
+        ftl->free_blocks[ftl->nr_free++] = victim;
+
+        ftl->erases++;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Answers a request: reads are pointed at the pages their LPNs are mapped
+ * onto, writes go out of place to newly allocated pages (reading the old
+ * page for the driver's read-modify-write).
+ *
+ * @param ftl      The FTL.
+ * @param req_map  The request mapping entries to fill in.
+ * @param req_size The number of entries.
+ */
+static void viosim_ftl_serve(      struct viosim_ftl         *ftl,
+                                   struct viosim_request_map *req_map,
+                             const unsigned long              req_size) {
+
+    struct viosim_page_map *page_map;
+
+    unsigned long ppnx;
+    unsigned long i;
+
+    for (i = 0; i < req_size; i++) {
+        page_map = &req_map[i].page_map;
+
+        /* Leaving the kernel's identity mapping for out-of-range LPNs. */
+        if (page_map->lpn >= ftl->nr_pages) {
+            continue;
+        }
+
+        page_map->ppn = ftl->l2p[page_map->lpn];
+
+        if (page_map->transf_dir == 0) {
+            ftl->reads++;
+
+            continue;
+        }
+
+        ftl->host_writes++;
+
+        ppnx = viosim_ftl_page_alloc(ftl);
+
+        if (ppnx == FTL_PPN_UNMAPPED) {
+            /*
+             * Out of space: overwriting in place, or else answering
+             * unmapped (the driver fails the write with ENOSPC).
+             */
+            page_map->ppnx = page_map->ppn;
+
+            if (page_map->ppn == FTL_PPN_UNMAPPED) {
+                ftl->failed_writes++;
+            } else {
+                ftl->inplace_writes++;
+            }
+
+            continue;
+        }
+
+        page_map->ppnx = ppnx;
+
+        viosim_ftl_map(ftl, page_map->lpn, ppnx);
+    }
+}
+
+/**
+ * Tops the pages granted to the driver up to <code>async_pages</code>
+ * (as long as there are free pages left after GC).
+ *
+ * @param ftl     The FTL.
+ * @param devnode The device node file descriptor.
+ *
+ * @return <code>EXIT_SUCCESS</code> or <code>EXIT_FAILURE</code>
+ *         when the pages couldn't be granted.
+ */
+static int viosim_ftl_grant(struct viosim_ftl *ftl, const int devnode) {
+    unsigned long ppn;
+    unsigned long i;
+
+    while (ftl->nr_granted < ftl->async_pages) {
+        viosim_ppn_grant.nr_ppns = 0;
+
+        if (viosim_ftl_gc(ftl, devnode, DEVICE_PPN_BATCH_MAX)
+            != EXIT_SUCCESS) {
+
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; (i < DEVICE_PPN_BATCH_MAX)
+            && (ftl->nr_granted + i < ftl->async_pages); i++) {
+
+            ppn = viosim_ftl_page_alloc(ftl);
+
+            if (ppn == FTL_PPN_UNMAPPED) {
+                break;
+            }
+
+            viosim_ppn_grant.ppns[viosim_ppn_grant.nr_ppns++] = ppn;
+
+            ftl->granted[ppn / ftl->block_pages]++;
+        }
+
+        /* Out of space: the driver forwards the writes it can't place. */
+        if (viosim_ppn_grant.nr_ppns == 0) {
+            break;
+        }
+
+        if (ioctl(devnode, DEVICE_IOCTL_GRANT_PPNS, &viosim_ppn_grant) < 0) {
+            if (errno != EOPNOTSUPP) {
+                fprintf(stderr, _FTLD_GRANT_PPNS_FAILED_ERR _NEW_LINE,
+                        _FTLD_APP_NAME, strerror(errno));
+
+                return EXIT_FAILURE;
+            }
+
+            printf(_FTLD_ASYNC_OFF_MSG _NEW_LINE, _FTLD_APP_NAME);
+
+            /* The pages allocated are never written: left for GC. */
+            for (i = 0; i < viosim_ppn_grant.nr_ppns; i++) {
+                ftl->granted[viosim_ppn_grant.ppns[i] / ftl->block_pages]--;
+            }
+
+            ftl->async_pages = 0;
+
+            break;
+        }
+
+        ftl->nr_granted += viosim_ppn_grant.nr_ppns;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Drains the journal of writes the driver has placed to the pages granted,
+ * mapping their LPNs onto those.
+ *
+ * @param ftl     The FTL.
+ * @param devnode The device node file descriptor.
+ *
+ * @return <code>EXIT_SUCCESS</code> or <code>EXIT_FAILURE</code>
+ *         when the journal couldn't be drained.
+ */
+static int viosim_ftl_drain(struct viosim_ftl *ftl, const int devnode) {
+    struct viosim_journal_entry *entry;
+
+    unsigned long i;
+
+    do {
+        if (ioctl(devnode, DEVICE_IOCTL_DRAIN_JOURNAL,
+                           &viosim_journal_batch) < 0) {
+
+            fprintf(stderr, _FTLD_DRAIN_JOURNAL_FAILED_ERR _NEW_LINE,
+                    _FTLD_APP_NAME, strerror(errno));
+
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < viosim_journal_batch.nr_entries; i++) {
+            entry = &viosim_journal_batch.entries[i];
+
+            /* Left by a previous FTL: its pages aren't known here. */
+            if ((entry->lpn >= ftl->nr_pages)
+                || (entry->ppn >= ftl->nr_blocks * ftl->block_pages)
+                || (ftl->granted[entry->ppn / ftl->block_pages] == 0)) {
+
+                continue;
+            }
+
+            ftl->granted[entry->ppn / ftl->block_pages]--;
+            ftl->nr_granted--;
+
+            viosim_ftl_map(ftl, entry->lpn, entry->ppn);
+
+            ftl->host_writes++;
+            ftl->async_writes++;
+        }
+    } while (viosim_journal_batch.nr_entries == DEVICE_PPN_BATCH_MAX);
+
+    return EXIT_SUCCESS;
+}
+
+/* Prints the FTL stats. */
+static void viosim_ftl_stats_print(const struct viosim_ftl *ftl) {
+    unsigned long valid = 0UL;
+    unsigned long i;
+
+    for (i = 0; i < ftl->nr_blocks; i++) {
+        valid += ftl->valid[i];
+    }
+
+    printf(_FTLD_STATS_MSG _NEW_LINE,
+           ftl->reads, ftl->host_writes, ftl->gc_writes,
+           (ftl->host_writes > 0UL)
+               ? ((double) (ftl->host_writes + ftl->gc_writes)
+                         /  ftl->host_writes) : 0.0,
+           ftl->erases, ftl->nr_free, valid,
+           ftl->inplace_writes, ftl->failed_writes, ftl->async_writes);
+
+    fflush(stdout);
+}
+
+/**
+ * Serves the next request handed to the FTL (waiting for one to arrive
+ * unless the device is opened non-blocking).
+ *
+ * @param devnode  The device node file descriptor.
+ * @param ftl      The FTL.
+ * @param app_name The name of the application executable.
+ *
+ * @return <code>FTL_SERVE_DONE</code> when a request has been served
+ *         (or is gone), <code>FTL_SERVE_IDLE</code> when there is none
+ *         (or a signal has come), <code>FTL_SERVE_FAILED</code> on error.
+ */
+static int viosim_ftld_serve_next(const int                devnode,
+                                        struct viosim_ftl *ftl,
+                                  const char              *app_name) {
+
+    unsigned long req_size;
+
+    /* Sizing... (blocks until a request arrives, unless non-blocking) */
+    if (ioctl(devnode, DEVICE_IOCTL_GET_REQUEST_SIZE, &req_size) < 0) {
+        if ((errno == EINTR) || (errno == EAGAIN)) {
+            return FTL_SERVE_IDLE;
+        }
+
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return FTL_SERVE_FAILED;
+    }
+
+    /* Reading... */
+    if (ioctl(devnode, DEVICE_IOCTL_GET_BLOCK, viosim_req_map) < 0) {
+        if ((errno == EINTR) || (errno == EAGAIN)) {
+            return FTL_SERVE_DONE;
+        }
+
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return FTL_SERVE_FAILED;
+    }
+
+    if (req_size > DEVICE_REQ_MAP_ENTRIES_MAX) {
+        req_size = DEVICE_REQ_MAP_ENTRIES_MAX;
+    }
+
+    /*
+     * Taking in the writes the driver has placed first: those done
+     * before the request was issued have to be in the answer.
+     */
+    if ((ftl->async_pages > 0)
+        && (viosim_ftl_drain(ftl, devnode) != EXIT_SUCCESS)) {
+
+        return FTL_SERVE_FAILED;
+    }
+
+    /* Making room for the request's writes first. */
+    if (viosim_ftl_gc(ftl, devnode, req_size) != EXIT_SUCCESS) {
+        return FTL_SERVE_FAILED;
+    }
+
+    viosim_ftl_serve(ftl, viosim_req_map, req_size);
+
+    /* Writing... */
+    if (ioctl(devnode, DEVICE_IOCTL_SET_BLOCK, viosim_req_map) < 0) {
+        if (errno == EINVAL) {
+            return FTL_SERVE_DONE; /* <== The request is gone already. */
+        }
+
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return FTL_SERVE_FAILED;
+    }
+
+    /* The request has come most likely for lack of pages granted. */
+    if (viosim_ftl_grant(ftl, devnode) != EXIT_SUCCESS) {
+        return FTL_SERVE_FAILED;
+    }
+
+    return FTL_SERVE_DONE;
+}
+
+/**
+ * Sets up the eventfd the driver signals whenever a request is queued,
+ * and an epoll instance watching it.
+ *
+ * @param devnode  The device node file descriptor (opened non-blocking).
+ * @param evfd     The eventfd file descriptor (returned).
+ * @param app_name The name of the application executable.
+ *
+ * @return The epoll file descriptor, or <code>-1</code> on error.
+ */
+static int viosim_ftld_epoll_init(const int   devnode,
+                                        int  *evfd,
+                                  const char *app_name) {
+
+    struct epoll_event ev;
+
+    int epfd;
+
+    *evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epfd  = epoll_create1(EPOLL_CLOEXEC);
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events  = EPOLLIN;
+    ev.data.fd = *evfd;
+
+    if ((*evfd < 0) || (epfd < 0)
+        || (epoll_ctl(epfd, EPOLL_CTL_ADD, *evfd, &ev) < 0)
+        || (ioctl(devnode, DEVICE_IOCTL_SET_EVENTFD, evfd) < 0)) {
+
+        fprintf(stderr, _FTLD_EVENTFD_FAILED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        if (*evfd >= 0) {
+            close(*evfd);
+        }
+
+        if (epfd >= 0) {
+            close(epfd);
+        }
+
+        return -1;
+    }
+
+    return epfd;
+}
+
+/**
+ * Serves the device as the FTL until stopped.
+ *
+ * @param devnode  The device node file descriptor.
+ * @param ftl      The FTL.
+ * @param interval The stats printing interval in seconds (<code>0</code>
+ *                 &ndash; only on SIGUSR1 and on exit).
+ * @param evloop   Whether to serve out of an epoll event loop (the device
+ *                 node is then opened non-blocking).
+ * @param app_name The name of the application executable.
+ *
+ * @return The exit code indicating the daemon execution status.
+ */
+static int viosim_ftld_run(const int                devnode,
+                                 struct viosim_ftl *ftl,
+                           const unsigned           interval,
+                           const bool               evloop,
+                           const char              *app_name) {
+
+    int ret = EXIT_SUCCESS;
+
+    struct epoll_event ev;
+
+    uint64_t events;
+
+    int epfd = -1;
+    int evfd = -1;
+    int served;
+
+    /* Registering... */
+    if (ioctl(devnode, DEVICE_IOCTL_REG_USER_CALLER, 0) < 0) {
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    if (evloop) {
+        epfd = viosim_ftld_epoll_init(devnode, &evfd, app_name);
+
+        if (epfd < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Dropping what a previous FTL has left, then granting pages. */
+    if ((viosim_ftl_drain(ftl, devnode) != EXIT_SUCCESS)
+        || (viosim_ftl_grant(ftl, devnode) != EXIT_SUCCESS)) {
+
+        ret = EXIT_FAILURE;
+    }
+
+    alarm(interval);
+
+    /* Stop on <Ctrl+C> or SIGTERM. */
+    while ((ret == EXIT_SUCCESS) && !viosim_ftld_stop) {
+        if (viosim_ftld_dump) {
+            viosim_ftld_dump = 0;
+
+            viosim_ftl_stats_print(ftl);
+
+            alarm(interval);
+        }
+
+        if (!evloop) {
+            served = viosim_ftld_serve_next(devnode, ftl, app_name);
+        } else {
+            /* Waiting for requests to be queued (or a signal to come). */
+            if (epoll_wait(epfd, &ev, 1, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                fprintf(stderr, _FTLD_EVENTFD_FAILED_ERR _NEW_LINE,
+                        app_name, strerror(errno));
+
+                ret = EXIT_FAILURE;
+
+                break;
+            }
+
+            /* Resetting the event counter, then serving all pending. */
+            if (read(evfd, &events, sizeof(events)) < 0) {
+                events = 0;
+            }
+
+            do {
+                served = viosim_ftld_serve_next(devnode, ftl, app_name);
+            } while ((served == FTL_SERVE_DONE) && !viosim_ftld_stop);
+        }
+
+        if (served == FTL_SERVE_FAILED) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (evloop) {
+        close(epfd);
+        close(evfd);
+    }
+
+    viosim_ftl_stats_print(ftl);
+
+    return ret;
+}
+
+/* The application entry point. */
+int main(int argc, char *const *argv) {
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_ftl ftl;
+    struct sigaction  sa;
+
+    unsigned long block_pages = FTL_PAGES_PER_BLOCK_DEF;
+    unsigned long gc_blocks   = FTL_GC_FREE_BLOCKS_DEF;
+    unsigned      interval    = FTL_STATS_INTERVAL_DEF;
+    unsigned long async_pages = FTL_ASYNC_PAGES_DEF;
+    bool          evloop      = false;
+
+    uint64_t dev_size;
+
+    int devnode;
+    int i;
+
+    if ((argc < 2) || (argv[1][0] == '-')) {
+        fprintf(stderr, _FTLD_USAGE_MSG _NEW_LINE);
+
+        return EXIT_FAILURE;
+    }
+
+    /* Parsing options following the device node. */
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], _PRINT_BANNER_OPT) == 0) {
+            printf(_FTLD_APP_NAME   _COMMA_SPACE_SEP                         \
+                   _APP_VERSION_S__ _ONE_SPACE_STRING _APP_VERSION _NEW_LINE \
+                   _FTLD_APP_DESCRIPTION                           _NEW_LINE \
+                   _APP_COPYRIGHT__ _ONE_SPACE_STRING _APP_AUTHOR  _NEW_LINE);
+        } else if ((strcmp(argv[i], _FTLD_BLOCK_PAGES_OPT) == 0)
+                   && (i + 1 < argc)) {
+
+            block_pages = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], _FTLD_GC_BLOCKS_OPT)   == 0)
+                   && (i + 1 < argc)) {
+
+            gc_blocks   = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], _FTLD_STATS_OPT)       == 0)
+                   && (i + 1 < argc)) {
+
+            interval    = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], _FTLD_ASYNC_OPT)       == 0)
+                   && (i + 1 < argc)) {
+
+            async_pages = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], _FTLD_EVLOOP_OPT) == 0) {
+            evloop      = true;
+        } else {
+            fprintf(stderr, _CLI_OPTION_INVALID_ERR _NEW_LINE,
+                    argv[0], argv[i]);
+
+            fprintf(stderr, _FTLD_USAGE_MSG _NEW_LINE);
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (gc_blocks == 0) {
+        gc_blocks = 1;
+    }
+
+    if (async_pages > FTL_ASYNC_PAGES_MAX) {
+        async_pages = FTL_ASYNC_PAGES_MAX;
+    }
+
+    devnode = open(argv[1], evloop ? (O_RDWR | O_NONBLOCK) : O_RDWR);
+
+    if (devnode < 0) {
+        fprintf(stderr, _DEVNODE_OPEN_FAILED_ERR _NEW_LINE,
+                argv[0], strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    if (ioctl(devnode, BLKGETSIZE64, &dev_size) < 0) {
+        fprintf(stderr, _FTLD_DEVSIZE_FAILED_ERR _NEW_LINE,
+                argv[0], strerror(errno));
+
+        close(devnode);
+
+        return EXIT_FAILURE;
+    }
+
+    /* GC needs at least one block to reclaim besides the free ones. */
+    if ((block_pages == 0)
+        || ((dev_size / DEVICE_PAGE_SIZE) / block_pages <= gc_blocks)) {
+
+        fprintf(stderr, _FTLD_GEOMETRY_INVALID_ERR _NEW_LINE,
+                argv[0], (unsigned long) (dev_size / DEVICE_PAGE_SIZE),
+                block_pages);
+
+        close(devnode);
+
+        return EXIT_FAILURE;
+    }
+
+    if (viosim_ftl_init(&ftl, dev_size / DEVICE_PAGE_SIZE,
+                        block_pages, gc_blocks) != EXIT_SUCCESS) {
+
+        fprintf(stderr, _FTLD_ALLOC_FAILED_ERR _NEW_LINE, argv[0]);
+
+        viosim_ftl_free(&ftl);
+
+        close(devnode);
+
+        return EXIT_FAILURE;
+    }
+
+    ftl.async_pages = async_pages;
+
+    printf(_FTLD_GEOMETRY_MSG _NEW_LINE, argv[0],
+           ftl.nr_pages, ftl.nr_blocks, ftl.block_pages, ftl.gc_free_blocks);
+
+    /* No SA_RESTART: signals have to break the blocking ioctl() calls. */
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sa_handler = _viosim_ftld_signal;
+
+    sigemptyset(&sa.sa_mask);
+
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGALRM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    ret = viosim_ftld_run(devnode, &ftl, interval, evloop, argv[0]);
+
+    viosim_ftl_free(&ftl);
+
+    if (close(devnode) < 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+/* vim:set nu et ts=4 sw=4: */
@@ -0,0 +1,198 @@
+/*
+ * tests/ioctl/virtblkftld.h
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This daemon is a reference user space page-mapped FTL (flash translation
+ * layer) serving the device through the ioctl() system call.
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#ifndef __VIRTBLKFTLD_H
+#define __VIRTBLKFTLD_H
+
+#include "virtblkioctl.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <linux/fs.h> /* <== Needs to use BLKGETSIZE64 in ioctl(). */
+
+/* Daemon name banner. */
+#define _FTLD_APP_NAME        "VIRTual BLocK FTL Daemon (virtblkftld)"
+#define _FTLD_APP_DESCRIPTION \
+         "Serves the device as a page-mapped FTL through the ioctl() system call"
+
+/** Constants: The daemon's command line options. */
+#define _FTLD_BLOCK_PAGES_OPT "-b"
+#define _FTLD_GC_BLOCKS_OPT   "-g"
+#define _FTLD_STATS_OPT       "-s"
+#define _FTLD_ASYNC_OPT       "-a"
+#define _FTLD_EVLOOP_OPT      "-e"
+
+/** Constant: Print this usage info when the args passed are wrong. */
+#define _FTLD_USAGE_MSG \
+         "Usage: virtblkftld <device_node> [options]"                                 _NEW_LINE \
+                                                                                      _NEW_LINE \
+         "       <device_node>       Something like " _DEVNODE_HUB _MODULE_NAME       _NEW_LINE \
+                                                                                      _NEW_LINE \
+         "       [options]           Any of the following:"                           _NEW_LINE \
+         "           -V              Print the app banner"                            _NEW_LINE \
+         "           -b <pages>      Pages per erase block (default: 256)"            _NEW_LINE \
+         "           -g <blocks>     Free blocks to keep by GC (default: 2)"          _NEW_LINE \
+         "           -s <seconds>    Print stats that often (default: 10; 0 - only"   _NEW_LINE \
+         "                           on exit and on SIGUSR1)"                         _NEW_LINE \
+         "           -a <pages>      Keep that many pages granted to the driver"      _NEW_LINE \
+         "                           to place writes to (default: 0 - none; needs"    _NEW_LINE \
+         "                           the driver loaded with async_writes=1)"          _NEW_LINE \
+         "           -e              Serve out of an epoll event loop, signaled"      _NEW_LINE \
+         "                           through an eventfd, with non-blocking calls"     _NEW_LINE
+
+/** Constant: Print this when getting the device size failed. */
+#define _FTLD_DEVSIZE_FAILED_ERR "%s: Cannot get device size: %s"
+
+/** Constant: Print this when the device is smaller than one erase block. */
+#define _FTLD_GEOMETRY_INVALID_ERR \
+         "%s: Device of %lu pages cannot hold blocks of %lu pages"
+
+/** Constant: Print this when the FTL tables cannot be allocated. */
+#define _FTLD_ALLOC_FAILED_ERR "%s: Cannot allocate FTL tables"
+
+/** Constant: Print this when a GC page relocation failed. */
+#define _FTLD_COPY_PAGE_FAILED_ERR "%s: Cannot relocate page %lu to %lu: %s"
+
+/** Constant: Print this when the kernel L2P cache couldn't be invalidated. */
+#define _FTLD_INVALIDATE_L2P_FAILED_ERR \
+         "%s: Cannot invalidate cached mapping of page %lu: %s"
+
+/** Constant: Print this when granting pages to the driver failed. */
+#define _FTLD_GRANT_PPNS_FAILED_ERR "%s: Cannot grant pages to the driver: %s"
+
+/** Constant: Print this when draining the driver's journal failed. */
+#define _FTLD_DRAIN_JOURNAL_FAILED_ERR \
+         "%s: Cannot drain the journal of writes placed by the driver: %s"
+
+/** Constant: Print this when the driver doesn't place writes on its own. */
+#define _FTLD_ASYNC_OFF_MSG \
+         "%s: The driver is not loaded with async_writes=1, serving all writes"
+
+/** Constant: Print this when the event loop can't be set up or run. */
+#define _FTLD_EVENTFD_FAILED_ERR "%s: Cannot wait for requests: %s"
+
+/** Constant: Print this once the FTL starts serving the device. */
+#define _FTLD_GEOMETRY_MSG \
+         "%s: Serving %lu pages as %lu blocks of %lu pages " \
+         "(GC keeps %lu free)"
+
+/** Constant: Print this as the FTL stats line. */
+#define _FTLD_STATS_MSG                                           \
+         "Reads: %lu | Host writes: %lu | GC writes: %lu"         \
+         " | WA: %.3f | Erases: %lu | Free blocks: %lu"           \
+         " | Valid pages: %lu | In-place: %lu | Failed: %lu"      \
+         " | Async: %lu"
+
+/** Constant: The device page size (as used by the driver). */
+#define DEVICE_PAGE_SIZE 4096
+
+/** Constants: The FTL defaults. */
+#define FTL_PAGES_PER_BLOCK_DEF  256
+#define FTL_GC_FREE_BLOCKS_DEF     2
+#define FTL_STATS_INTERVAL_DEF    10
+#define FTL_ASYNC_PAGES_DEF        0
+
+/** Constants: What serving the next request has come to. */
+#define FTL_SERVE_DONE   0
+#define FTL_SERVE_IDLE   1
+#define FTL_SERVE_FAILED 2
+
+/**
+ * Constant: The max number of pages kept granted to the driver
+ *           (the capacity of its pool).
+ */
+#define FTL_ASYNC_PAGES_MAX     1024
+
+/**
+ * Constant: The PPN of a page that has no mapping. The driver reads zeros
+ *           from such a page and drops writes to it.
+ */
+#define FTL_PPN_UNMAPPED (~0UL)
+
+/** Constants: The erase block states. */
+#define FTL_BLOCK_FREE   0
+#define FTL_BLOCK_ACTIVE 1
+#define FTL_BLOCK_FULL   2
+
+/** The structure to hold the FTL tables and stats. */
+struct viosim_ftl {
+    /** The number of logical (and physical) pages of the device. */
+    unsigned long nr_pages;
+
+    /** The number of pages per erase block. */
+    unsigned long block_pages;
+
+    /** The number of erase blocks (trailing pages that don't fit unused). */
+    unsigned long nr_blocks;
+
+    /** The number of free blocks GC keeps at least. */
+    unsigned long gc_free_blocks;
+
+    /** The L2P table: LPN to PPN. */
+    unsigned long *l2p;
+
+    /** The P2L table: PPN to LPN (to find the owners of pages on GC). */
+    unsigned long *p2l;
+
+    /** The number of valid pages in each block. */
+    unsigned long *valid;
+
+    /** The state of each block. */
+    unsigned char *state;
+
+    /**
+     * The number of pages of each block granted to the driver and not yet
+     * journaled as written (such blocks are not reclaimed).
+     */
+    unsigned long *granted;
+
+    /** The free block stack. */
+    unsigned long *free_blocks;
+    unsigned long  nr_free;
+
+    /** The number of pages to keep granted to the driver, and granted. */
+    unsigned long async_pages;
+    unsigned long nr_granted;
+
+    /** The block being written and its write pointer. */
+    unsigned long active;
+    unsigned long wp;
+
+    /** The page reads served. */
+    unsigned long reads;
+
+    /** The page writes issued by the host. */
+    unsigned long host_writes;
+
+    /** The page writes issued by GC (relocations). */
+    unsigned long gc_writes;
+
+    /** The blocks reclaimed (erased) by GC. */
+    unsigned long erases;
+
+    /** The writes done in place because no free page was left. */
+    unsigned long inplace_writes;
+
+    /** The writes failed because neither a free nor an old page existed. */
+    unsigned long failed_writes;
+
+    /** The page writes placed by the driver on its own (of host writes). */
+    unsigned long async_writes;
+};
+
+#endif /* __VIRTBLKFTLD_H */
+
+/* vim:set nu et ts=4 sw=4: */
@@ -14,10 +14,52 @@
 
 #include "virtblkioctl.h"
 
-static struct viosim_request_map viosim_req_map;
+static struct viosim_request_map viosim_req_map[DEVICE_REQ_MAP_ENTRIES_MAX];
 
 static uintptr_t viosim_req_size = 0U;
 
+/** The command line options (see <code>_CLI_USAGE_MSG</code>). */
+static struct viosim_opts viosim_opts = { false, 1U, 0U };
+
+/** The flag telling benchmark threads to stop (set on <Ctrl+C>). */
+static volatile sig_atomic_t viosim_bench_stop = 0;
+
+/**
+ * The number of I/O operations left for benchmark threads to perform
+ * (when limited).
+ */
+static long viosim_bench_ops_left = 0L;
+
+/**
+ * The structure to hold a benchmark thread's state and results.
+ * (Local to this file: it is only shared with the threads themselves.)
+ */
+struct viosim_bench_thread {
+    /** The thread itself. */
+    pthread_t thread;
+
+    /** The device node file descriptor. */
+    int devnode;
+
+    /** The deadline (<code>CLOCK_MONOTONIC</code>, ns; 0 &ndash; none). */
+    unsigned long deadline;
+
+    /** The number of I/O operations performed. */
+    unsigned long ops;
+
+    /** The number of failed <code>ioctl()</code> calls. */
+    unsigned long errors;
+
+    /** The number of requests gone (timed out) before answered. */
+    unsigned long withdrawn;
+
+    /** The per-stage latency histograms. */
+    struct viosim_hist hist[VIOSIM_STAGES];
+
+    /** The request mapping entries buffer. */
+    struct viosim_request_map req_map[DEVICE_REQ_MAP_ENTRIES_MAX];
+};
+
 /**
  * Makes <code>ioctl()</code> calls against the device.
  *
@@ -125,6 +167,56 @@ int viosim_ioctl_test(const char *viosim_devnode,
              */
             argp    = malloc(sizeof(struct viosim_request_map)
                                          * viosim_req_size);
+        } else if (strcmp(viosim_ioctl, _DEVICE_IOCTL_BENCH_IO)         == 0) {
+            /* Benchmarking I/O operations from several threads. */
+            viosim_bench_io(fd, viosim_req_size, app_name);
+
+            /* Normally closing the device node after ioctl'ing it. */
+            ret = _viosim_devnode_close(fd, app_name);
+
+            return ret;
+        } else if (strcmp(viosim_ioctl, _DEVICE_IOCTL_BATCH_IO)         == 0) {
+            /* Fetching and answering requests a batch at a time. */
+            ret = viosim_batch_io(fd, viosim_req_size, app_name);
+
+            if (_viosim_devnode_close(fd, app_name) != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+            }
+
+            return ret;
+        } else if ((strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_TAKE)     == 0)
+                || (strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_CLONE)    == 0)
+                || (strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_ROLLBACK) == 0)
+                || (strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_DROP)     == 0)) {
+
+            /* The slot(s) are passed as the request size. */
+            if (strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_TAKE) == 0) {
+                request = DEVICE_IOCTL_SNAP_TAKE;
+            } else if (strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_CLONE) == 0) {
+                request = DEVICE_IOCTL_SNAP_CLONE;
+            } else if (strcmp(viosim_ioctl, _DEVICE_IOCTL_SNAP_ROLLBACK)
+                                                                      == 0) {
+                request = DEVICE_IOCTL_SNAP_ROLLBACK;
+            } else {
+                request = DEVICE_IOCTL_SNAP_DROP;
+            }
+
+            ret = viosim_snap(fd, request, viosim_rq_sz, app_name);
+
+            if (_viosim_devnode_close(fd, app_name) != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+            }
+
+            return ret;
+        } else if (strcmp(viosim_ioctl, _DEVICE_IOCTL_MAP_STAT)         == 0) {
+            /* The mapping is exported through a device node of its own. */
+            ret = viosim_map_stat(viosim_req_size, app_name);
+
+            if (_viosim_devnode_close(fd, app_name) != EXIT_SUCCESS) {
+                ret = EXIT_FAILURE;
+            }
+
+            return ret;
         } else if (strcmp(viosim_ioctl, _DEVICE_IOCTL_PERF_IO)          == 0) {
             num_of_io_ops = viosim_req_size;
 
@@ -214,9 +306,11 @@ int viosim_perf_io(const int       viosim_devnode,
     int ret = EXIT_SUCCESS;
 
     unsigned i;
+    unsigned long j;
 
     /* Registering... */
-    ret = ioctl(viosim_devnode, DEVICE_IOCTL_REG_USER_CALLER, 0);
+    ret = ioctl(viosim_devnode, DEVICE_IOCTL_REG_USER_CALLER,
+                DEVICE_REG_FLAG_IDENTITY);
 
     if (ret < 0) {
         fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
@@ -227,7 +321,10 @@ int viosim_perf_io(const int       viosim_devnode,
         return ret;
     }
 
-    printf(_IOCTL_CALL_REG_USER_CALLER_RESULT_MSG _NEW_LINE, viosim_ioctl);
+    if (!viosim_opts.quiet) {
+        printf(_IOCTL_CALL_REG_USER_CALLER_RESULT_MSG _NEW_LINE,
+               viosim_ioctl);
+    }
 
     /* Defining the number of I/O operations (iterations). */
     if (num_of_io_ops != 0) {
@@ -251,12 +348,14 @@ int viosim_perf_io(const int       viosim_devnode,
             return ret;
         }
 
-        printf(_IOCTL_CALL_IO_GET_REQUEST_SIZE_RESULT_MSG _NEW_LINE,
-               &viosim_req_size);
+        if (!viosim_opts.quiet) {
+            printf(_IOCTL_CALL_IO_GET_REQUEST_SIZE_RESULT_MSG _NEW_LINE,
+                   &viosim_req_size);
+        }
 
         /* Reading... */
         ret = ioctl(viosim_devnode, DEVICE_IOCTL_GET_BLOCK,
-            &viosim_req_map);
+            viosim_req_map);
 
         if (ret < 0) {
             fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
@@ -267,18 +366,25 @@ int viosim_perf_io(const int       viosim_devnode,
             return ret;
         }
 
-        printf(_IOCTL_CALL_IO_GET_BLOCK_RESULT_MSG _NEW_LINE,
-               viosim_req_map.page_map.transf_dir,
-               viosim_req_map.start_sector,
-               viosim_req_map.num_of_sectors,
-               viosim_req_map.req_buffer);
+        if (!viosim_opts.quiet) {
+            printf(_IOCTL_CALL_IO_GET_BLOCK_RESULT_MSG _NEW_LINE,
+                   viosim_req_map[0].page_map.transf_dir,
+                   viosim_req_map[0].start_sector,
+                   viosim_req_map[0].num_of_sectors,
+                   viosim_req_map[0].req_buffer);
+        }
 
-        /* Converting LPN to PPN. */
-        viosim_req_map.page_map.ppn = viosim_req_map.page_map.lpn;
+        /* Converting LPN to PPN (and to the new PPN for writes). */
+        for (j = 0; (j < viosim_req_size)
+                 && (j < DEVICE_REQ_MAP_ENTRIES_MAX); j++) {
+
+            viosim_req_map[j].page_map.ppn  = viosim_req_map[j].page_map.lpn;
+            viosim_req_map[j].page_map.ppnx = viosim_req_map[j].page_map.lpn;
+        }
 
         /* Writing... */
         ret = ioctl(viosim_devnode, DEVICE_IOCTL_SET_BLOCK,
-            &viosim_req_map);
+            viosim_req_map);
 
         if (ret < 0) {
             fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
@@ -289,12 +395,14 @@ int viosim_perf_io(const int       viosim_devnode,
             return ret;
         }
 
-        printf(_IOCTL_CALL_IO_SET_BLOCK_RESULT_MSG _NEW_LINE,
-               viosim_req_map.page_map.transf_dir,
-               viosim_req_map.page_map.ppn,
-               viosim_req_map.start_sector,
-               viosim_req_map.num_of_sectors,
-               viosim_req_map.req_buffer);
+        if (!viosim_opts.quiet) {
+            printf(_IOCTL_CALL_IO_SET_BLOCK_RESULT_MSG _NEW_LINE,
+                   viosim_req_map[0].page_map.transf_dir,
+                   viosim_req_map[0].page_map.ppn,
+                   viosim_req_map[0].start_sector,
+                   viosim_req_map[0].num_of_sectors,
+                   viosim_req_map[0].req_buffer);
+        }
 
         if (num_of_io_ops != 0) {
             i--;
@@ -304,6 +412,658 @@ int viosim_perf_io(const int       viosim_devnode,
     return ret;
 }
 
+/* Helper function. Gets the CLOCK_MONOTONIC time in nanoseconds. */
+static unsigned long _viosim_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/* Helper function. Gets the latency histogram bucket for a value. */
+static unsigned _viosim_hist_bucket(const unsigned long value) {
+    unsigned msb;
+
+    if (value < VIOSIM_HIST_SUB) {
+        return value;
+    }
+
+    msb = (sizeof(long) * 8 - 1) - __builtin_clzl(value);
+
+    return ((msb - VIOSIM_HIST_SUB_BITS + 1) << VIOSIM_HIST_SUB_BITS)
+         + ((value >> (msb - VIOSIM_HIST_SUB_BITS)) - VIOSIM_HIST_SUB);
+}
+
+/* Helper function. Gets the value in the middle of a histogram bucket. */
+static unsigned long _viosim_hist_value(const unsigned bucket) {
+    unsigned      shift;
+    unsigned long lower;
+
+    /* The first two powers of two are recorded exactly. */
+    if (bucket < (VIOSIM_HIST_SUB * 2)) {
+        return bucket;
+    }
+
+    shift = (bucket >> VIOSIM_HIST_SUB_BITS) - 1;
+    lower = (unsigned long) ((bucket & (VIOSIM_HIST_SUB - 1))
+                                     +  VIOSIM_HIST_SUB) << shift;
+
+    return lower + ((1UL << shift) >> 1);
+}
+
+/* Helper function. Records a value into a latency histogram. */
+static void _viosim_hist_record(struct viosim_hist *hist,
+                                const unsigned long value) {
+
+    hist->counts[_viosim_hist_bucket(value)]++;
+    hist->total++;
+    hist->sum += value;
+
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+/* Helper function. Merges a latency histogram into another one. */
+static void _viosim_hist_merge(      struct viosim_hist *dst,
+                               const struct viosim_hist *src) {
+
+    unsigned i;
+
+    for (i = 0; i < VIOSIM_HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+
+    dst->total += src->total;
+    dst->sum   += src->sum;
+
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/* Helper function. Gets the given percentile of a latency histogram. */
+static unsigned long _viosim_hist_percentile(const struct viosim_hist *hist,
+                                             const double percentile) {
+
+    unsigned long rank = (unsigned long) ((hist->total * percentile) / 100.0);
+    unsigned long seen = 0UL;
+
+    unsigned i;
+
+    if (rank == 0UL) {
+        rank = 1UL;
+    }
+
+    for (i = 0; i < VIOSIM_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+
+        if (seen >= rank) {
+            /* Never reporting more than what was actually seen. */
+            return (_viosim_hist_value(i) < hist->max)
+                  ? _viosim_hist_value(i) : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+/* Helper function. Stops benchmark threads on <Ctrl+C>. */
+static void _viosim_bench_sigint(const int sig) {
+    viosim_bench_stop = 1;
+}
+
+/**
+ * Performs I/O (read/write) operations in a benchmark thread, timing each
+ * <code>ioctl()</code> stage, until the operations are exhausted,
+ * the deadline is reached, or <Ctrl+C> is pressed.
+ *
+ * @param arg The <code>viosim_bench_thread</code> structure to run with.
+ *
+ * @return Always <code>NULL</code>.
+ */
+static void *viosim_bench_thread(void *arg) {
+    struct viosim_bench_thread *thr = arg;
+
+    unsigned long req_size;
+    unsigned long i;
+
+    unsigned long t0, t1, t2, t3;
+
+    while (!viosim_bench_stop) {
+        if ((viosim_bench_ops_left != 0L)
+            && (__sync_fetch_and_sub(&viosim_bench_ops_left, 1L) <= 1L)) {
+
+            viosim_bench_stop = 1;
+        }
+
+        t0 = _viosim_now_ns();
+
+        if ((thr->deadline != 0UL) && (t0 >= thr->deadline)) {
+            break;
+        }
+
+        /* Sizing... */
+        if (ioctl(thr->devnode, DEVICE_IOCTL_GET_REQUEST_SIZE,
+                  &req_size) < 0) {
+
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                continue; /* <== No request there (yet). */
+            }
+
+            thr->errors++;
+
+            break;
+        }
+
+        t1 = _viosim_now_ns();
+
+        /* Reading... */
+        if (ioctl(thr->devnode, DEVICE_IOCTL_GET_BLOCK, thr->req_map) < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN)) {
+                thr->withdrawn++; /* <== The request is gone already. */
+
+                continue;
+            }
+
+            thr->errors++;
+
+            break;
+        }
+
+        t2 = _viosim_now_ns();
+
+        /* Converting LPN to PPN. */
+        for (i = 0; (i < req_size) && (i < DEVICE_REQ_MAP_ENTRIES_MAX); i++) {
+            thr->req_map[i].page_map.ppn  = thr->req_map[i].page_map.lpn;
+            thr->req_map[i].page_map.ppnx = thr->req_map[i].page_map.lpn;
+        }
+
+        /* Writing... */
+        if (ioctl(thr->devnode, DEVICE_IOCTL_SET_BLOCK, thr->req_map) < 0) {
+            if (errno == EINVAL) {
+                thr->withdrawn++; /* <== The request is gone already. */
+
+                continue;
+            }
+
+            thr->errors++;
+
+            break;
+        }
+
+        t3 = _viosim_now_ns();
+
+        _viosim_hist_record(&thr->hist[VIOSIM_STAGE_GET_REQUEST_SIZE], t1-t0);
+        _viosim_hist_record(&thr->hist[VIOSIM_STAGE_GET_BLOCK],        t2-t1);
+        _viosim_hist_record(&thr->hist[VIOSIM_STAGE_SET_BLOCK],        t3-t2);
+        _viosim_hist_record(&thr->hist[VIOSIM_STAGE_CYCLE],            t3-t0);
+
+        thr->ops++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Benchmarks I/O (read/write) operations from several threads
+ * and prints IOPS along with per-stage latency percentiles.
+ *
+ * @param viosim_devnode The device node to test.
+ * @param num_of_io_ops  The total number of I/O operations
+ *                       (<code>0</code> &ndash; no limit).
+ * @param app_name       The name of the application executable.
+ *
+ * @return The exit code indicating the benchmark execution status.
+ */
+int viosim_bench_io(const int            viosim_devnode,
+                    const unsigned long  num_of_io_ops,
+                    const char          *app_name) {
+
+    int ret = EXIT_SUCCESS;
+
+    static const char *stage_names[VIOSIM_STAGES] = {
+        "GET_REQUEST_SIZE", "GET_BLOCK", "SET_BLOCK", "Cycle"
+    };
+
+    struct viosim_bench_thread *thrs;
+    struct viosim_hist         *hist;
+
+    unsigned long start, elapsed, ops = 0UL, errors = 0UL, withdrawn = 0UL;
+    unsigned      i, j, started = 0U;
+
+    /* Registering... */
+    ret = ioctl(viosim_devnode, DEVICE_IOCTL_REG_USER_CALLER,
+                DEVICE_REG_FLAG_IDENTITY);
+
+    if (ret < 0) {
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    thrs = calloc(viosim_opts.threads, sizeof(*thrs));
+    hist = calloc(VIOSIM_STAGES,       sizeof(*hist));
+
+    if ((thrs == NULL) || (hist == NULL)) {
+        free(thrs);
+        free(hist);
+
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, _viosim_bench_sigint);
+
+    viosim_bench_ops_left = num_of_io_ops;
+
+    start = _viosim_now_ns();
+
+    for (i = 0; i < viosim_opts.threads; i++) {
+        thrs[i].devnode  = viosim_devnode;
+        thrs[i].deadline = (viosim_opts.duration > 0)
+                   ? (start + (viosim_opts.duration * 1000000000UL)) : 0UL;
+
+        ret = pthread_create(&thrs[i].thread, NULL,
+                             viosim_bench_thread, &thrs[i]);
+
+        if (ret != 0) {
+            fprintf(stderr, _BENCH_THREAD_CREATE_FAILED_ERR _NEW_LINE,
+                    app_name, strerror(ret));
+
+            viosim_bench_stop = 1;
+
+            ret = EXIT_FAILURE;
+
+            break;
+        }
+
+        started++;
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(thrs[i].thread, NULL);
+
+        ops       += thrs[i].ops;
+        errors    += thrs[i].errors;
+        withdrawn += thrs[i].withdrawn;
+
+        for (j = 0; j < VIOSIM_STAGES; j++) {
+            _viosim_hist_merge(&hist[j], &thrs[i].hist[j]);
+        }
+    }
+
+    elapsed = _viosim_now_ns() - start;
+
+    /* --- Printing the summary - Begin ------------------------------------ */
+    printf(_BENCH_SUMMARY_MSG _NEW_LINE _NEW_LINE, started, ops, errors,
+           withdrawn, elapsed / 1e9, (elapsed > 0UL) ? (ops * 1e9 / elapsed) : 0.0);
+
+    printf(_BENCH_LATENCY_HEADER_MSG _NEW_LINE, "Stage (us)",
+           "mean", "p50", "p99", "p99.9", "max");
+
+    for (j = 0; j < VIOSIM_STAGES; j++) {
+        printf(_BENCH_LATENCY_ROW_MSG _NEW_LINE, stage_names[j],
+            (hist[j].total > 0UL) ? (hist[j].sum / 1e3 / hist[j].total) : 0.0,
+            _viosim_hist_percentile(&hist[j], 50.0) / 1e3,
+            _viosim_hist_percentile(&hist[j], 99.0) / 1e3,
+            _viosim_hist_percentile(&hist[j], 99.9) / 1e3,
+            hist[j].max / 1e3);
+    }
+    /* --- Printing the summary - End -------------------------------------- */
+
+    free(thrs);
+    free(hist);
+
+    if (errors > 0UL) {
+        ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+/**
+ * Takes a snapshot of the device into a slot, clones a snapshot
+ * into another slot, rolls the device back to a snapshot, or drops one,
+ * printing the time it took.
+ *
+ * @param viosim_devnode The device node.
+ * @param request        The snapshot <code>ioctl()</code> call ID.
+ * @param slots          The slot (<code>&lt;from&gt;:&lt;to&gt;</code>
+ *                       when cloning).
+ * @param app_name       The name of the application executable.
+ *
+ * @return The exit code indicating the snapshot operation status.
+ */
+int viosim_snap(const int            viosim_devnode,
+                const unsigned long  request,
+                const char          *slots,
+                const char          *app_name) {
+
+    struct viosim_snap_clone snap_clone;
+
+    unsigned long start;
+
+    char *end;
+
+    void *argp = &snap_clone.slot;
+
+    int ret;
+
+    snap_clone.slot = strtoul(slots, &end, 0);
+
+    if (request == DEVICE_IOCTL_SNAP_CLONE) {
+        snap_clone.src = snap_clone.slot;
+
+        if (*end == ':') {
+            snap_clone.slot = strtoul(end + 1, &end, 0);
+        } else {
+            end = (char *) slots;
+        }
+
+        argp = &snap_clone;
+    }
+
+    if ((end == slots) || (*end != '\0')) {
+        fprintf(stderr, _SNAP_SLOTS_INVALID_ERR _NEW_LINE, app_name, slots);
+
+        return EXIT_FAILURE;
+    }
+
+    start = _viosim_now_ns();
+
+    ret = ioctl(viosim_devnode, request, argp);
+
+    if (ret < 0) {
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    printf(_SNAP_MSG _NEW_LINE, app_name, slots,
+           (_viosim_now_ns() - start) / 1e6);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Takes a consistent snapshot of the mapping exported by the driver
+ * (retrying while the driver updates it) and prints the number of pages
+ * mapped and valid, along with the erase block with the fewest valid pages
+ * (the one greedy GC would reclaim first).
+ *
+ * @param block_pages The number of pages per erase block
+ *                    (<code>0</code> &ndash; don't look for the block).
+ * @param app_name    The name of the application executable.
+ *
+ * @return The exit code indicating the snapshot status.
+ */
+int viosim_map_stat(const unsigned long  block_pages,
+                    const char          *app_name) {
+
+    int ret = EXIT_SUCCESS;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    volatile const struct viosim_map_header *hdr;
+
+    const unsigned long *l2p, *valid;
+
+    unsigned long *snap;
+    unsigned long  size, words, gen;
+    unsigned long  mapped, nr_valid, retries = 0UL;
+    unsigned long  block, blocks, count, min_count, min_block = 0UL;
+    unsigned long  i;
+
+    void *map;
+
+    int fd = open(_MAP_DEVNODE, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, _DEVNODE_OPEN_FAILED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    /* Mapping the header first to learn the size of the whole export. */
+    map = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, _MAP_STAT_MMAP_FAILED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        close(fd);
+
+        return EXIT_FAILURE;
+    }
+
+    hdr  = map;
+    size = hdr->size;
+
+    if (hdr->magic != DEVICE_MAP_MAGIC) {
+        fprintf(stderr, _MAP_STAT_MAGIC_INVALID_ERR _NEW_LINE, app_name);
+
+        munmap(map, page_size);
+        close(fd);
+
+        return EXIT_FAILURE;
+    }
+
+    munmap(map, page_size);
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, _MAP_STAT_MMAP_FAILED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    hdr   = map;
+    l2p   = (const unsigned long *) ((char *) map + hdr->l2p_offset);
+    valid = (const unsigned long *) ((char *) map + hdr->valid_offset);
+    words = (hdr->nr_pages + (8 * sizeof(long)) - 1) / (8 * sizeof(long));
+
+    snap = malloc(words * sizeof(long));
+
+    if (snap == NULL) {
+        munmap(map, size);
+
+        return EXIT_FAILURE;
+    }
+
+    /* Retrying until no update has come in between. */
+    for (;;) {
+        gen = hdr->generation;
+
+        if ((gen & 1UL) == 0UL) {
+            __sync_synchronize();
+
+            for (i = 0, mapped = 0UL; i < hdr->nr_pages; i++) {
+                mapped += (l2p[i] != DEVICE_MAP_PPN_NONE);
+            }
+
+            memcpy(snap, valid, words * sizeof(long));
+
+            __sync_synchronize();
+
+            if (hdr->generation == gen) {
+                break;
+            }
+        }
+
+        retries++;
+    }
+
+    for (i = 0, nr_valid = 0UL; i < words; i++) {
+        nr_valid += __builtin_popcountl(snap[i]);
+    }
+
+    printf(_MAP_STAT_MSG _NEW_LINE,
+           gen, hdr->nr_pages, mapped, nr_valid, retries);
+
+    blocks    = (block_pages > 0UL) ? (hdr->nr_pages / block_pages) : 0UL;
+    min_count = block_pages + 1;
+
+    for (block = 0; block < blocks; block++) {
+        for (i = block * block_pages, count = 0UL;
+             i < (block + 1) * block_pages; i++) {
+
+            count += (snap[i / (8 * sizeof(long))]
+                          >> (i % (8 * sizeof(long)))) & 1UL;
+        }
+
+        if (count < min_count) {
+            min_count = count;
+            min_block = block;
+        }
+    }
+
+    if (blocks > 0UL) {
+        printf(_MAP_STAT_BLOCK_MSG _NEW_LINE,
+               min_count, block_pages, min_block, blocks);
+    }
+
+    free(snap);
+
+    munmap(map, size);
+
+    return ret;
+}
+
+/**
+ * Performs I/O operations like <code>viosim_perf_io()</code> does,
+ * but fetching the requests waiting in batches (one
+ * <code>GET_BATCH</code> call) and answering each batch
+ * with one <code>SET_BATCH</code> call.
+ *
+ * @param viosim_devnode The device node to test.
+ * @param num_of_io_ops  The number of I/O operations
+ *                       (<code>0</code> &ndash; no limit, until <Ctrl+C>).
+ * @param app_name       The name of the application executable.
+ *
+ * @return The exit code indicating the I/O operations execution status.
+ */
+int viosim_batch_io(const int            viosim_devnode,
+                    const unsigned long  num_of_io_ops,
+                    const char          *app_name) {
+
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_ftl_batch      batch;
+    struct viosim_ftl_batch_req *rec;
+
+    unsigned long ops = 0UL, errors = 0UL, calls = 0UL, batches = 0UL;
+    unsigned long start, elapsed;
+    unsigned long j;
+
+    unsigned fetched, i;
+
+    size_t size = DEVICE_FTL_BATCH_MAX * (sizeof(*rec)
+                + (sizeof(rec->req_map[0]) * DEVICE_REQ_MAP_ENTRIES_MAX));
+
+    char *buffer, *p;
+
+    /* Registering... */
+    if (ioctl(viosim_devnode, DEVICE_IOCTL_REG_USER_CALLER,
+              DEVICE_REG_FLAG_IDENTITY) < 0) {
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    buffer = malloc(size);
+
+    if (buffer == NULL) {
+        fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                app_name, strerror(ENOMEM));
+
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, _viosim_bench_sigint);
+
+    start = _viosim_now_ns();
+
+    /* Stop on <Ctrl+C>. */
+    while (!viosim_bench_stop && ((num_of_io_ops == 0)
+                              || (ops < num_of_io_ops))) {
+
+        /* Fetching... */
+        batch.addr    = (unsigned long) buffer;
+        batch.len     = size;
+        batch.nr_reqs = 0;
+
+        calls++;
+
+        if (ioctl(viosim_devnode, DEVICE_IOCTL_GET_BATCH, &batch) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                    app_name, strerror(errno));
+
+            ret = EXIT_FAILURE;
+
+            break;
+        }
+
+        /* Converting LPN to PPN (and to the new PPN for writes). */
+        for (p = buffer, i = 0; i < batch.nr_reqs; i++) {
+            rec = (struct viosim_ftl_batch_req *) p;
+
+            for (j = 0; j < rec->req_size; j++) {
+                rec->req_map[j].page_map.ppn  = rec->req_map[j].page_map.lpn;
+                rec->req_map[j].page_map.ppnx = rec->req_map[j].page_map.lpn;
+            }
+
+            p += sizeof(*rec) + (sizeof(rec->req_map[0]) * rec->req_size);
+        }
+
+        /* Answering them all at once... */
+        fetched = batch.nr_reqs;
+
+        calls++;
+        batches++;
+
+        if (ioctl(viosim_devnode, DEVICE_IOCTL_SET_BATCH, &batch) < 0) {
+            fprintf(stderr, _MAKE_IOCTL_CALL_UNHANDLED_ERR _NEW_LINE,
+                    app_name, strerror(errno));
+
+            errors += fetched;
+
+            ret = EXIT_FAILURE;
+
+            break;
+        }
+
+        /* The ones not answered have timed out in the meantime. */
+        ops    += batch.nr_reqs;
+        errors += fetched - batch.nr_reqs;
+    }
+
+    elapsed = _viosim_now_ns() - start;
+
+    printf(_BATCH_SUMMARY_MSG _NEW_LINE, ops, errors, elapsed / 1e9,
+           (elapsed > 0UL) ? (ops * 1e9 / elapsed) : 0.0, calls, batches);
+
+    free(buffer);
+
+    if (errors > 0UL) {
+        ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
 /* Helper function. Closes the device node. */
 int _viosim_devnode_close(const int viosim_devnode, const char *app_name) {
     int ret = close(viosim_devnode);
@@ -329,27 +1089,36 @@ void _separator_draw(const char *banner_text) {
 int main(int argc, char *const *argv) {
     int ret = EXIT_SUCCESS;
 
-    char *print_banner_opt = _EMPTY_STRING;
+    bool print_banner = false;
 
-    int argv4_len, /*
-        ^
-        |
-        +-------- Needs this for toupper'ing argv[4] only.
-        |
-        v
-    */  i;
+    int i;
 
-    if (argc > 4) {
-        argv4_len = strlen(argv[4]);
+    /* Parsing options following the three mandatory args. */
+    for (i = 4; i < argc; i++) {
+        if ((toupper(argv[i][0]) == _PRINT_BANNER_OPT[0])
+            && (toupper(argv[i][1]) == _PRINT_BANNER_OPT[1])
+            && (argv[i][2] == '\0')) {
 
-        print_banner_opt = malloc(argv4_len);
+            print_banner = true;
+        } else if (strcmp(argv[i], _QUIET_MODE_OPT) == 0) {
+            viosim_opts.quiet = true;
+        } else if ((strcmp(argv[i], _THREADS_OPT) == 0) && (i + 1 < argc)) {
+            viosim_opts.threads  = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], _DURATION_OPT) == 0) && (i + 1 < argc)) {
+            viosim_opts.duration = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, _CLI_OPTION_INVALID_ERR _NEW_LINE,
+                    argv[0], argv[i]);
 
-        for (i = 0; i <= argv4_len; i++) {
-            print_banner_opt[i] = toupper(argv[4][i]);
+            return EXIT_FAILURE;
         }
     }
 
-    if (strcmp(print_banner_opt, _PRINT_BANNER_OPT) == 0) {
+    if (viosim_opts.threads == 0) {
+        viosim_opts.threads = 1;
+    }
+
+    if (print_banner) {
         _separator_draw(_APP_COPYRIGHT__ _ONE_SPACE_STRING _APP_AUTHOR);
 
         printf(_APP_NAME        _COMMA_SPACE_SEP                         \
@@ -360,10 +1129,6 @@ int main(int argc, char *const *argv) {
         _separator_draw(_APP_COPYRIGHT__ _ONE_SPACE_STRING _APP_AUTHOR);
     }
 
-    if (argc > 4) {
-        free(print_banner_opt);
-    }
-
     /* Checking for args presence. */
     if (argc < 4) {
         ret = EXIT_FAILURE;
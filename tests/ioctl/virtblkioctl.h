@@ -15,7 +15,9 @@
 #ifndef __VIRTBLKIOCTL_H
 #define __VIRTBLKIOCTL_H
 
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE /* <== Needs to use O_DIRECT in open(). */
+#endif
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -23,9 +25,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
 
 /* Helper constants. */
 #define _EMPTY_STRING       ""
@@ -34,6 +41,9 @@
 #define _COMMA_SPACE_SEP  ", "
 #define _NEW_LINE         "\n"
 #define _PRINT_BANNER_OPT "-V"
+#define _QUIET_MODE_OPT   "-q"
+#define _THREADS_OPT      "-t"
+#define _DURATION_OPT     "-d"
 
 /* App name, version, and copyright banners. */
 #define _APP_NAME        "VIRTual BLocK IOCTLing (virtblkioctl)"
@@ -58,7 +68,7 @@
  */
 #define _CLI_USAGE_MSG \
          "Usage: virtblkioctl <device_node> <ioctl_command> <request_size"                               \
-                                                           "|num_of_io_ops> [-V]"              _NEW_LINE \
+                                                           "|num_of_io_ops> [options]"         _NEW_LINE \
                                                                                                _NEW_LINE \
          "       <device_node>       Something like " _DEVNODE_HUB _MODULE_NAME                _NEW_LINE \
                                                                                                _NEW_LINE \
@@ -75,9 +85,39 @@
          "                           to the number of I/O operations preferred,"               _NEW_LINE \
          "                           or to 0 for infinite repetitions"                         _NEW_LINE \
                                                                                                _NEW_LINE \
+         "           --bench         Benchmark the ioctl() handshake: perform I/O operations"  _NEW_LINE \
+         "                           like '--io' does, from several threads, timing each"      _NEW_LINE \
+         "                           stage, then print IOPS and latency percentiles"           _NEW_LINE \
+         "                           The <num_of_io_ops> param is the total number of them,"   _NEW_LINE \
+         "                           or 0 to run for the duration set (or until <Ctrl+C>)"     _NEW_LINE \
+                                                                                               _NEW_LINE \
+         "           --batch         Perform I/O operations like '--io' does, fetching"        _NEW_LINE \
+         "                           and answering requests in batches (GET_BATCH/SET_BATCH)," _NEW_LINE \
+         "                           then print the number of ioctl() calls it took"           _NEW_LINE \
+                                                                                               _NEW_LINE \
+         "           --mapstat       Take a snapshot of the mapping the driver exports"        _NEW_LINE \
+         "                           (map_export=1) and print the pages mapped and valid"      _NEW_LINE \
+         "                           The <request_size> param is the number of pages"          _NEW_LINE \
+         "                           per erase block to find the one with the fewest"          _NEW_LINE \
+         "                           valid pages in, or 0 to skip that"                        _NEW_LINE \
+                                                                                               _NEW_LINE \
+         "           --snap          Take a snapshot of the device into the slot given"        _NEW_LINE \
+         "                           as <request_size> (0 to 7), sharing its pages"            _NEW_LINE \
+         "           --clone         Clone a snapshot into another slot: <request_size>"       _NEW_LINE \
+         "                           is '<from>:<to>' (without quotes)"                        _NEW_LINE \
+         "           --rollback      Roll the device back to the snapshot in the slot"         _NEW_LINE \
+         "           --snapdrop      Drop the snapshot in the slot"                            _NEW_LINE \
+                                                                                               _NEW_LINE \
          "       <request_size>      Unsigned integer or 'none' (without quotes) when unknown" _NEW_LINE \
                                                                                                _NEW_LINE \
-         "       <num_of_io_ops>     The number of I/O ops (see '--io' command description)"   _NEW_LINE
+         "       <num_of_io_ops>     The number of I/O ops (see '--io' command description)"   _NEW_LINE \
+                                                                                               _NEW_LINE \
+         "       [options]           Any of the following:"                                    _NEW_LINE \
+         "           -V              Print the app banner"                                     _NEW_LINE \
+         "           -q              Quiet mode: don't print each I/O operation ('--io')"      _NEW_LINE \
+         "           -t <threads>    The number of threads to run ('--bench'; default: 1)"     _NEW_LINE \
+         "           -d <seconds>    Stop after that many seconds ('--bench'; default: 0,"     _NEW_LINE \
+         "                           i.e. no time limit)"                                      _NEW_LINE
 
 /**
  * Constant: Print this when the device node is not specified
@@ -149,6 +189,46 @@
         _IOCTL_CALL_GET_BLOCK_RESULT_MSG
 #define _IOCTL_CALL_UNKNOWN_COMMAND_MSG         "%s: Unknown command"
 
+/** Constant: Print this when an option is unknown or lacks its value. */
+#define _CLI_OPTION_INVALID_ERR "%s: Invalid option: %s"
+
+/** Constant: Print this when benchmark threads cannot be started. */
+#define _BENCH_THREAD_CREATE_FAILED_ERR "%s: Cannot start thread: %s"
+
+/** Constants: Print as the <code>--bench</code> pseudo-command summary. */
+#define _BENCH_SUMMARY_MSG                               \
+         "Threads: %u | I/O ops: %lu | Errors: %lu"      \
+                    " | Withdrawn: %lu"                  \
+                    " | Elapsed: %.3f s | IOPS: %.1f"
+#define _BENCH_LATENCY_HEADER_MSG                        \
+         "%-18s %12s %12s %12s %12s %12s"
+#define _BENCH_LATENCY_ROW_MSG                           \
+         "%-18s %12.3f %12.3f %12.3f %12.3f %12.3f"
+
+/** Constant: Print as the <code>--batch</code> pseudo-command summary. */
+#define _BATCH_SUMMARY_MSG                               \
+         "I/O ops: %lu | Errors: %lu | Elapsed: %.3f s"  \
+                    " | IOPS: %.1f | ioctl() calls: %lu | Batches: %lu"
+
+/** Constant: Print this when the snapshot slots given are not valid. */
+#define _SNAP_SLOTS_INVALID_ERR "%s: Invalid snapshot slot(s): %s"
+
+/** Constant: Print as the snapshot pseudo-commands summary. */
+#define _SNAP_MSG "%s: slot %s done in %.3f ms"
+
+/** Constant: Print this when the mapping export cannot be mapped. */
+#define _MAP_STAT_MMAP_FAILED_ERR "%s: Cannot map " _MAP_DEVNODE ": %s"
+
+/** Constant: Print this when the mapping export is not the one expected. */
+#define _MAP_STAT_MAGIC_INVALID_ERR "%s: " _MAP_DEVNODE " is not a mapping export"
+
+/** Constants: Print as the <code>--mapstat</code> pseudo-command summary. */
+#define _MAP_STAT_MSG                                    \
+         "Generation: %lu | Pages: %lu | Mapped: %lu"    \
+                    " | Valid: %lu | Retries: %lu"
+#define _MAP_STAT_BLOCK_MSG                              \
+         "Fewest valid pages: %lu of %lu in block %lu (of %lu)"
+
 /** Constants: Print during <code>ioctl()</code> pseudo-command execution. */
 #define _IOCTL_CALL_IO_GET_REQUEST_SIZE_RESULT_MSG "Request size: %lu"
 #define _IOCTL_CALL_IO_GET_BLOCK_RESULT_MSG            \
@@ -170,6 +250,12 @@
 #define  DEVICE_IOCTL_REG_USER_CALLER \
         _IO (DEVICE_IOCTL_TYPE_LETTER, 0)
 
+/**
+ * Constant: The flag to register a user space caller with, declaring
+ *           it maps each page to itself (see the driver's header).
+ */
+#define DEVICE_REG_FLAG_IDENTITY 0x1
+
 /** Constant: The ioctl() command to get the request size. */
 #define _DEVICE_IOCTL_GET_REQUEST_SIZE "--getreqsize"
 #define  DEVICE_IOCTL_GET_REQUEST_SIZE \
@@ -185,15 +271,185 @@
 #define  DEVICE_IOCTL_SET_BLOCK \
         _IOW(DEVICE_IOCTL_TYPE_LETTER, 3, unsigned long)
 
+/**
+ * Constant: The ioctl() command to copy a physical page onto another one
+ *           (used by the FTL daemon to relocate pages on GC).
+ */
+#define  DEVICE_IOCTL_COPY_PAGE \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 4, struct viosim_page_copy)
+
+/**
+ * Constant: The ioctl() command to invalidate a range of the kernel
+ *           L2P cache (used by the FTL daemon for pages relocated on GC).
+ */
+#define  DEVICE_IOCTL_INVALIDATE_L2P \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 5, struct viosim_l2p_range)
+
+/**
+ * Constant: The ioctl() command to grant the driver free PPNs it places
+ *           writes to on its own (when loaded with async_writes=1).
+ */
+#define  DEVICE_IOCTL_GRANT_PPNS \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 6, struct viosim_ppn_grant)
+
+/**
+ * Constant: The ioctl() command to drain the journal of writes the driver
+ *           has placed on its own (to be done after getting a request
+ *           and before answering it).
+ */
+#define  DEVICE_IOCTL_DRAIN_JOURNAL \
+        _IOR(DEVICE_IOCTL_TYPE_LETTER, 7, struct viosim_journal_batch)
+
+/**
+ * Constant: The ioctl() command to have an eventfd signaled whenever
+ *           a request is queued for the FTL (-1 -- none), to wait for it
+ *           in an event loop with the device node opened non-blocking.
+ */
+#define  DEVICE_IOCTL_SET_EVENTFD \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 8, int)
+
+/**
+ * Constants: The ioctl() commands to fetch a batch of requests waiting
+ *            for the FTL and to answer them (by their tags).
+ */
+#define  DEVICE_IOCTL_GET_BATCH \
+        _IOWR(DEVICE_IOCTL_TYPE_LETTER, 9, struct viosim_ftl_batch)
+#define  DEVICE_IOCTL_SET_BATCH \
+        _IOWR(DEVICE_IOCTL_TYPE_LETTER, 10, struct viosim_ftl_batch)
+
+/**
+ * Constants: The ioctl() calls to take a snapshot of the device into
+ *            a slot, to clone a snapshot into another slot, to roll
+ *            the device back to a snapshot, and to drop a snapshot.
+ */
+#define  DEVICE_IOCTL_SNAP_TAKE \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 11, unsigned)
+#define  DEVICE_IOCTL_SNAP_CLONE \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 12, struct viosim_snap_clone)
+#define  DEVICE_IOCTL_SNAP_ROLLBACK \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 13, unsigned)
+#define  DEVICE_IOCTL_SNAP_DROP \
+        _IOW(DEVICE_IOCTL_TYPE_LETTER, 14, unsigned)
+
 /**
  * Constant: The ioctl() pseudo-command to continuously perform
  *           I/O operations in a loop.
  */
 #define _DEVICE_IOCTL_PERF_IO "--io"
 
+/**
+ * Constant: The ioctl() pseudo-command to benchmark I/O operations
+ *           from several threads.
+ */
+#define _DEVICE_IOCTL_BENCH_IO "--bench"
+
+/**
+ * Constant: The pseudo-command to perform I/O operations
+ *           fetching and answering requests in batches.
+ */
+#define _DEVICE_IOCTL_BATCH_IO "--batch"
+
+/**
+ * Constants: The pseudo-commands to take, clone, roll back to,
+ *            and drop snapshots of the device.
+ */
+#define _DEVICE_IOCTL_SNAP_TAKE     "--snap"
+#define _DEVICE_IOCTL_SNAP_CLONE    "--clone"
+#define _DEVICE_IOCTL_SNAP_ROLLBACK "--rollback"
+#define _DEVICE_IOCTL_SNAP_DROP     "--snapdrop"
+
+/**
+ * Constant: The pseudo-command to take a snapshot of the mapping
+ *           exported by the driver through mmap().
+ */
+#define _DEVICE_IOCTL_MAP_STAT "--mapstat"
+
+/** Constant: The device node the driver exports its mapping through. */
+#define _MAP_DEVNODE _DEVNODE_HUB _MODULE_NAME "-map"
+
+/** Constant: The magic number the mapping export header starts with. */
+#define DEVICE_MAP_MAGIC 0x70616d6d69736f69UL
+
+/** Constant: The mapping export entry of a page not mapped (as known). */
+#define DEVICE_MAP_PPN_NONE (~0UL)
+
+/**
+ * Constant: The max number of request mapping entries the device
+ *           may return at once (one per page the largest request spans,
+ *           so that's well above what it takes).
+ */
+#define DEVICE_REQ_MAP_ENTRIES_MAX 1024
+
+/**
+ * Constant: The max number of PPNs granted or journal entries drained
+ *           at once.
+ */
+#define DEVICE_PPN_BATCH_MAX 128
+
+/** Constant: The max number of requests fetched or answered in a batch. */
+#define DEVICE_FTL_BATCH_MAX 64
+
+/**
+ * Constant: The number of bits of a latency histogram bucket mantissa.
+ *           Buckets are log-linear (HDR-style): each power of two
+ *           is split into <code>2^VIOSIM_HIST_SUB_BITS</code> buckets,
+ *           so that any recorded value is within ~3% of its bucket.
+ */
+#define VIOSIM_HIST_SUB_BITS 5
+#define VIOSIM_HIST_SUB      (1 << VIOSIM_HIST_SUB_BITS)
+
+/** Constant: The number of latency histogram buckets (up to 2^64 ns). */
+#define VIOSIM_HIST_BUCKETS ((64 - VIOSIM_HIST_SUB_BITS + 1) * VIOSIM_HIST_SUB)
+
+/** Constants: The timed stages of an I/O operation. */
+#define VIOSIM_STAGE_GET_REQUEST_SIZE 0
+#define VIOSIM_STAGE_GET_BLOCK        1
+#define VIOSIM_STAGE_SET_BLOCK        2
+#define VIOSIM_STAGE_CYCLE            3
+#define VIOSIM_STAGES                 4
+
+/** The structure to hold a latency histogram (in nanoseconds). */
+struct viosim_hist {
+    /** The number of values recorded into each bucket. */
+    unsigned long counts[VIOSIM_HIST_BUCKETS];
+
+    /** The number of values recorded. */
+    unsigned long total;
+
+    /** The sum of values recorded. */
+    unsigned long sum;
+
+    /** The max value recorded. */
+    unsigned long max;
+};
+
+/** The structure to hold the command line options. */
+struct viosim_opts {
+    /** Quiet mode: don't print each I/O operation. */
+    bool quiet;
+
+    /** The number of benchmark threads. */
+    unsigned threads;
+
+    /** The benchmark duration in seconds (<code>0</code> &ndash; no limit). */
+    unsigned duration;
+};
+
 /* Continuously performs I/O (read/write) operations in a loop. */
 int viosim_perf_io(const int, const char *, const unsigned, const char *);
 
+/* Benchmarks I/O (read/write) operations from several threads. */
+int viosim_bench_io(const int, const unsigned long, const char *);
+
+/* Performs I/O operations fetching and answering requests in batches. */
+int viosim_batch_io(const int, const unsigned long, const char *);
+
+/* Takes a snapshot of the mapping exported by the driver. */
+int viosim_map_stat(const unsigned long, const char *);
+
+/* Takes, clones, rolls back to, or drops a snapshot of the device. */
+int viosim_snap(const int, const unsigned long, const char *, const char *);
+
 /* Helper function. Closes the device node. */
 extern int _viosim_devnode_close(const int, const char *);
 
@@ -207,13 +463,14 @@ struct viosim_page_map {
 
     /**
      * The physical page number (PPN). Provided by the user
-     * and is based on <code>lpn</code>.
+     * and is based on <code>lpn</code>. Prefilled with <code>lpn</code>
+     * by the kernel (identity mapping).
      */
     unsigned long ppn;
 
     /**
      * The new physical page number. Provided by the user
-     * for write ops only.
+     * for write ops only. Prefilled with <code>lpn</code> by the kernel.
      */
     unsigned long ppnx;
 
@@ -242,6 +499,113 @@ struct viosim_request_map {
     void *req_buffer;
 };
 
+/**
+ * The structure to describe a physical page copy
+ * requested by the FTL daemon.
+ */
+struct viosim_page_copy {
+    /** The physical page number (PPN) to copy from. */
+    unsigned long src_ppn;
+
+    /** The physical page number (PPN) to copy to. */
+    unsigned long dst_ppn;
+};
+
+/** The structure to describe a batch of free PPNs granted to the driver. */
+struct viosim_ppn_grant {
+    /** The number of PPNs in the batch. */
+    unsigned long nr_ppns;
+
+    /** The physical page numbers (PPNs). */
+    unsigned long ppns[DEVICE_PPN_BATCH_MAX];
+};
+
+/**
+ * The structure to describe the mapping exported by the driver: this header
+ * page is followed by the L2P table (a PPN per LPN) and the valid bitmap
+ * (a bit per PPN). The generation is odd while the driver updates them.
+ */
+struct viosim_map_header {
+    /** The magic number: <code>DEVICE_MAP_MAGIC</code>. */
+    unsigned long magic;
+
+    /** The generation counter. */
+    unsigned long generation;
+
+    /** The number of pages. */
+    unsigned long nr_pages;
+
+    /** The offsets (bytes) of the L2P table and the valid bitmap. */
+    unsigned long l2p_offset;
+    unsigned long valid_offset;
+
+    /** The size (bytes) of the whole mapping export. */
+    unsigned long size;
+};
+
+/** The structure to describe a snapshot to clone into another slot. */
+struct viosim_snap_clone {
+    /** The slot to clone into (must be free). */
+    unsigned slot;
+
+    /** The slot of the snapshot to clone. */
+    unsigned src;
+};
+
+/** The structure to describe a batch of requests fetched or answered. */
+struct viosim_ftl_batch {
+    /** The address of the records. */
+    unsigned long addr;
+
+    /** The size of the buffer the records are in (in bytes). */
+    unsigned len;
+
+    /** The number of records (fetched, or to answer, then answered). */
+    unsigned nr_reqs;
+};
+
+/** The structure to describe a request in a batch (records follow). */
+struct viosim_ftl_batch_req {
+    /** The tag to answer the request by. */
+    unsigned tag;
+
+    /** The number of request map entries. */
+    unsigned req_size;
+
+    /** The request map entries. */
+    struct viosim_request_map req_map[];
+};
+
+/** The structure to describe a write placed by the driver on its own. */
+struct viosim_journal_entry {
+    /** The logical page number (LPN) written. */
+    unsigned long lpn;
+
+    /** The granted physical page number (PPN) it has been written to. */
+    unsigned long ppn;
+};
+
+/** The structure to describe a batch of journal entries (oldest first). */
+struct viosim_journal_batch {
+    /** The number of entries in the batch. */
+    unsigned long nr_entries;
+
+    /** The journal entries. */
+    struct viosim_journal_entry entries[DEVICE_PPN_BATCH_MAX];
+};
+
+/**
+ * The structure to describe a range of logical pages whose kernel
+ * L2P cache entries the FTL daemon invalidates (0 pages -- all of them).
+ */
+struct viosim_l2p_range {
+    /** The first logical page number (LPN). */
+    unsigned long lpn;
+
+    /** The number of pages. */
+    unsigned long nr_pages;
+};
+
 #endif /* __VIRTBLKIOCTL_H */
 
 /* vim:set nu et ts=4 sw=4: */
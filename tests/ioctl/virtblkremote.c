@@ -0,0 +1,660 @@
+/*
+ * tests/ioctl/virtblkremote.c
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This server is a reference remote backing store the driver keeps
+ * the device pages in (loaded with remote set), answering page requests
+ * after a network-style latency.
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#include "virtblkremote.h"
+
+/** The pages kept and the server statistics. */
+static struct viosim_remote_store viosim_store = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/** The flag telling the server to stop (set on SIGINT/SIGTERM). */
+static volatile sig_atomic_t viosim_remote_stop = 0;
+
+/* Helper function. Handles the signals the server is stopped by. */
+static void _viosim_remote_signal(const int sig) {
+    viosim_remote_stop = 1;
+}
+
+/* Helper function. Gets the current time (ns, monotonic clock). */
+static uint64_t _viosim_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/* Helper function. Reads exactly that many bytes (false on EOF/error). */
+static bool _viosim_read_full(const int fd, void *buffer, size_t len) {
+    uint8_t *p = buffer;
+    ssize_t  n;
+
+    while (len > 0) {
+        n = read(fd, p, len);
+
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        p   += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/* Helper function. Writes exactly that many bytes (false on error). */
+static bool _viosim_write_full(const int fd, const void *buffer, size_t len) {
+    const uint8_t *p = buffer;
+    ssize_t        n;
+
+    while (len > 0) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if ((n < 0) && (errno == EINTR)) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        p   += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/**
+ * Sets up the pages on the first hello, in the file if given
+ * (sized to the device), or in memory otherwise.
+ * A later hello has to be for a device of the same size.
+ *
+ * @param nr_pages The number of pages of the device.
+ *
+ * @return <code>0</code> or the errno value to answer with.
+ */
+static int viosim_remote_hello(const unsigned long nr_pages) {
+    int ret = 0;
+
+    size_t size = nr_pages * DEVICE_PAGE_SIZE;
+
+    void *pages;
+
+    int fd;
+
+    pthread_mutex_lock(&viosim_store.lock);
+
+    if (viosim_store.pages != NULL) {
+        if (nr_pages != viosim_store.nr_pages) {
+            ret = EINVAL;
+        }
+
+        pthread_mutex_unlock(&viosim_store.lock);
+
+        return ret;
+    }
+
+    if (viosim_store.file != NULL) {
+        fd = open(viosim_store.file, O_RDWR | O_CREAT, 0644);
+
+        if ((fd < 0) || (ftruncate(fd, size) < 0)) {
+            pages = MAP_FAILED;
+        } else {
+            pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, 0);
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+    } else {
+        pages = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+
+    if (pages == MAP_FAILED) {
+        ret = errno;
+
+        fprintf(stderr, _REMOTE_STORE_FAILED_ERR _NEW_LINE,
+                viosim_store.app_name, nr_pages, strerror(ret));
+    } else {
+        viosim_store.pages    = pages;
+        viosim_store.nr_pages = nr_pages;
+    }
+
+    pthread_mutex_unlock(&viosim_store.lock);
+
+    return ret;
+}
+
+/**
+ * Serves a request: reads (part of) a page into the answer, or writes
+ * the data received into (part of) a page, bringing the rest of the page
+ * from the source page first if it is another one.
+ *
+ * @param conn  The connection.
+ * @param req   The request.
+ * @param reply The answer (with room for the data read).
+ *
+ * @return <code>0</code> or the errno value to answer with.
+ */
+static int viosim_remote_serve(      struct viosim_remote_conn  *conn,
+                               const struct viosim_remote_msg   *req,
+                                     struct viosim_remote_reply *reply) {
+
+    uint8_t *page;
+
+    if ((viosim_store.pages == NULL) || (req->ppn >= viosim_store.nr_pages)
+     || (req->offset > (DEVICE_PAGE_SIZE - req->len))) {
+
+        return EINVAL;
+    }
+
+    page = viosim_store.pages + (req->ppn * DEVICE_PAGE_SIZE);
+
+    if (req->op == DEVICE_REMOTE_OP_READ) {
+        memcpy(reply->data, page + req->offset, req->len);
+
+        return 0;
+    }
+
+    if (req->src_ppn == DEVICE_REMOTE_PPN_ZERO) {
+        memset(page, 0, DEVICE_PAGE_SIZE);
+    } else if (req->src_ppn != req->ppn) {
+        if (req->src_ppn >= viosim_store.nr_pages) {
+            return EINVAL;
+        }
+
+        memcpy(page, viosim_store.pages + (req->src_ppn * DEVICE_PAGE_SIZE),
+               DEVICE_PAGE_SIZE);
+    }
+
+    memcpy(page + req->offset, conn->page, req->len);
+
+    return 0;
+}
+
+/**
+ * Queues an answer to be sent once due, in the order answers are due.
+ *
+ * @param conn  The connection.
+ * @param reply The answer.
+ */
+static void viosim_remote_queue(struct viosim_remote_conn  *conn,
+                                struct viosim_remote_reply *reply) {
+
+    struct viosim_remote_reply **pos;
+
+    unsigned long queued;
+
+    pthread_mutex_lock(&conn->lock);
+
+    if ((conn->tail == NULL) || (conn->tail->due_ns <= reply->due_ns)) {
+        pos = (conn->tail != NULL) ? &conn->tail->next : &conn->head;
+    } else {
+        /* Due sooner than the last one (with jitter): finding its place. */
+        for (pos = &conn->head; (*pos)->due_ns <= reply->due_ns;
+             pos = &(*pos)->next);
+    }
+
+    reply->next = *pos;
+    *pos        = reply;
+
+    if (reply->next == NULL) {
+        conn->tail = reply;
+    }
+
+    queued = ++conn->queued;
+
+    pthread_cond_signal(&conn->cond);
+
+    pthread_mutex_unlock(&conn->lock);
+
+    pthread_mutex_lock(&viosim_store.lock);
+
+    if (queued > viosim_store.peak) {
+        viosim_store.peak = queued;
+    }
+
+    pthread_mutex_unlock(&viosim_store.lock);
+}
+
+/**
+ * Sends the answers of a connection as they are due, until
+ * the driver is gone: a thread per connection.
+ *
+ * @param arg The connection.
+ *
+ * @return <code>NULL</code>.
+ */
+static void *viosim_remote_sender(void *arg) {
+    struct viosim_remote_conn  *conn = arg;
+    struct viosim_remote_reply *reply;
+
+    struct timespec due;
+
+    uint64_t now;
+
+    bool sent = true;
+
+    pthread_mutex_lock(&conn->lock);
+
+    while (!conn->closed || (conn->head != NULL)) {
+        if (conn->head == NULL) {
+            pthread_cond_wait(&conn->cond, &conn->lock);
+
+            continue;
+        }
+
+        now = _viosim_now_ns();
+
+        if (conn->head->due_ns > now) {
+            due.tv_sec  = conn->head->due_ns / 1000000000UL;
+            due.tv_nsec = conn->head->due_ns % 1000000000UL;
+
+            pthread_cond_timedwait(&conn->cond, &conn->lock, &due);
+
+            continue;
+        }
+
+        reply      = conn->head;
+        conn->head = reply->next;
+
+        if (conn->head == NULL) {
+            conn->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&conn->lock);
+
+        /* Once the driver is gone, the rest is only dropped. */
+        if (sent) {
+            sent = _viosim_write_full(conn->fd, &reply->msg,
+                                      sizeof(reply->msg))
+                && ((reply->msg.op != DEVICE_REMOTE_OP_READ)
+                 || (reply->msg.status != 0)
+                 || _viosim_write_full(conn->fd, reply->data,
+                                       reply->msg.len));
+
+            if (!sent) {
+                shutdown(conn->fd, SHUT_RDWR);
+            }
+        }
+
+        free(reply);
+
+        pthread_mutex_lock(&conn->lock);
+
+        conn->queued--;
+    }
+
+    pthread_mutex_unlock(&conn->lock);
+
+    return NULL;
+}
+
+/**
+ * Serves a connection from the driver: receives the requests and serves
+ * them in the order they come in, each answer queued to be sent after
+ * the latency set, until the driver is gone: a thread per connection.
+ *
+ * @param arg The connection.
+ *
+ * @return <code>NULL</code>.
+ */
+static void *viosim_remote_receiver(void *arg) {
+    struct viosim_remote_conn  *conn = arg;
+    struct viosim_remote_reply *reply;
+    struct viosim_remote_msg    req;
+
+    pthread_condattr_t attr;
+
+    int status;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&conn->lock, NULL);
+    pthread_cond_init(&conn->cond, &attr);
+
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&conn->sender, NULL, viosim_remote_sender,
+                       conn) != 0) {
+
+        close(conn->fd);
+        free(conn);
+
+        return NULL;
+    }
+
+    while (_viosim_read_full(conn->fd, &req, sizeof(req))) {
+        if ((req.magic != DEVICE_REMOTE_MAGIC) || (req.len > DEVICE_PAGE_SIZE)) {
+            break;
+        }
+
+        /* The data written is to be received anyway, to stay in step. */
+        if ((req.op == DEVICE_REMOTE_OP_WRITE)
+            && !_viosim_read_full(conn->fd, conn->page, req.len)) {
+
+            break;
+        }
+
+        reply = malloc(sizeof(*reply)
+              + ((req.op == DEVICE_REMOTE_OP_READ) ? req.len : 0));
+
+        if (reply == NULL) {
+            break;
+        }
+
+        if (req.op == DEVICE_REMOTE_OP_HELLO) {
+            status = viosim_remote_hello(req.ppn);
+        } else if ((req.op == DEVICE_REMOTE_OP_READ)
+                || (req.op == DEVICE_REMOTE_OP_WRITE)) {
+
+            status = viosim_remote_serve(conn, &req, reply);
+        } else {
+            status = EINVAL;
+        }
+
+        pthread_mutex_lock(&viosim_store.lock);
+
+        if (status != 0) {
+            viosim_store.errors++;
+        } else if (req.op == DEVICE_REMOTE_OP_READ) {
+            viosim_store.reads++;
+        } else if (req.op == DEVICE_REMOTE_OP_WRITE) {
+            viosim_store.writes++;
+        }
+
+        pthread_mutex_unlock(&viosim_store.lock);
+
+        reply->msg        = req;
+        reply->msg.status = status;
+        reply->due_ns     = _viosim_now_ns() + viosim_store.latency_ns;
+
+        if (viosim_store.jitter_ns > 0) {
+            reply->due_ns += (uint64_t) rand() % (viosim_store.jitter_ns + 1);
+        }
+
+        viosim_remote_queue(conn, reply);
+    }
+
+    pthread_mutex_lock(&conn->lock);
+
+    conn->closed = true;
+
+    pthread_cond_signal(&conn->cond);
+
+    pthread_mutex_unlock(&conn->lock);
+
+    pthread_join(conn->sender, NULL);
+
+    printf(_REMOTE_CONN_MSG _NEW_LINE, conn->index, "closed");
+
+    close(conn->fd);
+
+    pthread_cond_destroy(&conn->cond);
+    pthread_mutex_destroy(&conn->lock);
+
+    free(conn);
+
+    return NULL;
+}
+
+/**
+ * Listens on the address given: a Unix socket path,
+ * or <code>[IPv4:]port</code>.
+ *
+ * @param address  The address.
+ * @param app_name The name of the application executable.
+ *
+ * @return The socket listened on, or <code>-1</code>.
+ */
+static int viosim_remote_listen(const char *address, const char *app_name) {
+    struct sockaddr_un un;
+    struct sockaddr_in in;
+    struct sockaddr   *addr;
+    socklen_t          addr_len;
+
+    char  host[INET_ADDRSTRLEN] = REMOTE_ADDR_DEF;
+    char *port;
+
+    int fd;
+    int one = 1;
+
+    if (address[0] == '/') {
+        memset(&un, 0, sizeof(un));
+
+        un.sun_family = AF_UNIX;
+
+        if (strlen(address) >= sizeof(un.sun_path)) {
+            fprintf(stderr, _REMOTE_ADDR_INVALID_ERR _NEW_LINE,
+                    app_name, address);
+
+            return -1;
+        }
+
+        strcpy(un.sun_path, address);
+
+        /* A socket left over by a previous run is in the way. */
+        unlink(address);
+
+        addr     = (struct sockaddr *) &un;
+        addr_len = sizeof(un);
+    } else {
+        memset(&in, 0, sizeof(in));
+
+        in.sin_family = AF_INET;
+
+        port = strrchr(address, ':');
+
+        if (port != NULL) {
+            if ((port - address) >= INET_ADDRSTRLEN) {
+                fprintf(stderr, _REMOTE_ADDR_INVALID_ERR _NEW_LINE,
+                        app_name, address);
+
+                return -1;
+            }
+
+            memcpy(host, address, port - address);
+
+            host[port - address] = '\0';
+
+            port++;
+        } else {
+            port = (char *) address;
+        }
+
+        in.sin_port = htons(strtoul(port, NULL, 10));
+
+        if ((inet_pton(AF_INET, host, &in.sin_addr) != 1)
+            || (in.sin_port == 0)) {
+
+            fprintf(stderr, _REMOTE_ADDR_INVALID_ERR _NEW_LINE,
+                    app_name, address);
+
+            return -1;
+        }
+
+        addr     = (struct sockaddr *) &in;
+        addr_len = sizeof(in);
+    }
+
+    fd = socket(addr->sa_family, SOCK_STREAM, 0);
+
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+
+    if ((fd < 0) || (bind(fd, addr, addr_len) < 0)
+                 || (listen(fd, REMOTE_LISTEN_BACKLOG) < 0)) {
+
+        fprintf(stderr, _REMOTE_LISTEN_FAILED_ERR _NEW_LINE,
+                app_name, address, strerror(errno));
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    return fd;
+}
+
+/* The server entry point. */
+int main(int argc, char *const *argv) {
+    struct viosim_remote_conn *conn;
+    struct sigaction           sa;
+
+    pthread_t      thread;
+    pthread_attr_t attr;
+
+    unsigned long latency_us = 0UL;
+    unsigned long jitter_us  = 0UL;
+
+    int listen_fd;
+    int fd;
+    int one = 1;
+    int i;
+
+    if ((argc < 2) || (argv[1][0] == '-')) {
+        fprintf(stderr, _REMOTE_USAGE_MSG _NEW_LINE);
+
+        return EXIT_FAILURE;
+    }
+
+    /* Parsing options following the address. */
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], _PRINT_BANNER_OPT) == 0) {
+            printf(_REMOTE_APP_NAME _COMMA_SPACE_SEP                         \
+                   _APP_VERSION_S__ _ONE_SPACE_STRING _APP_VERSION _NEW_LINE \
+                   _REMOTE_APP_DESCRIPTION                         _NEW_LINE \
+                   _APP_COPYRIGHT__ _ONE_SPACE_STRING _APP_AUTHOR  _NEW_LINE);
+        } else if ((strcmp(argv[i], _REMOTE_FILE_OPT)    == 0)
+                   && (i + 1 < argc)) {
+
+            viosim_store.file = argv[++i];
+        } else if ((strcmp(argv[i], _REMOTE_LATENCY_OPT) == 0)
+                   && (i + 1 < argc)) {
+
+            latency_us = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], _REMOTE_JITTER_OPT)  == 0)
+                   && (i + 1 < argc)) {
+
+            jitter_us  = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, _CLI_OPTION_INVALID_ERR _NEW_LINE,
+                    argv[0], argv[i]);
+
+            fprintf(stderr, _REMOTE_USAGE_MSG _NEW_LINE);
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    viosim_store.app_name   = argv[0];
+    viosim_store.latency_ns = (uint64_t) latency_us * 1000UL;
+    viosim_store.jitter_ns  = (uint64_t) jitter_us  * 1000UL;
+
+    listen_fd = viosim_remote_listen(argv[1], argv[0]);
+
+    if (listen_fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    /* Not restarting accept() on a signal, to stop. */
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sa_handler = _viosim_remote_signal;
+
+    sigemptyset(&sa.sa_mask);
+
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    printf(_REMOTE_LISTENING_MSG _NEW_LINE, argv[1], latency_us, jitter_us);
+
+    fflush(stdout);
+
+    while (!viosim_remote_stop) {
+        fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        /* Answers are small and latency-bound: sending them at once. */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn = calloc(1, sizeof(*conn));
+
+        if (conn == NULL) {
+            close(fd);
+
+            continue;
+        }
+
+        pthread_mutex_lock(&viosim_store.lock);
+
+        conn->index = viosim_store.conns++;
+
+        pthread_mutex_unlock(&viosim_store.lock);
+
+        conn->fd = fd;
+
+        printf(_REMOTE_CONN_MSG _NEW_LINE, conn->index, "opened");
+
+        fflush(stdout);
+
+        if (pthread_create(&thread, &attr, viosim_remote_receiver,
+                           conn) != 0) {
+
+            close(fd);
+            free(conn);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+
+    close(listen_fd);
+
+    if (argv[1][0] == '/') {
+        unlink(argv[1]);
+    }
+
+    pthread_mutex_lock(&viosim_store.lock);
+
+    printf(_REMOTE_SUMMARY_MSG _NEW_LINE, viosim_store.conns,
+           viosim_store.reads, viosim_store.writes, viosim_store.errors,
+           viosim_store.peak);
+
+    pthread_mutex_unlock(&viosim_store.lock);
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set nu et ts=4 sw=4: */
@@ -0,0 +1,193 @@
+/*
+ * tests/ioctl/virtblkremote.h
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This server is a reference remote backing store the driver keeps
+ * the device pages in (loaded with remote set), answering page requests
+ * after a network-style latency.
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#ifndef __VIRTBLKREMOTE_H
+#define __VIRTBLKREMOTE_H
+
+#include "virtblkioctl.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Server name banner. */
+#define _REMOTE_APP_NAME        "VIRTual BLocK Remote Store (virtblkremote)"
+#define _REMOTE_APP_DESCRIPTION \
+         "Keeps the device pages for the driver, answering after a set latency"
+
+/** Constants: The server's command line options. */
+#define _REMOTE_FILE_OPT    "-f"
+#define _REMOTE_LATENCY_OPT "-l"
+#define _REMOTE_JITTER_OPT  "-j"
+
+/** Constant: Print this usage info when the args passed are wrong. */
+#define _REMOTE_USAGE_MSG \
+         "Usage: virtblkremote <address> [options]"                                   _NEW_LINE \
+                                                                                      _NEW_LINE \
+         "       <address>           A Unix socket path (/run/virtblkremote.sock),"   _NEW_LINE \
+         "                           or [IPv4:]port to listen on (127.0.0.1 if"       _NEW_LINE \
+         "                           only the port is given)"                         _NEW_LINE \
+                                                                                      _NEW_LINE \
+         "       [options]           Any of the following:"                           _NEW_LINE \
+         "           -V              Print the app banner"                            _NEW_LINE \
+         "           -f <file>       Keep the pages in the file (default: in memory)" _NEW_LINE \
+         "           -l <us>         Answer each request that many microseconds"      _NEW_LINE \
+         "                           after it came in (default: 0)"                   _NEW_LINE \
+         "           -j <us>         Add up to that many microseconds at random"      _NEW_LINE \
+         "                           to the latency (default: 0)"                     _NEW_LINE
+
+/** Constant: Print this when the address to listen on is not valid. */
+#define _REMOTE_ADDR_INVALID_ERR "%s: Invalid address: %s"
+
+/** Constant: Print this when unable to listen on the address. */
+#define _REMOTE_LISTEN_FAILED_ERR "%s: Cannot listen on %s: %s"
+
+/** Constant: Print this when unable to set up the pages. */
+#define _REMOTE_STORE_FAILED_ERR "%s: Cannot set up %lu pages: %s"
+
+/** Constant: Print this once listening. */
+#define _REMOTE_LISTENING_MSG "Listening on %s (latency %lu us, jitter %lu us)"
+
+/** Constant: Print this when a connection comes in or goes away. */
+#define _REMOTE_CONN_MSG "Connection %lu %s"
+
+/** Constant: Print this as the summary once stopped. */
+#define _REMOTE_SUMMARY_MSG                                          \
+         "Connections: %lu | Reads: %lu | Writes: %lu | Errors: %lu" \
+         " | Most in flight on a connection: %lu"
+
+/** Constant: The backlog of the socket listened on. */
+#define REMOTE_LISTEN_BACKLOG 64
+
+/** Constant: The address listened on when only the port is given. */
+#define REMOTE_ADDR_DEF "127.0.0.1"
+
+/** Constants: The remote store message and operations (as by the driver). */
+#define DEVICE_REMOTE_MAGIC    0x6d727376
+#define DEVICE_REMOTE_OP_HELLO 0
+#define DEVICE_REMOTE_OP_READ  1
+#define DEVICE_REMOTE_OP_WRITE 2
+
+/** Constant: The source page of a write meaning "zeros" (none to copy). */
+#define DEVICE_REMOTE_PPN_ZERO UINT64_MAX
+
+/** Constant: The page size of the device. */
+#define DEVICE_PAGE_SIZE 4096
+
+/** The structure to describe a remote store message (as by the driver). */
+struct viosim_remote_msg {
+    /** The magic number (<code>DEVICE_REMOTE_MAGIC</code>). */
+    uint32_t magic;
+
+    /** The operation (<code>DEVICE_REMOTE_OP_*</code>). */
+    uint16_t op;
+
+    /** The status (the answer only): <code>0</code> or an errno value. */
+    uint16_t status;
+
+    /** The tag the answer is matched to the request by. */
+    uint32_t tag;
+
+    /** The number of bytes read or written. */
+    uint32_t len;
+
+    /** The page read or written (the number of pages for the hello). */
+    uint64_t ppn;
+
+    /** The page the rest of the page written comes from. */
+    uint64_t src_ppn;
+
+    /** The offset within the page read or written. */
+    uint32_t offset;
+
+    /** Reserved (zero). */
+    uint32_t reserved;
+};
+
+/** The structure to hold an answer waiting to be sent. */
+struct viosim_remote_reply {
+    /** The next answer (due no sooner). */
+    struct viosim_remote_reply *next;
+
+    /** The time (ns) the answer is due at. */
+    uint64_t due_ns;
+
+    /** The answer, followed by the data read (if any). */
+    struct viosim_remote_msg msg;
+    uint8_t                  data[];
+};
+
+/** The structure to hold a connection from the driver. */
+struct viosim_remote_conn {
+    /** The connection number, and its socket. */
+    unsigned long index;
+    int           fd;
+
+    /** The thread sending the answers as they are due. */
+    pthread_t sender;
+
+    /** Guards the answers waiting, signalled as they are added. */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    /** The answers waiting to be sent, by the time they are due. */
+    struct viosim_remote_reply *head;
+    struct viosim_remote_reply *tail;
+
+    /** The number of answers waiting. */
+    unsigned long queued;
+
+    /** Whether the driver is gone. */
+    bool closed;
+
+    /** The buffer the data written is received into. */
+    uint8_t page[DEVICE_PAGE_SIZE];
+};
+
+/** The structure to hold the pages kept and the server statistics. */
+struct viosim_remote_store {
+    /** Guards the pages being set up, and the statistics. */
+    pthread_mutex_t lock;
+
+    /** The pages (set up on the first hello), and their number. */
+    uint8_t       *pages;
+    unsigned long  nr_pages;
+
+    /** The file to keep the pages in (or <code>NULL</code>). */
+    const char *file;
+
+    /** The name of the application executable. */
+    const char *app_name;
+
+    /** The latency and its jitter (ns) the answers are sent after. */
+    uint64_t latency_ns;
+    uint64_t jitter_ns;
+
+    /** The number of connections, reads, writes, and errors. */
+    unsigned long conns;
+    unsigned long reads;
+    unsigned long writes;
+    unsigned long errors;
+
+    /** The most requests ever in flight on a connection. */
+    unsigned long peak;
+};
+
+#endif /* __VIRTBLKREMOTE_H */
+
+/* vim:set nu et ts=4 sw=4: */
@@ -0,0 +1,578 @@
+/*
+ * tests/ioctl/virtblkreplay.c
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This utility captures the I/O trace the driver records and replays it
+ * against the device with O_DIRECT, comparing the latencies.
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#include "virtblkreplay.h"
+
+/** The flag telling the utility to stop (set on SIGINT/SIGTERM). */
+static volatile sig_atomic_t viosim_replay_stop = 0;
+
+/* Helper function. Handles the signals the utility is stopped by. */
+static void _viosim_replay_signal(const int sig) {
+    viosim_replay_stop = 1;
+}
+
+/* Helper function. Gets the current time (ns, monotonic clock). */
+static uint64_t _viosim_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/* Helper function. Compares requests by the time they were issued at. */
+static int _viosim_replay_req_cmp(const void *a, const void *b) {
+    const struct viosim_replay_req *x = a;
+    const struct viosim_replay_req *y = b;
+
+    return (x->issue_ns > y->issue_ns) - (x->issue_ns < y->issue_ns);
+}
+
+/* Helper function. Compares latencies. */
+static int _viosim_lat_cmp(const void *a, const void *b) {
+    const uint64_t *x = a;
+    const uint64_t *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+/**
+ * Captures the trace the driver records: drains its per-CPU trace files
+ * into the trace file until stopped.
+ *
+ * @param trace_file The trace file to write.
+ * @param app_name   The name of the application executable.
+ *
+ * @return The exit code indicating the capture status.
+ */
+static int viosim_replay_capture(const char *trace_file,
+                                 const char *app_name) {
+
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_trace_rec *recs;
+    struct timespec          idle = { 0, REPLAY_CAPTURE_IDLE_NS };
+
+    unsigned long captured = 0UL;
+
+    long nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    long nr_open = 0L;
+    long cpu;
+
+    bool last = false;
+
+    ssize_t len;
+    size_t  nr_recs;
+
+    char path[PATH_MAX];
+
+    int *fds;
+
+    FILE *out;
+
+    fds  = calloc(nr_cpus, sizeof(*fds));
+    recs = calloc(REPLAY_CAPTURE_BATCH, sizeof(*recs));
+
+    if ((fds == NULL) || (recs == NULL)) {
+        fprintf(stderr, _REPLAY_ALLOC_FAILED_ERR _NEW_LINE, app_name);
+
+        free(recs);
+        free(fds);
+
+        return EXIT_FAILURE;
+    }
+
+    /* CPUs that have never been online have no trace file. */
+    for (cpu = 0; cpu < nr_cpus; cpu++) {
+        snprintf(path, sizeof(path), _REPLAY_TRACE_CPU_FILE, cpu);
+
+        fds[cpu] = open(path, O_RDONLY | O_NONBLOCK);
+
+        if (fds[cpu] >= 0) {
+            nr_open++;
+        }
+    }
+
+    if (nr_open == 0) {
+        fprintf(stderr, _REPLAY_NO_TRACE_ERR _NEW_LINE, app_name);
+
+        free(recs);
+        free(fds);
+
+        return EXIT_FAILURE;
+    }
+
+    out = fopen(trace_file, "wb");
+
+    if (out == NULL) {
+        fprintf(stderr, _REPLAY_TRACE_FILE_ERR _NEW_LINE,
+                app_name, trace_file, strerror(errno));
+
+        ret = EXIT_FAILURE;
+
+        last = true;
+    }
+
+    /* Going on till stopped, then draining what is left once more. */
+    while ((out != NULL) && !last) {
+        last    = viosim_replay_stop;
+        nr_recs = 0;
+
+        for (cpu = 0; cpu < nr_cpus; cpu++) {
+            if (fds[cpu] < 0) {
+                continue;
+            }
+
+            /* Whole records only: the driver never splits one. */
+            while ((len = read(fds[cpu], recs,
+                   REPLAY_CAPTURE_BATCH * sizeof(*recs))) > 0) {
+
+                nr_recs = len / sizeof(*recs);
+
+                if (fwrite(recs, sizeof(*recs), nr_recs, out) != nr_recs) {
+                    fprintf(stderr, _REPLAY_TRACE_FILE_ERR _NEW_LINE,
+                            app_name, trace_file, strerror(errno));
+
+                    ret  = EXIT_FAILURE;
+                    last = true;
+
+                    break;
+                }
+
+                captured += nr_recs;
+            }
+        }
+
+        if ((nr_recs == 0) && !last) {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    if ((out != NULL) && (fclose(out) != 0)) {
+        ret = EXIT_FAILURE;
+    }
+
+    for (cpu = 0; cpu < nr_cpus; cpu++) {
+        if (fds[cpu] >= 0) {
+            close(fds[cpu]);
+        }
+    }
+
+    printf(_REPLAY_CAPTURED_MSG _NEW_LINE, captured, nr_open, trace_file);
+
+    free(recs);
+    free(fds);
+
+    return ret;
+}
+
+/**
+ * Loads the trace file, ordering its requests by the time they were
+ * issued at (records are logged at completion, on different CPUs).
+ *
+ * @param replay     The replay to load the requests into.
+ * @param trace_file The trace file to read.
+ * @param app_name   The name of the application executable.
+ *
+ * @return The exit code indicating the loading status.
+ */
+static int viosim_replay_load(      struct viosim_replay *replay,
+                              const char                 *trace_file,
+                              const char                 *app_name) {
+
+    struct viosim_trace_rec rec;
+
+    unsigned long cap = 0UL;
+
+    void *reqs;
+
+    FILE *in = fopen(trace_file, "rb");
+
+    if (in == NULL) {
+        fprintf(stderr, _REPLAY_TRACE_FILE_ERR _NEW_LINE,
+                app_name, trace_file, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        /* Failed requests have no timing worth reproducing. */
+        if (rec.error || (rec.bytes == 0)) {
+            continue;
+        }
+
+        if (replay->nr_reqs == cap) {
+            cap  = (cap == 0UL) ? 4096UL : (cap * 2);
+            reqs = realloc(replay->reqs, cap * sizeof(*replay->reqs));
+
+            if (reqs == NULL) {
+                fprintf(stderr, _REPLAY_ALLOC_FAILED_ERR _NEW_LINE, app_name);
+
+                fclose(in);
+
+                return EXIT_FAILURE;
+            }
+
+            replay->reqs = reqs;
+        }
+
+        replay->reqs[replay->nr_reqs].issue_ns    = rec.time_ns - rec.lat_ns;
+        replay->reqs[replay->nr_reqs].orig_lat_ns = rec.lat_ns;
+        replay->reqs[replay->nr_reqs].lat_ns      = 0;
+        replay->reqs[replay->nr_reqs].sector      = rec.sector;
+        replay->reqs[replay->nr_reqs].bytes       = rec.bytes;
+        replay->reqs[replay->nr_reqs].op          = rec.op;
+
+        if (rec.bytes > replay->max_bytes) {
+            replay->max_bytes = rec.bytes;
+        }
+
+        replay->nr_reqs++;
+    }
+
+    fclose(in);
+
+    if (replay->nr_reqs == 0) {
+        fprintf(stderr, _REPLAY_TRACE_EMPTY_ERR _NEW_LINE,
+                app_name, trace_file);
+
+        return EXIT_FAILURE;
+    }
+
+    qsort(replay->reqs, replay->nr_reqs, sizeof(*replay->reqs),
+          _viosim_replay_req_cmp);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Replays requests: a job takes the next one, waits till it is due,
+ * issues it with <code>O_DIRECT</code>, and times it.
+ *
+ * @param arg The replay shared by the jobs.
+ *
+ * @return <code>NULL</code>.
+ */
+static void *viosim_replay_job(void *arg) {
+    struct viosim_replay     *replay = arg;
+    struct viosim_replay_req *req;
+    struct timespec           due_ts;
+
+    unsigned long i;
+
+    uint64_t base = replay->reqs[0].issue_ns;
+    uint64_t due, now;
+
+    ssize_t done;
+
+    void *buffer;
+
+    if (posix_memalign(&buffer, REPLAY_BUFFER_ALIGN, replay->max_bytes) != 0) {
+        __atomic_fetch_add(&replay->errors, 1, __ATOMIC_RELAXED);
+
+        return NULL;
+    }
+
+    memset(buffer, 0xa5, replay->max_bytes);
+
+    while (!viosim_replay_stop) {
+        i = __atomic_fetch_add(&replay->next, 1, __ATOMIC_RELAXED);
+
+        if (i >= replay->nr_reqs) {
+            break;
+        }
+
+        req = &replay->reqs[i];
+        due = replay->start_ns
+            + (uint64_t) ((req->issue_ns - base) * replay->scale);
+        now = _viosim_now_ns();
+
+        if (now < due) {
+            due_ts.tv_sec  = due / 1000000000UL;
+            due_ts.tv_nsec = due % 1000000000UL;
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due_ts, NULL);
+
+            now = _viosim_now_ns();
+        } else if ((replay->scale > 0) && ((now - due) > REPLAY_LATE_NS)) {
+            /* All jobs were busy: the device is slower than it was. */
+            __atomic_fetch_add(&replay->late, 1, __ATOMIC_RELAXED);
+        }
+
+        if (req->op == DEVICE_TRACE_OP_WRITE) {
+            done = pwrite(replay->devnode, buffer, req->bytes,
+                          req->sector * DEVICE_SECTOR_SIZE);
+        } else {
+            done = pread(replay->devnode,  buffer, req->bytes,
+                          req->sector * DEVICE_SECTOR_SIZE);
+        }
+
+        if (done == (ssize_t) req->bytes) {
+            req->lat_ns = _viosim_now_ns() - now;
+
+            /* (A latency of 0 tells a failed request.) */
+            if (req->lat_ns == 0) {
+                req->lat_ns = 1;
+            }
+        } else {
+            __atomic_fetch_add(&replay->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    free(buffer);
+
+    return NULL;
+}
+
+/**
+ * Prints the original and replayed latencies of an operation side by side.
+ *
+ * @param replay The replay done.
+ * @param op     The operation (<code>DEVICE_TRACE_OP_*</code>).
+ * @param name   The operation name.
+ * @param orig   The buffer to sort the original latencies in.
+ * @param lat    The buffer to sort the replayed latencies in.
+ */
+static void viosim_replay_report(const struct viosim_replay *replay,
+                                 const uint16_t              op,
+                                 const char                 *name,
+                                       uint64_t             *orig,
+                                       uint64_t             *lat) {
+
+    unsigned long n = 0UL;
+    unsigned long i;
+
+    double orig_sum = 0.0, sum = 0.0;
+    double orig_mean, mean, orig_p99, p99;
+
+    for (i = 0; i < replay->nr_reqs; i++) {
+        /* Comparing the requests replayed only. */
+        if ((replay->reqs[i].op != op) || (replay->reqs[i].lat_ns == 0)) {
+            continue;
+        }
+
+        orig[n]   = replay->reqs[i].orig_lat_ns;
+        lat[n]    = replay->reqs[i].lat_ns;
+        orig_sum += orig[n];
+        sum      += lat[n];
+
+        n++;
+    }
+
+    if (n == 0UL) {
+        return;
+    }
+
+    qsort(orig, n, sizeof(*orig), _viosim_lat_cmp);
+    qsort(lat,  n, sizeof(*lat),  _viosim_lat_cmp);
+
+    orig_mean = orig_sum / n;
+    mean      = sum      / n;
+    orig_p99  = orig[(n * 99) / 100];
+    p99       = lat[(n * 99) / 100];
+
+    printf(_REPLAY_LAT_MSG _NEW_LINE, name, n,
+           orig_mean / 1e3, orig[n / 2] / 1e3, orig_p99 / 1e3,
+           mean      / 1e3, lat[n / 2]  / 1e3, p99      / 1e3,
+           (orig_mean > 0) ? ((mean / orig_mean - 1.0) * 100.0) : 0.0,
+           (orig_p99  > 0) ? ((p99  / orig_p99  - 1.0) * 100.0) : 0.0);
+}
+
+/**
+ * Replays the trace against the device and compares the latencies.
+ *
+ * @param devnode_name The device node to replay against.
+ * @param trace_file   The trace file to replay.
+ * @param scale        The time scale.
+ * @param jobs         The max number of requests in flight.
+ * @param app_name     The name of the application executable.
+ *
+ * @return The exit code indicating the replay status.
+ */
+static int viosim_replay_run(const char          *devnode_name,
+                             const char          *trace_file,
+                             const double         scale,
+                             const unsigned long  jobs,
+                             const char          *app_name) {
+
+    int ret = EXIT_SUCCESS;
+
+    struct viosim_replay replay;
+
+    pthread_t *threads;
+
+    uint64_t *orig, *lat, elapsed;
+
+    unsigned long started = 0UL;
+    unsigned long i;
+
+    memset(&replay, 0, sizeof(replay));
+
+    replay.scale = scale;
+
+    if (viosim_replay_load(&replay, trace_file, app_name) != EXIT_SUCCESS) {
+        free(replay.reqs);
+
+        return EXIT_FAILURE;
+    }
+
+    replay.devnode = open(devnode_name, O_RDWR | O_DIRECT);
+
+    if (replay.devnode < 0) {
+        fprintf(stderr, _DEVNODE_OPEN_FAILED_ERR _NEW_LINE,
+                app_name, strerror(errno));
+
+        free(replay.reqs);
+
+        return EXIT_FAILURE;
+    }
+
+    threads = calloc(jobs, sizeof(*threads));
+
+    if (threads == NULL) {
+        fprintf(stderr, _REPLAY_ALLOC_FAILED_ERR _NEW_LINE, app_name);
+
+        close(replay.devnode);
+        free(replay.reqs);
+
+        return EXIT_FAILURE;
+    }
+
+    replay.start_ns = _viosim_now_ns();
+
+    for (i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, viosim_replay_job,
+                           &replay) != 0) {
+
+            break;
+        }
+
+        started++;
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    elapsed = _viosim_now_ns() - replay.start_ns;
+
+    printf(_REPLAY_SUMMARY_MSG _NEW_LINE, replay.nr_reqs, replay.errors,
+           replay.late,
+           (replay.reqs[replay.nr_reqs - 1].issue_ns
+          + replay.reqs[replay.nr_reqs - 1].orig_lat_ns
+          - replay.reqs[0].issue_ns) / 1e9, elapsed / 1e9);
+
+    orig = calloc(replay.nr_reqs, sizeof(*orig));
+    lat  = calloc(replay.nr_reqs, sizeof(*lat));
+
+    if ((orig != NULL) && (lat != NULL)) {
+        printf(_REPLAY_LAT_HEADER_MSG _NEW_LINE);
+
+        viosim_replay_report(&replay, DEVICE_TRACE_OP_READ,  "read",
+                             orig, lat);
+        viosim_replay_report(&replay, DEVICE_TRACE_OP_WRITE, "write",
+                             orig, lat);
+    } else {
+        fprintf(stderr, _REPLAY_ALLOC_FAILED_ERR _NEW_LINE, app_name);
+
+        ret = EXIT_FAILURE;
+    }
+
+    if ((started == 0UL) || (replay.errors > 0UL)) {
+        ret = EXIT_FAILURE;
+    }
+
+    free(lat);
+    free(orig);
+    free(threads);
+
+    if (close(replay.devnode) < 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    free(replay.reqs);
+
+    return ret;
+}
+
+/* The utility entry point. */
+int main(int argc, char *const *argv) {
+    struct sigaction sa;
+
+    double        scale = REPLAY_SCALE_DEF;
+    unsigned long jobs  = REPLAY_JOBS_DEF;
+
+    int i;
+
+    if ((argc < 3) || ((argv[1][0] == '-')
+                   && (strcmp(argv[1], _REPLAY_CAPTURE_OPT) != 0))) {
+
+        fprintf(stderr, _REPLAY_USAGE_MSG _NEW_LINE);
+
+        return EXIT_FAILURE;
+    }
+
+    /* Parsing options following the device node and the trace file. */
+    for (i = 3; i < argc; i++) {
+        if (strcmp(argv[i], _PRINT_BANNER_OPT) == 0) {
+            printf(_REPLAY_APP_NAME _COMMA_SPACE_SEP                         \
+                   _APP_VERSION_S__ _ONE_SPACE_STRING _APP_VERSION _NEW_LINE \
+                   _REPLAY_APP_DESCRIPTION                         _NEW_LINE \
+                   _APP_COPYRIGHT__ _ONE_SPACE_STRING _APP_AUTHOR  _NEW_LINE);
+        } else if ((strcmp(argv[i], _REPLAY_SCALE_OPT) == 0)
+                   && (i + 1 < argc)) {
+
+            scale = strtod(argv[++i], NULL);
+        } else if ((strcmp(argv[i], _REPLAY_JOBS_OPT)  == 0)
+                   && (i + 1 < argc)) {
+
+            jobs  = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, _CLI_OPTION_INVALID_ERR _NEW_LINE,
+                    argv[0], argv[i]);
+
+            fprintf(stderr, _REPLAY_USAGE_MSG _NEW_LINE);
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (scale < 0) {
+        scale = 0;
+    }
+
+    if (jobs == 0) {
+        jobs = 1;
+    } else if (jobs > REPLAY_JOBS_MAX) {
+        jobs = REPLAY_JOBS_MAX;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+
+    sa.sa_handler = _viosim_replay_signal;
+
+    sigemptyset(&sa.sa_mask);
+
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (strcmp(argv[1], _REPLAY_CAPTURE_OPT) == 0) {
+        return viosim_replay_capture(argv[2], argv[0]);
+    }
+
+    return viosim_replay_run(argv[1], argv[2], scale, jobs, argv[0]);
+}
+
+/* vim:set nu et ts=4 sw=4: */
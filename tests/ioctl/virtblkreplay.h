@@ -0,0 +1,177 @@
+/*
+ * tests/ioctl/virtblkreplay.h
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This utility captures the I/O trace the driver records and replays it
+ * against the device with O_DIRECT, comparing the latencies.
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#ifndef __VIRTBLKREPLAY_H
+#define __VIRTBLKREPLAY_H
+
+#include "virtblkioctl.h"
+
+#include <limits.h>
+
+/* Utility name banner. */
+#define _REPLAY_APP_NAME        "VIRTual BLocK I/O Trace Replay (virtblkreplay)"
+#define _REPLAY_APP_DESCRIPTION \
+         "Captures the driver's I/O trace and replays it with O_DIRECT"
+
+/** Constants: The utility's command line options. */
+#define _REPLAY_CAPTURE_OPT "-c"
+#define _REPLAY_SCALE_OPT   "-s"
+#define _REPLAY_JOBS_OPT    "-j"
+
+/** Constant: Print this usage info when the args passed are wrong. */
+#define _REPLAY_USAGE_MSG \
+         "Usage: virtblkreplay -c <trace_file>"                                       _NEW_LINE \
+         "       virtblkreplay <device_node> <trace_file> [options]"                  _NEW_LINE \
+                                                                                      _NEW_LINE \
+         "       -c <trace_file>     Capture the trace the driver records (loaded"    _NEW_LINE \
+         "                           with trace_kb set and trace=1) to the file,"     _NEW_LINE \
+         "                           until <Ctrl+C>"                                  _NEW_LINE \
+         "       <device_node>       Something like " _DEVNODE_HUB _MODULE_NAME       _NEW_LINE \
+         "                           (writes in the trace overwrite its data)"        _NEW_LINE \
+                                                                                      _NEW_LINE \
+         "       [options]           Any of the following:"                           _NEW_LINE \
+         "           -V              Print the app banner"                            _NEW_LINE \
+         "           -s <scale>      Scale the time between requests (default: 1"     _NEW_LINE \
+         "                           - original timing; 0 - as fast as possible)"     _NEW_LINE \
+         "           -j <jobs>       Max requests in flight (default: 32)"            _NEW_LINE
+
+/** Constant: The directory holding the driver's per-CPU trace files. */
+#define _REPLAY_TRACE_DIR "/sys/kernel/debug/" _MODULE_NAME "/"
+
+/** Constant: The name of a per-CPU trace file, given the CPU number. */
+#define _REPLAY_TRACE_CPU_FILE _REPLAY_TRACE_DIR "trace-cpu%ld"
+
+/** Constant: Print this when no per-CPU trace file can be opened. */
+#define _REPLAY_NO_TRACE_ERR \
+         "%s: No trace files in " _REPLAY_TRACE_DIR \
+         " (is the driver loaded with trace_kb set?)"
+
+/** Constant: Print this when the trace file cannot be opened or read. */
+#define _REPLAY_TRACE_FILE_ERR "%s: Cannot use trace file %s: %s"
+
+/** Constant: Print this when the trace file holds no records. */
+#define _REPLAY_TRACE_EMPTY_ERR "%s: No requests in trace file %s"
+
+/** Constant: Print this when the replay buffers cannot be allocated. */
+#define _REPLAY_ALLOC_FAILED_ERR "%s: Cannot allocate replay buffers"
+
+/** Constant: Print this once the trace is captured. */
+#define _REPLAY_CAPTURED_MSG "Captured: %lu requests (from %ld CPUs) to %s"
+
+/** Constant: Print this as the replay timing summary. */
+#define _REPLAY_SUMMARY_MSG                                          \
+         "Requests: %lu | Errors: %lu | Late: %lu"                   \
+         " | Original: %.3f s | Replay: %.3f s"
+
+/** Constant: Print this as the latency comparison header. */
+#define _REPLAY_LAT_HEADER_MSG                                       \
+         "op       count    orig_mean_us  orig_p50_us  orig_p99_us"  \
+         "  mean_us    p50_us    p99_us   mean%%    p99%%"
+
+/** Constant: Print this as the latency comparison line of an operation. */
+#define _REPLAY_LAT_MSG                                              \
+         "%-5s %8lu    %12.1f %12.1f %12.1f %8.1f %9.1f %9.1f %+7.1f %+7.1f"
+
+/** Constants: The replay defaults. */
+#define REPLAY_SCALE_DEF  1.0
+#define REPLAY_JOBS_DEF  32
+
+/** Constant: The max number of replay jobs. */
+#define REPLAY_JOBS_MAX 1024
+
+/** Constant: How late (ns) a request may be issued not to be counted late. */
+#define REPLAY_LATE_NS 1000000UL
+
+/** Constant: How long (ns) capturing sleeps when the trace files are drained. */
+#define REPLAY_CAPTURE_IDLE_NS 100000000L
+
+/** Constant: The number of trace records read at a time. */
+#define REPLAY_CAPTURE_BATCH 2048
+
+/** Constant: The alignment of O_DIRECT buffers. */
+#define REPLAY_BUFFER_ALIGN 4096
+
+/** Constants: The operations recorded in the trace (as by the driver). */
+#define DEVICE_TRACE_OP_READ  0
+#define DEVICE_TRACE_OP_WRITE 1
+
+/** Constant: The sector size the trace LBAs are in. */
+#define DEVICE_SECTOR_SIZE 512
+
+/** The structure to describe a trace record (as logged by the driver). */
+struct viosim_trace_rec {
+    /** The time (ns, monotonic clock) the request was completed at. */
+    uint64_t time_ns;
+
+    /** The time (ns) from the request being issued till completed. */
+    uint64_t lat_ns;
+
+    /** The first sector (LBA, 512 bytes each). */
+    uint64_t sector;
+
+    /** The request size in bytes. */
+    uint32_t bytes;
+
+    /** The operation (<code>DEVICE_TRACE_OP_*</code>). */
+    uint16_t op;
+
+    /** Whether the request failed. */
+    uint16_t error;
+};
+
+/** The structure to hold a request of the trace being replayed. */
+struct viosim_replay_req {
+    /** The time (ns) the request was issued at originally. */
+    uint64_t issue_ns;
+
+    /** The original and the replayed latency (ns; 0 - replay failed). */
+    uint64_t orig_lat_ns;
+    uint64_t lat_ns;
+
+    /** The first sector, the size in bytes, and the operation. */
+    uint64_t sector;
+    uint32_t bytes;
+    uint16_t op;
+};
+
+/** The structure to hold the replay shared by its jobs. */
+struct viosim_replay {
+    /** The device node replayed against. */
+    int devnode;
+
+    /** The requests, sorted by the time they were issued at. */
+    struct viosim_replay_req *reqs;
+    unsigned long             nr_reqs;
+
+    /** The size of the largest request (of the job buffers). */
+    uint32_t max_bytes;
+
+    /** The time scale. */
+    double scale;
+
+    /** The time (ns) the replay started at. */
+    uint64_t start_ns;
+
+    /** The next request to issue (taken by the jobs atomically). */
+    unsigned long next;
+
+    /** The requests issued late, and those failed. */
+    unsigned long late;
+    unsigned long errors;
+};
+
+#endif /* __VIRTBLKREPLAY_H */
+
+/* vim:set nu et ts=4 sw=4: */
@@ -0,0 +1,175 @@
+/*
+ * tests/iofio/virtblkiofio-engine.c
+ * ============================================================================
+ * VIRTual BLocK IO SIMulating (virtblkiosim). Version 0.9.10
+ * ============================================================================
+ * Virtual Linux block device driver for simulating and performing I/O.
+ *
+ * This fio external ioengine acts as the user space FTL responder:
+ * each fio I/O serves one device request through the ioctl() handshake
+ * (GET_REQUEST_SIZE, GET_BLOCK, SET_BLOCK), answering it with
+ * the identity mapping, so that fio's rate limits, latency percentiles
+ * and JSON output apply to the user-FTL path.
+ *
+ * Build it against a configured fio source tree (see Makefile), then use it
+ * as ioengine=external:tests/iofio/virtblkiofio-engine.so along with a job
+ * generating the device traffic (see virtblkiofio-03-ftl.fio).
+ * ============================================================================
+ * Copyright (C) 2016-2026 Radislav (Radicchio) Golubtsov
+ *
+ * (See the LICENSE file at the top of the source tree.)
+ */
+
+#include "../ioctl/virtblkioctl.h"
+
+#include "fio.h"
+
+/** The engine's per-job data. */
+struct viosim_fio_data {
+    /** The request mapping entries buffer. */
+    struct viosim_request_map req_map[DEVICE_REQ_MAP_ENTRIES_MAX];
+};
+
+/* Allocates the engine's per-job data. */
+static int fio_viosim_init(struct thread_data *td) {
+    struct viosim_fio_data *data = calloc(1, sizeof(*data));
+
+    if (data == NULL) {
+        return 1;
+    }
+
+    td->io_ops_data = data;
+
+    return 0;
+}
+
+/* Releases the engine's per-job data. */
+static void fio_viosim_cleanup(struct thread_data *td) {
+    free(td->io_ops_data);
+
+    td->io_ops_data = NULL;
+}
+
+/* Opens the device node and registers the job as the FTL. */
+static int fio_viosim_open_file(struct thread_data *td, struct fio_file *f) {
+    f->fd = open(f->file_name, O_RDWR);
+
+    if (f->fd < 0) {
+        td_verror(td, errno, "open");
+
+        return 1;
+    }
+
+    if (ioctl(f->fd, DEVICE_IOCTL_REG_USER_CALLER, 0) < 0) {
+        td_verror(td, errno, "ioctl");
+
+        close(f->fd);
+
+        f->fd = -1;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Closes the device node, which unregisters the FTL. */
+static int fio_viosim_close_file(struct thread_data *td, struct fio_file *f) {
+    int ret = close(f->fd);
+
+    f->fd = -1;
+
+    return (ret < 0) ? errno : 0;
+}
+
+/* There is no page cache in front of the handshake to invalidate. */
+static int fio_viosim_invalidate(struct thread_data *td, struct fio_file *f) {
+    return 0;
+}
+
+/*
+ * Makes a blocking handshake ioctl() call, retrying when interrupted
+ * unless fio is terminating the job.
+ */
+static int _fio_viosim_ioctl(struct thread_data *td, const int fd,
+                             const unsigned long request, void *arg) {
+
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while ((ret < 0) && (errno == EINTR) && !td->terminate);
+
+    return (ret < 0) ? errno : 0;
+}
+
+/*
+ * Serves one device request: the io_u buffer is not used, the I/O direction
+ * only tells fio how to account for it.
+ */
+static enum fio_q_status fio_viosim_queue(struct thread_data *td,
+                                          struct io_u        *io_u) {
+
+    struct viosim_fio_data *data = td->io_ops_data;
+
+    unsigned long req_size;
+    unsigned long i;
+
+    int fd = io_u->file->fd;
+
+    fio_ro_check(td, io_u);
+
+    if ((io_u->ddir != DDIR_READ) && (io_u->ddir != DDIR_WRITE)) {
+        return FIO_Q_COMPLETED;
+    }
+
+    /* Sizing... (blocks until a request arrives) */
+    io_u->error = _fio_viosim_ioctl(td, fd, DEVICE_IOCTL_GET_REQUEST_SIZE,
+                                    &req_size);
+
+    if (io_u->error != 0) {
+        return FIO_Q_COMPLETED;
+    }
+
+    /* Reading... */
+    io_u->error = _fio_viosim_ioctl(td, fd, DEVICE_IOCTL_GET_BLOCK,
+                                    data->req_map);
+
+    /* The request is gone (e.g. served by a previous FTL): next one. */
+    if (io_u->error == EAGAIN) {
+        io_u->error = 0;
+
+        return FIO_Q_COMPLETED;
+    }
+
+    if (io_u->error != 0) {
+        return FIO_Q_COMPLETED;
+    }
+
+    /* Converting LPN to PPN (and to the new PPN for writes). */
+    for (i = 0; (i < req_size) && (i < DEVICE_REQ_MAP_ENTRIES_MAX); i++) {
+        data->req_map[i].page_map.ppn  = data->req_map[i].page_map.lpn;
+        data->req_map[i].page_map.ppnx = data->req_map[i].page_map.lpn;
+    }
+
+    /* Writing... */
+    io_u->error = _fio_viosim_ioctl(td, fd, DEVICE_IOCTL_SET_BLOCK,
+                                    data->req_map);
+
+    return FIO_Q_COMPLETED;
+}
+
+/** The engine as looked up by fio (ioengine=external:...). */
+struct ioengine_ops ioengine = {
+    .name       = "virtblkiosim",
+    .version    = FIO_IOOPS_VERSION,
+    .flags      = FIO_SYNCIO | FIO_NOEXTEND | FIO_NODISKUTIL,
+    .init       = fio_viosim_init,
+    .cleanup    = fio_viosim_cleanup,
+    .queue      = fio_viosim_queue,
+    .open_file  = fio_viosim_open_file,
+    .close_file = fio_viosim_close_file,
+    .invalidate = fio_viosim_invalidate,
+};
+
+/* vim:set nu et ts=4 sw=4: */